@@ -0,0 +1,82 @@
+#include "can_bit_timing.h"
+
+#define CAN_TQ_MIN  8   // 1 sync + tseg1 + tseg2, theo chuẩn CAN
+#define CAN_TQ_MAX  25
+
+static uint32_t udiff(uint32_t a, uint32_t b)
+{
+    return a > b ? a - b : b - a;
+}
+
+bool can_bit_timing_calc(const can_bit_timing_limits_t *lim, uint32_t bitrate,
+                         uint16_t sample_point, uint32_t max_err_ppm,
+                         can_bit_timing_t *out)
+{
+    if (!lim || !out || bitrate == 0 || sample_point == 0 || sample_point >= 1000) {
+        return false;
+    }
+
+    bool     found    = false;
+    uint32_t best_err = 0, best_sp_err = 0, best_tq = 0;
+
+    for (uint32_t tq = CAN_TQ_MIN; tq <= CAN_TQ_MAX; tq++) {
+        if (tq > 1u + lim->tseg1_max + lim->tseg2_max) {
+            break;
+        }
+
+        // brp gần nhất cho số TQ này (làm tròn, rồi chỉnh cho chẵn nếu cần)
+        uint64_t div = (uint64_t)bitrate * tq;
+        uint32_t brp = (uint32_t)(((uint64_t)lim->clk_hz + div / 2) / div);
+        if (lim->brp_even && (brp & 1u)) {
+            uint32_t lo = brp - 1, hi = brp + 1;
+            uint32_t rlo = lo ? lim->clk_hz / (lo * tq) : 0;
+            uint32_t rhi = lim->clk_hz / (hi * tq);
+            brp = (lo && udiff(rlo, bitrate) <= udiff(rhi, bitrate)) ? lo : hi;
+        }
+        if (brp < lim->brp_min || brp > lim->brp_max) {
+            continue;
+        }
+
+        uint32_t actual = lim->clk_hz / (brp * tq);
+        uint32_t err    = (uint32_t)((uint64_t)udiff(actual, bitrate) * 1000000u / bitrate);
+        if (err > max_err_ppm) {
+            continue;
+        }
+
+        // tseg2 = phần sau điểm lấy mẫu, làm tròn rồi kẹp vào giới hạn phần cứng
+        uint32_t tseg2 = (tq * (1000u - sample_point) + 500u) / 1000u;
+        if (tseg2 < 1) tseg2 = 1;
+        if (tseg2 > lim->tseg2_max) tseg2 = lim->tseg2_max;
+        uint32_t tseg1 = tq - 1 - tseg2;
+        if (tseg1 > lim->tseg1_max) {
+            tseg1 = lim->tseg1_max;
+            tseg2 = tq - 1 - tseg1;
+            if (tseg2 > lim->tseg2_max) {
+                continue;
+            }
+        }
+        if (tseg1 < 1) {
+            continue;
+        }
+
+        uint32_t sp     = (1000u * (1 + tseg1)) / tq;
+        uint32_t sp_err = udiff(sp, sample_point);
+
+        bool better = !found || err < best_err ||
+                      (err == best_err && (sp_err < best_sp_err ||
+                                           (sp_err == best_sp_err && tq > best_tq)));
+        if (better) {
+            found       = true;
+            best_err    = err;
+            best_sp_err = sp_err;
+            best_tq     = tq;
+            out->brp          = brp;
+            out->tseg1        = (uint8_t)tseg1;
+            out->tseg2        = (uint8_t)tseg2;
+            out->sjw          = (uint8_t)(tseg2 < lim->sjw_max ? tseg2 : lim->sjw_max);
+            out->bitrate      = actual;
+            out->sample_point = (uint16_t)sp;
+        }
+    }
+    return found;
+}
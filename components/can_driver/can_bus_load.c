@@ -0,0 +1,136 @@
+#include "can_bus_load.h"
+
+#include <stddef.h>
+
+// Giới hạn tìm kiếm của can_bus_load_max_axes
+#define CAN_BUS_LOAD_AXES_LIMIT  4096
+
+uint32_t can_frame_bits_max(uint8_t dlc, bool extended)
+{
+    if (dlc > 8) {
+        dlc = 8;
+    }
+    // Phần bị stuffing: SOF .. CRC (standard 34 + 8n bit, extended 54 + 8n bit).
+    // Worst-case thêm 1 bit sau mỗi 4 bit kể từ bit thứ 2 của chuỗi stuff.
+    uint32_t stuffed = (extended ? 54u : 34u) + 8u * dlc;
+    // CRC delimiter + ACK slot/delimiter + EOF (7) + interframe space (3)
+    uint32_t tail = 1u + 2u + 7u + 3u;
+
+    return stuffed + tail + (stuffed - 1u) / 4u;
+}
+
+// Bộ đếm bit stuffing + CRC-15 chạy song song theo từng bit (SOF .. hết data)
+typedef struct {
+    uint32_t bits;      // số bit đã phát kể cả bit stuff
+    uint16_t crc;
+    int      last;      // bit cuối trên bus (kể cả bit stuff), -1 = chưa có
+    int      run;       // số bit giống nhau liên tiếp
+} can_bitstream_t;
+
+static void bs_put(can_bitstream_t *bs, int bit, bool crc)
+{
+    if (crc) {
+        int fb = bit ^ ((bs->crc >> 14) & 1);
+        bs->crc = (uint16_t)((bs->crc << 1) & 0x7FFF);
+        if (fb) {
+            bs->crc ^= 0x4599;
+        }
+    }
+
+    bs->bits++;
+    if (bit == bs->last) {
+        bs->run++;
+    } else {
+        bs->last = bit;
+        bs->run  = 1;
+    }
+    // 5 bit giống nhau -> chèn 1 bit ngược lại, bit này bắt đầu chuỗi mới
+    if (bs->run == 5) {
+        bs->bits++;
+        bs->last = !bit;
+        bs->run  = 1;
+    }
+}
+
+static void bs_put_field(can_bitstream_t *bs, uint32_t value, int n_bits)
+{
+    for (int i = n_bits - 1; i >= 0; i--) {
+        bs_put(bs, (value >> i) & 1, true);
+    }
+}
+
+uint32_t can_frame_bits(uint32_t id, bool extended, bool rtr, uint8_t dlc, const uint8_t *data)
+{
+    can_bitstream_t bs = { .bits = 0, .crc = 0, .last = -1, .run = 0 };
+    uint8_t n_data = (rtr || !data) ? 0 : (dlc > 8 ? 8 : dlc);
+
+    bs_put(&bs, 0, true);                               // SOF
+    if (extended) {
+        bs_put_field(&bs, (id >> 18) & 0x7FF, 11);      // base ID
+        bs_put(&bs, 1, true);                           // SRR
+        bs_put(&bs, 1, true);                           // IDE
+        bs_put_field(&bs, id & 0x3FFFF, 18);            // ID mở rộng
+        bs_put(&bs, rtr, true);
+        bs_put_field(&bs, 0, 2);                        // r1, r0
+    } else {
+        bs_put_field(&bs, id & 0x7FF, 11);
+        bs_put(&bs, rtr, true);
+        bs_put_field(&bs, 0, 2);                        // IDE, r0
+    }
+    bs_put_field(&bs, dlc & 0x0F, 4);
+    for (uint8_t i = 0; i < n_data; i++) {
+        bs_put_field(&bs, data[i], 8);
+    }
+
+    // CRC-15 cũng bị stuffing, nhưng không đưa vào tính CRC
+    uint16_t crc = bs.crc;
+    for (int i = 14; i >= 0; i--) {
+        bs_put(&bs, (crc >> i) & 1, false);
+    }
+
+    // CRC delimiter + ACK slot/delimiter + EOF (7) + interframe space (3)
+    return bs.bits + 1u + 2u + 7u + 3u;
+}
+
+static uint32_t div_ceil(uint32_t a, uint32_t b)
+{
+    return (a + b - 1u) / b;
+}
+
+uint64_t can_bus_load_bits_per_s(const can_bus_load_cfg_t *cfg, uint32_t n_axes)
+{
+    if (!cfg || cfg->axes_per_frame == 0) {
+        return 0;
+    }
+
+    uint64_t cmd_frames = div_ceil(n_axes, cfg->axes_per_frame);
+    uint64_t bits = cmd_frames * cfg->loop_hz * can_frame_bits_max(cfg->cmd_dlc, cfg->extended);
+
+    bits += (uint64_t)n_axes * cfg->feedback_hz *
+            can_frame_bits_max(cfg->feedback_dlc, cfg->extended);
+    bits += (uint64_t)cfg->extra_frames_hz * can_frame_bits_max(8, cfg->extended);
+    return bits;
+}
+
+uint32_t can_bus_load_permille(const can_bus_load_cfg_t *cfg, uint32_t n_axes)
+{
+    if (!cfg || cfg->bitrate == 0) {
+        return 0;
+    }
+    return (uint32_t)(can_bus_load_bits_per_s(cfg, n_axes) * 1000u / cfg->bitrate);
+}
+
+uint32_t can_bus_load_max_axes(const can_bus_load_cfg_t *cfg, uint32_t max_permille)
+{
+    if (!cfg || cfg->bitrate == 0 || cfg->axes_per_frame == 0) {
+        return 0;
+    }
+
+    // Tải tăng đơn điệu theo số trục -> dừng ở trục đầu tiên vượt ngưỡng
+    uint64_t budget = (uint64_t)cfg->bitrate * max_permille / 1000u;
+    uint32_t n = 0;
+    while (n < CAN_BUS_LOAD_AXES_LIMIT && can_bus_load_bits_per_s(cfg, n + 1) <= budget) {
+        n++;
+    }
+    return n;
+}
@@ -1,19 +1,307 @@
 #include "can_driver.h"
+#include "can_bus_load.h"
+#include "can_bit_timing.h"
+#include "sdkconfig.h"
+#include <string.h>
 #include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/task.h"
 
 static const char *TAG = "CAN_DRIVER";
 
-esp_err_t can_driver_init(gpio_num_t tx_pin, gpio_num_t rx_pin)
+typedef struct {
+    uint32_t         id;
+    can_rx_handler_t fn;
+    void            *arg;
+} can_handler_entry_t;
+
+static can_handler_entry_t s_handlers[CAN_DRIVER_MAX_HANDLERS];
+static size_t              s_num_handlers  = 0;
+static uint8_t             s_id_slot[TWAI_STD_ID_MASK + 1];   // ID -> handler index + 1, 0 = none
+static can_rx_handler_t    s_default_fn    = NULL;
+static void               *s_default_arg   = NULL;
+static TaskHandle_t        s_dispatch_task = NULL;
+
+#define CAN_TX_TASK_PRIO        (configMAX_PRIORITIES - 3)
+#define CAN_TX_DONE_TIMEOUT_MS  20
+
+typedef struct {
+    twai_message_t msg;
+    int64_t        enqueue_us;
+} can_tx_slot_t;
+
+static can_tx_slot_t    s_txq[CAN_DRIVER_TX_QUEUE_LEN];   // sắp theo ưu tiên, [0] gửi trước
+static size_t           s_txq_len    = 0;
+static portMUX_TYPE     s_txq_mux    = portMUX_INITIALIZER_UNLOCKED;
+static TaskHandle_t     s_tx_task    = NULL;
+static can_tx_done_cb_t s_tx_done_cb[CAN_DRIVER_MAX_TX_DONE_CBS];
+static void            *s_tx_done_arg[CAN_DRIVER_MAX_TX_DONE_CBS];
+static volatile size_t  s_tx_done_n  = 0;
+static can_tx_stats_t   s_tx_stats;
+
+static void can_tx_task(void *arg);
+
+static uint8_t s_node_id = 0;
+
+// Health monitor: bit thật trên bus của frame TX (TX task) / RX (dispatch task)
+static uint32_t          s_bitrate = CONFIG_CAN_DRIVER_BITRATE;
+static volatile uint32_t s_tx_bits = 0;
+static volatile uint32_t s_rx_bits = 0;
+static TaskHandle_t      s_health_task = NULL;
+static can_health_t      s_health;
+static portMUX_TYPE      s_health_mux  = portMUX_INITIALIZER_UNLOCKED;
+
+static inline uint32_t frame_bits(const twai_message_t *m)
+{
+    return can_frame_bits(m->identifier, m->extd, m->rtr, m->data_length_code, m->data);
+}
+
+/* ========= Acceptance filter ========= */
+
+// Nhóm ID dạng (code, mask): mọi ID có (id & ~mask) == code đều được nhận
+typedef struct {
+    uint32_t code;
+    uint32_t mask;
+} can_id_group_t;
+
+static can_id_group_t group_of_range(const can_id_range_t *r)
+{
+    uint32_t diff = (uint32_t)(r->first ^ r->last);
+    uint32_t mask = diff ? (0xFFFFFFFFu >> __builtin_clz(diff)) : 0;
+    return (can_id_group_t){ .code = r->first & ~mask, .mask = mask };
+}
+
+static can_id_group_t group_merge(can_id_group_t a, can_id_group_t b)
+{
+    uint32_t mask = a.mask | b.mask | (a.code ^ b.code);
+    return (can_id_group_t){ .code = a.code & ~mask, .mask = mask };
+}
+
+static can_id_group_t group_of_ranges(const can_id_range_t *r, size_t n)
+{
+    can_id_group_t g = group_of_range(&r[0]);
+    for (size_t i = 1; i < n; i++) {
+        g = group_merge(g, group_of_range(&r[i]));
+    }
+    return g;
+}
+
+static uint32_t group_size(can_id_group_t g)
 {
+    return 1u << __builtin_popcount(g.mask);
+}
+
+esp_err_t can_driver_calc_filter(const can_id_range_t *accept, size_t n_accept,
+                                 twai_filter_config_t *out)
+{
+    if (!out) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (!accept || n_accept == 0) {
+        *out = (twai_filter_config_t)TWAI_FILTER_CONFIG_ACCEPT_ALL();
+        return ESP_OK;
+    }
+
+    // Sắp xếp theo first để thử các cách chia thành 2 nhóm liên tiếp (dual filter)
+    can_id_range_t sorted[CAN_DRIVER_MAX_HANDLERS];
+    if (n_accept > CAN_DRIVER_MAX_HANDLERS) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    for (size_t i = 0; i < n_accept; i++) {
+        if (accept[i].first > accept[i].last || accept[i].last > TWAI_STD_ID_MASK) {
+            return ESP_ERR_INVALID_ARG;
+        }
+        size_t j = i;
+        while (j > 0 && sorted[j - 1].first > accept[i].first) {
+            sorted[j] = sorted[j - 1];
+            j--;
+        }
+        sorted[j] = accept[i];
+    }
+
+    can_id_group_t single = group_of_ranges(sorted, n_accept);
+    uint32_t best = group_size(single);
+    can_id_group_t g1 = single, g2 = single;
+    bool dual = false;
+
+    for (size_t k = 1; k < n_accept; k++) {
+        can_id_group_t a = group_of_ranges(sorted, k);
+        can_id_group_t b = group_of_ranges(&sorted[k], n_accept - k);
+        uint32_t size = group_size(a) + group_size(b);
+        if (size < best) {
+            best = size;
+            g1 = a;
+            g2 = b;
+            dual = true;
+        }
+    }
+
+    if (!dual) {
+        // Single filter: bit 31..21 = ID, RTR + data byte không quan tâm
+        out->acceptance_code = single.code << 21;
+        out->acceptance_mask = (single.mask << 21) | 0x001FFFFFu;
+        out->single_filter   = true;
+    } else {
+        // Dual filter: filter 1 = bit 31..21, filter 2 = bit 15..5; RTR/data không quan tâm
+        out->acceptance_code = (g1.code << 21) | (g2.code << 5);
+        out->acceptance_mask = (g1.mask << 21) | (g2.mask << 5) | 0x001F001Fu;
+        out->single_filter   = false;
+    }
+    return ESP_OK;
+}
+
+/* ========= Bitrate ========= */
+
+static uint16_t s_sample_point = CONFIG_CAN_DRIVER_SAMPLE_POINT;
+static bool     s_installed    = false;
+
+// Lệch bitrate tối đa chấp nhận được (chuẩn cho phép tổng ~1.5% cả 2 đầu)
+#define CAN_BITRATE_MAX_ERR_PPM  5000
+
+static esp_err_t make_timing(uint32_t bitrate, uint16_t sample_point,
+                             twai_timing_config_t *out, can_bit_timing_t *bt)
+{
+    const can_bit_timing_limits_t lim = CAN_BIT_TIMING_LIMITS_ESP32C3();
+    if (!can_bit_timing_calc(&lim, bitrate, sample_point, CAN_BITRATE_MAX_ERR_PPM, bt)) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    *out = (twai_timing_config_t){
+        .clk_src              = TWAI_CLK_SRC_DEFAULT,
+        .quanta_resolution_hz = 0,   // dùng brp trực tiếp
+        .brp                  = bt->brp,
+        .tseg_1               = bt->tseg1,
+        .tseg_2               = bt->tseg2,
+        .sjw                  = bt->sjw,
+        .triple_sampling      = false,
+    };
+    return ESP_OK;
+}
+
+esp_err_t can_driver_set_bitrate(uint32_t bitrate, uint16_t sample_point)
+{
+    if (s_installed) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (sample_point == 0) {
+        sample_point = CONFIG_CAN_DRIVER_SAMPLE_POINT;
+    }
+    twai_timing_config_t t;
+    can_bit_timing_t bt;
+    esp_err_t ret = make_timing(bitrate, sample_point, &t, &bt);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "No bit timing for %u bit/s", (unsigned)bitrate);
+        return ret;
+    }
+    s_bitrate      = bitrate;
+    s_sample_point = sample_point;
+    return ESP_OK;
+}
+
+uint32_t can_driver_get_bitrate(void)
+{
+    return s_bitrate;
+}
+
+static const uint32_t s_auto_baud_default[] = {
+    1000000, 800000, 500000, 250000, 125000, 100000, 50000, 20000, 10000,
+};
+
+esp_err_t can_driver_auto_baud(gpio_num_t tx_pin, gpio_num_t rx_pin,
+                               const uint32_t *candidates, size_t n_candidates,
+                               uint32_t window_ms, uint32_t *found)
+{
+    if (s_installed) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (!candidates || n_candidates == 0) {
+        candidates   = s_auto_baud_default;
+        n_candidates = sizeof(s_auto_baud_default) / sizeof(s_auto_baud_default[0]);
+    }
+
+    // Listen-only: không ACK, không gửi error frame -> không phá bus khi sai bitrate
     twai_general_config_t g_config =
-        TWAI_GENERAL_CONFIG_DEFAULT(tx_pin, rx_pin, TWAI_MODE_NORMAL);
-    twai_timing_config_t t_config = TWAI_TIMING_CONFIG_500KBITS();
+        TWAI_GENERAL_CONFIG_DEFAULT(tx_pin, rx_pin, TWAI_MODE_LISTEN_ONLY);
+    g_config.rx_queue_len = 4;
     twai_filter_config_t f_config = TWAI_FILTER_CONFIG_ACCEPT_ALL();
 
+    for (size_t i = 0; i < n_candidates; i++) {
+        twai_timing_config_t t_config;
+        can_bit_timing_t bt;
+        if (make_timing(candidates[i], s_sample_point, &t_config, &bt) != ESP_OK) {
+            continue;
+        }
+        esp_err_t ret = twai_driver_install(&g_config, &t_config, &f_config);
+        if (ret != ESP_OK) {
+            return ret;
+        }
+        twai_start();
+
+        // Cần 2 frame CRC đúng liên tiếp trong cửa sổ: bitrate sai gần như
+        // không thể cho ra frame hợp lệ, 2 frame loại trường hợp trùng ngẫu nhiên
+        twai_message_t msg;
+        int ok = 0;
+        int64_t end = esp_timer_get_time() + (int64_t)window_ms * 1000;
+        while (ok < 2) {
+            int64_t left_ms = (end - esp_timer_get_time()) / 1000;
+            if (left_ms <= 0 ||
+                twai_receive(&msg, pdMS_TO_TICKS((uint32_t)left_ms) + 1) != ESP_OK) {
+                break;
+            }
+            ok++;
+        }
+
+        twai_stop();
+        twai_driver_uninstall();
+
+        if (ok >= 2) {
+            s_bitrate = candidates[i];
+            if (found) {
+                *found = candidates[i];
+            }
+            ESP_LOGI(TAG, "Auto-baud: bus at %u bit/s", (unsigned)candidates[i]);
+            return ESP_OK;
+        }
+    }
+    return ESP_ERR_NOT_FOUND;
+}
+
+esp_err_t can_driver_init(gpio_num_t tx_pin, gpio_num_t rx_pin,
+                          const can_id_range_t *accept, size_t n_accept)
+{
+    twai_general_config_t g_config =
+        TWAI_GENERAL_CONFIG_DEFAULT(tx_pin, rx_pin, TWAI_MODE_NORMAL);
+    g_config.alerts_enabled = TWAI_ALERT_TX_SUCCESS | TWAI_ALERT_TX_FAILED;
+    twai_timing_config_t t_config;
+    twai_filter_config_t f_config;
+    can_bit_timing_t bt;
+
+    esp_err_t ret = make_timing(s_bitrate, s_sample_point, &t_config, &bt);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "No bit timing for %u bit/s", (unsigned)s_bitrate);
+        return ret;
+    }
+    ret = can_driver_calc_filter(accept, n_accept, &f_config);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Invalid acceptance list: %s", esp_err_to_name(ret));
+        return ret;
+    }
+
     ESP_ERROR_CHECK(twai_driver_install(&g_config, &t_config, &f_config));
     ESP_ERROR_CHECK(twai_start());
+    s_installed = true;
 
-    ESP_LOGI(TAG, "CAN initialized (TX=%d, RX=%d)", tx_pin, rx_pin);
+    if (!s_tx_task &&
+        xTaskCreate(can_tx_task, "CAN_TX", 3072, NULL, CAN_TX_TASK_PRIO, &s_tx_task) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create CAN TX task");
+        return ESP_ERR_NO_MEM;
+    }
+
+    ESP_LOGI(TAG, "CAN initialized (TX=%d, RX=%d, %u bit/s brp=%u tseg=%u/%u sp=%u.%u%%, "
+                  "%s filter code=0x%08X mask=0x%08X)",
+             tx_pin, rx_pin, (unsigned)bt.bitrate, (unsigned)bt.brp, bt.tseg1, bt.tseg2,
+             bt.sample_point / 10, bt.sample_point % 10,
+             f_config.single_filter ? "single" : "dual",
+             (unsigned)f_config.acceptance_code, (unsigned)f_config.acceptance_mask);
     return ESP_OK;
 }
 
@@ -26,37 +314,485 @@ esp_err_t can_driver_transmit(const twai_message_t *msg)
     return ret;
 }
 
+/* ========= TX bất đồng bộ ========= */
+
+// Khóa sắp xếp theo arbitration: ID standard thắng ID extended có cùng 11 bit cao
+static inline uint32_t tx_prio_key(const twai_message_t *m)
+{
+    return m->extd ? (((m->identifier & 0x1FFFFFFF) << 1) | 0x1u)
+                   : ((m->identifier & TWAI_STD_ID_MASK) << 19);
+}
+
+// Frame mới thay frame đang chờ nếu cùng "luồng": cùng ID, riêng frame gộp
+// còn phải cùng header (node đầu, số slot, cờ) để không nuốt frame của nhóm node khác.
+// Lệnh motor có trace (DLC 6) đang chờ không bị thay: mẫu độ trễ của nó sẽ mất.
+static inline bool tx_same_stream(const twai_message_t *queued, const twai_message_t *msg)
+{
+    if (queued->identifier != msg->identifier || queued->extd != msg->extd) {
+        return false;
+    }
+    if (queued->extd) {
+        return true;
+    }
+    if (queued->identifier == CAN_ID_MOTOR_PACKED) {
+        return queued->data[0] == msg->data[0];
+    }
+    if (CAN_ID_BASE_OF(queued->identifier) == CAN_ID_MOTOR_CMD) {
+        return queued->data_length_code < 6;
+    }
+    return true;
+}
+
+esp_err_t can_driver_transmit_async(const twai_message_t *msg)
+{
+    if (!msg || msg->data_length_code > TWAI_FRAME_MAX_DLC) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    int64_t now = esp_timer_get_time();
+    uint32_t key = tx_prio_key(msg);
+    esp_err_t ret = ESP_OK;
+
+    portENTER_CRITICAL(&s_txq_mux);
+    size_t i;
+    for (i = 0; i < s_txq_len; i++) {
+        if (tx_same_stream(&s_txq[i].msg, msg)) {
+            break;
+        }
+    }
+    if (i < s_txq_len) {
+        // Cùng ID đang chờ: chỉ giữ frame mới nhất, giữ nguyên vị trí.
+        // Frame gộp: slot KEEP của frame mới giữ duty chưa gửi của frame cũ
+        twai_message_t merged = *msg;
+        if (!msg->extd && msg->identifier == CAN_ID_MOTOR_PACKED) {
+            can_driver_merge_packed(&merged, &s_txq[i].msg);
+        }
+        s_txq[i].msg = merged;
+        s_txq[i].enqueue_us = now;
+        s_tx_stats.replaced++;
+    } else {
+        size_t pos = s_txq_len;
+        while (pos > 0 && tx_prio_key(&s_txq[pos - 1].msg) > key) {
+            pos--;
+        }
+        if (s_txq_len == CAN_DRIVER_TX_QUEUE_LEN) {
+            if (pos == s_txq_len) {
+                ret = ESP_ERR_NO_MEM;      // frame mới có ưu tiên thấp nhất: bỏ nó
+            } else {
+                s_txq_len--;               // bỏ frame ưu tiên thấp nhất đang chờ
+            }
+            s_tx_stats.dropped++;
+        }
+        if (ret == ESP_OK) {
+            for (size_t k = s_txq_len; k > pos; k--) {
+                s_txq[k] = s_txq[k - 1];
+            }
+            s_txq[pos].msg = *msg;
+            s_txq[pos].enqueue_us = now;
+            s_txq_len++;
+            s_tx_stats.queued++;
+        }
+    }
+    portEXIT_CRITICAL(&s_txq_mux);
+
+    if (ret == ESP_OK && s_tx_task) {
+        xTaskNotifyGive(s_tx_task);
+    }
+    return ret;
+}
+
+esp_err_t can_driver_add_tx_done_cb(can_tx_done_cb_t cb, void *arg)
+{
+    if (!cb) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    esp_err_t ret = ESP_OK;
+    portENTER_CRITICAL(&s_txq_mux);
+    if (s_tx_done_n < CAN_DRIVER_MAX_TX_DONE_CBS) {
+        s_tx_done_cb[s_tx_done_n]  = cb;
+        s_tx_done_arg[s_tx_done_n] = arg;
+        s_tx_done_n++;
+    } else {
+        ret = ESP_ERR_NO_MEM;
+    }
+    portEXIT_CRITICAL(&s_txq_mux);
+    return ret;
+}
+
+void can_driver_get_tx_stats(can_tx_stats_t *out)
+{
+    if (!out) {
+        return;
+    }
+    portENTER_CRITICAL(&s_txq_mux);
+    *out = s_tx_stats;
+    portEXIT_CRITICAL(&s_txq_mux);
+}
+
+static bool tx_pop(can_tx_slot_t *out)
+{
+    bool ok = false;
+    portENTER_CRITICAL(&s_txq_mux);
+    if (s_txq_len > 0) {
+        *out = s_txq[0];
+        for (size_t k = 1; k < s_txq_len; k++) {
+            s_txq[k - 1] = s_txq[k];
+        }
+        s_txq_len--;
+        ok = true;
+    }
+    portEXIT_CRITICAL(&s_txq_mux);
+    return ok;
+}
+
+// Gửi từng frame một và chờ alert TX_SUCCESS/TX_FAILED để đo latency từng frame
+static void can_tx_task(void *arg)
+{
+    (void)arg;
+    can_tx_slot_t slot;
+
+    while (1) {
+        if (!tx_pop(&slot)) {
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            continue;
+        }
+
+        bool ok = false;
+        if (twai_transmit(&slot.msg, pdMS_TO_TICKS(CAN_TX_DONE_TIMEOUT_MS)) == ESP_OK) {
+            uint32_t alerts = 0;
+            int64_t deadline = esp_timer_get_time() + CAN_TX_DONE_TIMEOUT_MS * 1000;
+            do {
+                if (twai_read_alerts(&alerts, pdMS_TO_TICKS(CAN_TX_DONE_TIMEOUT_MS)) != ESP_OK) {
+                    break;
+                }
+            } while (!(alerts & (TWAI_ALERT_TX_SUCCESS | TWAI_ALERT_TX_FAILED)) &&
+                     esp_timer_get_time() < deadline);
+            ok = (alerts & TWAI_ALERT_TX_SUCCESS) != 0;
+        }
+
+        int64_t  done_us = esp_timer_get_time();
+        uint32_t latency = (uint32_t)(done_us - slot.enqueue_us);
+        portENTER_CRITICAL(&s_txq_mux);
+        if (ok) {
+            s_tx_bits += frame_bits(&slot.msg);
+            s_tx_stats.sent++;
+            if (latency > s_tx_stats.latency_max_us) {
+                s_tx_stats.latency_max_us = latency;
+            }
+        } else {
+            s_tx_stats.failed++;
+        }
+        size_t n_cb = s_tx_done_n;
+        portEXIT_CRITICAL(&s_txq_mux);
+
+        // Callback chỉ được thêm, không bị gỡ: đọc mảng ngoài critical section là an toàn
+        for (size_t i = 0; i < n_cb; i++) {
+            s_tx_done_cb[i](&slot.msg, ok, done_us, latency, s_tx_done_arg[i]);
+        }
+    }
+}
+
 esp_err_t can_driver_receive(twai_message_t *msg, TickType_t timeout)
 {
-    return twai_receive(msg, timeout);
+    esp_err_t ret = twai_receive(msg, timeout);
+    if (ret == ESP_OK) {
+        s_rx_bits += frame_bits(msg);
+    }
+    return ret;
+}
+
+/* ========= RX dispatch ========= */
+
+esp_err_t can_driver_register_handler(uint32_t id, can_rx_handler_t fn, void *arg)
+{
+    if (!fn || id > TWAI_STD_ID_MASK) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    uint8_t slot = s_id_slot[id];
+    if (slot) {
+        s_handlers[slot - 1].fn  = fn;
+        s_handlers[slot - 1].arg = arg;
+        return ESP_OK;
+    }
+    if (s_num_handlers >= CAN_DRIVER_MAX_HANDLERS) {
+        return ESP_ERR_NO_MEM;
+    }
+    s_handlers[s_num_handlers] = (can_handler_entry_t){ .id = id, .fn = fn, .arg = arg };
+    s_num_handlers++;
+    s_id_slot[id] = (uint8_t)s_num_handlers;
+    return ESP_OK;
+}
+
+esp_err_t can_driver_set_default_handler(can_rx_handler_t fn, void *arg)
+{
+    s_default_fn  = fn;
+    s_default_arg = arg;
+    return ESP_OK;
 }
 
-/* ========= Legacy helpers (có thể bỏ nếu không dùng) ========= */
+static void can_dispatch(const twai_message_t *msg, int64_t rx_us)
+{
+    if (!msg->extd) {
+        uint8_t slot = s_id_slot[msg->identifier & TWAI_STD_ID_MASK];
+        if (slot) {
+            const can_handler_entry_t *h = &s_handlers[slot - 1];
+            h->fn(msg, rx_us, h->arg);
+            return;
+        }
+    }
+    if (s_default_fn) {
+        s_default_fn(msg, rx_us, s_default_arg);
+    }
+}
+
+static void can_dispatch_task(void *arg)
+{
+    (void)arg;
+    twai_message_t msg;
+
+    while (1) {
+        if (twai_receive(&msg, portMAX_DELAY) == ESP_OK) {
+            can_dispatch(&msg, esp_timer_get_time());
+            s_rx_bits += frame_bits(&msg);
+        }
+    }
+}
+
+esp_err_t can_driver_start_dispatch(UBaseType_t priority)
+{
+    if (s_dispatch_task) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (xTaskCreate(can_dispatch_task, "CAN_DISPATCH", 4096, NULL,
+                    priority, &s_dispatch_task) != pdPASS) {
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+/* ========= Health monitor ========= */
+
+static const char *state_name(twai_state_t st)
+{
+    switch (st) {
+    case TWAI_STATE_STOPPED:    return "STOPPED";
+    case TWAI_STATE_RUNNING:    return "RUNNING";
+    case TWAI_STATE_BUS_OFF:    return "BUS_OFF";
+    case TWAI_STATE_RECOVERING: return "RECOVERING";
+    default:                    return "?";
+    }
+}
+
+static void can_health_task(void *arg)
+{
+    uint32_t period_ms = (uint32_t)(uintptr_t)arg;
+    uint32_t log_every = s_health.log_every_ms / period_ms;
+    uint32_t n         = 0;
+    uint32_t last_bits = s_tx_bits + s_rx_bits;
+    int64_t  last_us   = esp_timer_get_time();
+    bool     recovering = false;
+    TickType_t last_wake = xTaskGetTickCount();
+
+    while (1) {
+        vTaskDelayUntil(&last_wake, pdMS_TO_TICKS(period_ms));
+
+        twai_status_info_t info;
+        if (twai_get_status_info(&info) != ESP_OK) {
+            continue;
+        }
+
+        // Tải bus theo bit thật của frame node này gửi / nhận trong cửa sổ vừa qua
+        uint32_t bits = s_tx_bits + s_rx_bits;
+        int64_t  now  = esp_timer_get_time();
+        uint32_t load = 0;
+        if (now > last_us) {
+            load = (uint32_t)((uint64_t)(bits - last_bits) * 1000000ULL * 1000ULL /
+                              ((uint64_t)s_bitrate * (uint64_t)(now - last_us)));
+        }
+        last_bits = bits;
+        last_us   = now;
+
+        // Bus-off: bắt đầu recovery (128 x 11 bit lặn), xong thì driver về STOPPED -> start lại
+        bool bus_off_event = false, recovered_event = false;
+        if (info.state == TWAI_STATE_BUS_OFF && !recovering) {
+            if (twai_initiate_recovery() == ESP_OK) {
+                recovering    = true;
+                bus_off_event = true;
+            }
+        } else if (info.state == TWAI_STATE_STOPPED && recovering) {
+            if (twai_start() == ESP_OK) {
+                recovering      = false;
+                recovered_event = true;
+            }
+        }
+
+        portENTER_CRITICAL(&s_health_mux);
+        s_health.state            = info.state;
+        s_health.tx_error_counter = info.tx_error_counter;
+        s_health.rx_error_counter = info.rx_error_counter;
+        s_health.tx_failed        = info.tx_failed_count;
+        s_health.rx_missed        = info.rx_missed_count;
+        s_health.rx_overrun       = info.rx_overrun_count;
+        s_health.arb_lost         = info.arb_lost_count;
+        s_health.bus_errors       = info.bus_error_count;
+        s_health.msgs_to_tx       = info.msgs_to_tx;
+        s_health.msgs_to_rx       = info.msgs_to_rx;
+        s_health.bus_load_permille = (uint16_t)(load > 1000 ? 1000 : load);
+        if (s_health.bus_load_permille > s_health.bus_load_max_permille) {
+            s_health.bus_load_max_permille = s_health.bus_load_permille;
+        }
+        if (bus_off_event)   s_health.bus_off_count++;
+        if (recovered_event) s_health.recoveries++;
+        can_health_t h = s_health;
+        portEXIT_CRITICAL(&s_health_mux);
+
+        if (bus_off_event) {
+            ESP_LOGW(TAG, "Bus-off (TEC=%u), recovery started", (unsigned)h.tx_error_counter);
+        }
+        if (recovered_event) {
+            ESP_LOGW(TAG, "Bus-off recovered, TWAI restarted");
+        }
+        if (log_every && ++n >= log_every) {
+            n = 0;
+            ESP_LOGI(TAG, "health: %s TEC=%u REC=%u load=%u.%u%% (max %u.%u%%) arb_lost=%u "
+                          "rx_missed=%u rx_overrun=%u bus_err=%u tx_failed=%u bus_off=%u",
+                     state_name(h.state),
+                     (unsigned)h.tx_error_counter, (unsigned)h.rx_error_counter,
+                     h.bus_load_permille / 10, h.bus_load_permille % 10,
+                     h.bus_load_max_permille / 10, h.bus_load_max_permille % 10,
+                     (unsigned)h.arb_lost, (unsigned)h.rx_missed, (unsigned)h.rx_overrun,
+                     (unsigned)h.bus_errors, (unsigned)h.tx_failed, (unsigned)h.bus_off_count);
+        }
+    }
+}
+
+esp_err_t can_driver_start_health_monitor(uint32_t period_ms, uint32_t log_every_ms)
+{
+    if (s_health_task) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (period_ms == 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    s_health.log_every_ms = log_every_ms;
+    if (xTaskCreate(can_health_task, "CAN_HEALTH", 3072, (void *)(uintptr_t)period_ms,
+                    2, &s_health_task) != pdPASS) {
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+esp_err_t can_driver_get_health(can_health_t *out)
+{
+    if (!out) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (!s_health_task) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    portENTER_CRITICAL(&s_health_mux);
+    *out = s_health;
+    portEXIT_CRITICAL(&s_health_mux);
+    return ESP_OK;
+}
+
+/* ========= Địa chỉ node ========= */
+
+esp_err_t can_driver_set_node_id(uint8_t node)
+{
+    if (node >= CAN_MAX_NODES) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    s_node_id = node;
+    return ESP_OK;
+}
+
+uint8_t can_driver_get_node_id(void)
+{
+    return s_node_id;
+}
+
+/* ========= Setpoint / feedback (vòng kín chạy trên slave) ========= */
 
 esp_err_t can_driver_send_setpoint(int16_t angle)
 {
+    return can_driver_send_setpoint_to(0, angle);
+}
+
+esp_err_t can_driver_send_setpoint_to(uint8_t node, int16_t angle)
+{
+    if (node >= CAN_MAX_NODES) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
     twai_message_t msg = {0};
-    msg.identifier       = CAN_ID_SETPOINT;
+    msg.identifier       = CAN_ID_NODE(CAN_ID_SETPOINT, node);
     msg.extd             = 0;
     msg.rtr              = 0;
     msg.data_length_code = 2;
     msg.data[0] = (uint8_t)(angle & 0xFF);
     msg.data[1] = (uint8_t)((angle >> 8) & 0xFF);
 
-    return can_driver_transmit(&msg);
+    return can_driver_transmit_async(&msg);
 }
 
-esp_err_t can_driver_send_feedback(int16_t angle)
+esp_err_t can_driver_send_feedback(int16_t angle, int16_t duty)
 {
     twai_message_t msg = {0};
-    msg.identifier       = CAN_ID_FEEDBACK;
+    msg.identifier       = CAN_ID_NODE(CAN_ID_FEEDBACK, s_node_id);
     msg.extd             = 0;
     msg.rtr              = 0;
-    msg.data_length_code = 2;
+    msg.data_length_code = 4;
     msg.data[0] = (uint8_t)(angle & 0xFF);
     msg.data[1] = (uint8_t)((angle >> 8) & 0xFF);
+    msg.data[2] = (uint8_t)(duty & 0xFF);
+    msg.data[3] = (uint8_t)((duty >> 8) & 0xFF);
+
+    return can_driver_transmit_async(&msg);
+}
+
+esp_err_t can_driver_parse_setpoint(const twai_message_t *msg, int16_t *angle)
+{
+    if (!msg || !angle) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (msg->identifier != CAN_ID_NODE(CAN_ID_SETPOINT, s_node_id) ||
+        msg->extd != 0 ||
+        msg->rtr  != 0 ||
+        msg->data_length_code < 2)
+    {
+        return ESP_FAIL;
+    }
+
+    *angle = (int16_t)((uint16_t)msg->data[0] | ((uint16_t)msg->data[1] << 8));
+    return ESP_OK;
+}
+
+esp_err_t can_driver_parse_feedback(const twai_message_t *msg, uint8_t *node,
+                                    int16_t *angle, int16_t *duty)
+{
+    if (!msg || !angle || !duty) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (CAN_ID_BASE_OF(msg->identifier) != CAN_ID_FEEDBACK ||
+        msg->extd != 0 ||
+        msg->rtr  != 0 ||
+        msg->data_length_code < 4)
+    {
+        return ESP_FAIL;
+    }
 
-    return can_driver_transmit(&msg);
+    *angle = (int16_t)((uint16_t)msg->data[0] | ((uint16_t)msg->data[1] << 8));
+    *duty  = (int16_t)((uint16_t)msg->data[2] | ((uint16_t)msg->data[3] << 8));
+    if (node) {
+        *node = (uint8_t)CAN_ID_NODE_OF(msg->identifier);
+    }
+    return ESP_OK;
 }
 
 /* ================= NEW API: MOTOR COMMAND ================= */
@@ -65,21 +801,69 @@ esp_err_t can_driver_send_feedback(int16_t angle)
 // Byte 2: duty MSB
 esp_err_t can_driver_send_motor_cmd(bool dir, uint16_t duty)
 {
+    return can_driver_send_motor_cmd_to(0, dir, duty);
+}
+
+static esp_err_t build_motor_cmd(twai_message_t *msg, uint8_t node, bool dir, uint16_t duty)
+{
+    if (node >= CAN_MAX_NODES) {
+        return ESP_ERR_INVALID_ARG;
+    }
     if (duty > 1023) {
         duty = 1023;
     }
 
-    twai_message_t msg = {0};
-    msg.identifier       = CAN_ID_MOTOR_CMD;
-    msg.extd             = 0;
-    msg.rtr              = 0;
-    msg.data_length_code = 3;
+    memset(msg, 0, sizeof(*msg));
+    msg->identifier       = CAN_ID_NODE(CAN_ID_MOTOR_CMD, node);
+    msg->extd             = 0;
+    msg->rtr              = 0;
+    msg->data_length_code = 3;
 
-    msg.data[0] = dir ? 1 : 0;
-    msg.data[1] = (uint8_t)(duty & 0xFF);        // LSB
-    msg.data[2] = (uint8_t)((duty >> 8) & 0xFF); // MSB
+    msg->data[0] = dir ? 1 : 0;
+    msg->data[1] = (uint8_t)(duty & 0xFF);        // LSB
+    msg->data[2] = (uint8_t)((duty >> 8) & 0xFF); // MSB
+    return ESP_OK;
+}
 
-    return can_driver_transmit(&msg);
+esp_err_t can_driver_send_motor_cmd_to(uint8_t node, bool dir, uint16_t duty)
+{
+    twai_message_t msg;
+    esp_err_t err = build_motor_cmd(&msg, node, dir, duty);
+    if (err != ESP_OK) {
+        return err;
+    }
+    return can_driver_transmit_async(&msg);
+}
+
+esp_err_t can_driver_send_motor_cmd_traced(uint8_t node, bool dir, uint16_t duty,
+                                           uint8_t seq, int64_t capture_us)
+{
+    twai_message_t msg;
+    esp_err_t err = build_motor_cmd(&msg, node, dir, duty);
+    if (err != ESP_OK) {
+        return err;
+    }
+    msg.data_length_code = 6;
+    msg.data[3] = seq;
+    msg.data[4] = (uint8_t)(capture_us & 0xFF);
+    msg.data[5] = (uint8_t)((capture_us >> 8) & 0xFF);
+    return can_driver_transmit_async(&msg);
+}
+
+esp_err_t can_driver_parse_motor_cmd_trace(const twai_message_t *msg,
+                                           uint8_t *seq, uint16_t *capture_us16)
+{
+    if (!msg || !seq || !capture_us16) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (CAN_ID_BASE_OF(msg->identifier) != CAN_ID_MOTOR_CMD || msg->extd || msg->rtr ||
+        msg->data_length_code < 6)
+    {
+        return ESP_ERR_NOT_FOUND;
+    }
+    *seq          = msg->data[3];
+    *capture_us16 = (uint16_t)msg->data[4] | ((uint16_t)msg->data[5] << 8);
+    return ESP_OK;
 }
 
 esp_err_t can_driver_parse_motor_cmd(const twai_message_t *msg,
@@ -90,7 +874,7 @@ esp_err_t can_driver_parse_motor_cmd(const twai_message_t *msg,
         return ESP_ERR_INVALID_ARG;
     }
 
-    if (msg->identifier != CAN_ID_MOTOR_CMD ||
+    if (msg->identifier != CAN_ID_NODE(CAN_ID_MOTOR_CMD, s_node_id) ||
         msg->extd != 0 ||
         msg->rtr  != 0 ||
         msg->data_length_code < 3)
@@ -105,3 +889,209 @@ esp_err_t can_driver_parse_motor_cmd(const twai_message_t *msg,
     }
     return ESP_OK;
 }
+
+/* ========= Ramp ========= */
+
+esp_err_t can_driver_send_motor_ramp_to(uint8_t node, bool dir, uint16_t duty, uint16_t ramp_ms)
+{
+    twai_message_t msg;
+    esp_err_t err = build_motor_cmd(&msg, node, dir, duty);
+    if (err != ESP_OK) {
+        return err;
+    }
+    msg.identifier       = CAN_ID_NODE(CAN_ID_MOTOR_RAMP, node);
+    msg.data_length_code = 5;
+    msg.data[3] = (uint8_t)(ramp_ms & 0xFF);
+    msg.data[4] = (uint8_t)(ramp_ms >> 8);
+    return can_driver_transmit_async(&msg);
+}
+
+esp_err_t can_driver_parse_motor_ramp(const twai_message_t *msg,
+                                      bool *dir, uint16_t *duty, uint16_t *ramp_ms)
+{
+    if (!msg || !dir || !duty || !ramp_ms) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (msg->identifier != CAN_ID_NODE(CAN_ID_MOTOR_RAMP, s_node_id) ||
+        msg->extd || msg->rtr || msg->data_length_code < 5)
+    {
+        return ESP_FAIL;
+    }
+
+    *dir     = (msg->data[0] != 0);
+    *duty    = (uint16_t)msg->data[1] | ((uint16_t)msg->data[2] << 8);
+    *ramp_ms = (uint16_t)msg->data[3] | ((uint16_t)msg->data[4] << 8);
+    if (*duty > 1023) {
+        *duty = 1023;
+    }
+    return ESP_OK;
+}
+
+/* ========= Đặc tính motor ========= */
+
+esp_err_t can_driver_send_motor_char(uint8_t node, uint8_t cmd)
+{
+    if (node >= CAN_MAX_NODES) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    twai_message_t msg = {0};
+    msg.identifier       = CAN_ID_NODE(CAN_ID_MOTOR_CHAR, node);
+    msg.data_length_code = 1;
+    msg.data[0]          = cmd;
+    return can_driver_transmit_async(&msg);
+}
+
+esp_err_t can_driver_parse_motor_char(const twai_message_t *msg, uint8_t *cmd)
+{
+    if (!msg || !cmd) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (msg->identifier != CAN_ID_NODE(CAN_ID_MOTOR_CHAR, s_node_id) ||
+        msg->extd || msg->rtr || msg->data_length_code < 1)
+    {
+        return ESP_FAIL;
+    }
+
+    *cmd = msg->data[0];
+    return ESP_OK;
+}
+
+/* ========= Telemetry ========= */
+
+esp_err_t can_driver_send_telemetry(const can_telemetry_t *tm)
+{
+    if (!tm) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    int16_t duty = tm->duty;
+    if (duty > 1023)  duty = 1023;
+    if (duty < -1023) duty = -1023;
+    uint16_t w = ((uint16_t)duty & 0x07FF) | ((uint16_t)(tm->faults & CAN_FAULT_MASK) << 11);
+
+    twai_message_t msg = {0};
+    msg.identifier       = CAN_ID_NODE(CAN_ID_TELEMETRY, s_node_id);
+    msg.data_length_code = 8;
+    msg.data[0] = (uint8_t)((uint16_t)tm->position & 0xFF);
+    msg.data[1] = (uint8_t)((uint16_t)tm->position >> 8);
+    msg.data[2] = (uint8_t)((uint16_t)tm->velocity & 0xFF);
+    msg.data[3] = (uint8_t)((uint16_t)tm->velocity >> 8);
+    msg.data[4] = (uint8_t)(w & 0xFF);
+    msg.data[5] = (uint8_t)(w >> 8);
+    msg.data[6] = (uint8_t)(tm->time_us & 0xFF);
+    msg.data[7] = (uint8_t)(tm->time_us >> 8);
+
+    return can_driver_transmit_async(&msg);
+}
+
+esp_err_t can_driver_parse_telemetry(const twai_message_t *msg, uint8_t *node,
+                                     can_telemetry_t *tm)
+{
+    if (!msg || !tm) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (CAN_ID_BASE_OF(msg->identifier) != CAN_ID_TELEMETRY ||
+        msg->extd != 0 ||
+        msg->rtr  != 0 ||
+        msg->data_length_code < 8)
+    {
+        return ESP_FAIL;
+    }
+
+    uint16_t w = (uint16_t)msg->data[4] | ((uint16_t)msg->data[5] << 8);
+    tm->position = (int16_t)((uint16_t)msg->data[0] | ((uint16_t)msg->data[1] << 8));
+    tm->velocity = (int16_t)((uint16_t)msg->data[2] | ((uint16_t)msg->data[3] << 8));
+    tm->duty     = (int16_t)(((w & 0x07FFu) ^ 0x400u) - 0x400u);
+    tm->faults   = (uint8_t)(w >> 11);
+    tm->time_us  = (uint16_t)msg->data[6] | ((uint16_t)msg->data[7] << 8);
+    if (node) {
+        *node = (uint8_t)CAN_ID_NODE_OF(msg->identifier);
+    }
+    return ESP_OK;
+}
+
+/* ========= Dòng motor ========= */
+
+esp_err_t can_driver_send_current(const can_current_t *cur)
+{
+    if (!cur) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    twai_message_t msg = {0};
+    msg.identifier       = CAN_ID_NODE(CAN_ID_CURRENT, s_node_id);
+    msg.data_length_code = 7;
+    msg.data[0] = (uint8_t)(cur->current_ma & 0xFF);
+    msg.data[1] = (uint8_t)(cur->current_ma >> 8);
+    msg.data[2] = (uint8_t)(cur->peak_ma & 0xFF);
+    msg.data[3] = (uint8_t)(cur->peak_ma >> 8);
+    msg.data[4] = (uint8_t)(cur->trips & 0xFF);
+    msg.data[5] = (uint8_t)(cur->trips >> 8);
+    msg.data[6] = cur->tripped ? 0x01 : 0x00;
+
+    return can_driver_transmit_async(&msg);
+}
+
+esp_err_t can_driver_parse_current(const twai_message_t *msg, uint8_t *node,
+                                   can_current_t *cur)
+{
+    if (!msg || !cur) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (CAN_ID_BASE_OF(msg->identifier) != CAN_ID_CURRENT ||
+        msg->extd != 0 ||
+        msg->rtr  != 0 ||
+        msg->data_length_code < 7)
+    {
+        return ESP_FAIL;
+    }
+
+    cur->current_ma = (uint16_t)msg->data[0] | ((uint16_t)msg->data[1] << 8);
+    cur->peak_ma    = (uint16_t)msg->data[2] | ((uint16_t)msg->data[3] << 8);
+    cur->trips      = (uint16_t)msg->data[4] | ((uint16_t)msg->data[5] << 8);
+    cur->tripped    = (msg->data[6] & 0x01) != 0;
+    if (node) {
+        *node = (uint8_t)CAN_ID_NODE_OF(msg->identifier);
+    }
+    return ESP_OK;
+}
+
+/* ========= Lệnh motor gộp nhiều trục ========= */
+
+esp_err_t can_driver_send_packed(uint8_t first_node, const int16_t *duty, size_t count,
+                                 bool staged)
+{
+    twai_message_t msg;
+    esp_err_t err = can_driver_encode_packed(&msg, first_node, duty, count, staged);
+    if (err != ESP_OK) {
+        return err;
+    }
+    return can_driver_transmit_async(&msg);
+}
+
+/* ========= SYNC ========= */
+
+esp_err_t can_driver_send_sync(uint8_t counter)
+{
+    twai_message_t msg = {0};
+    msg.identifier       = CAN_ID_SYNC;
+    msg.data_length_code = 1;
+    msg.data[0]          = counter;
+
+    return can_driver_transmit_async(&msg);
+}
+
+esp_err_t can_driver_parse_sync(const twai_message_t *msg, uint8_t *counter)
+{
+    if (!msg || !counter) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (msg->identifier != CAN_ID_SYNC || msg->extd != 0 || msg->rtr != 0 ||
+        msg->data_length_code < 1)
+    {
+        return ESP_FAIL;
+    }
+    *counter = msg->data[0];
+    return ESP_OK;
+}
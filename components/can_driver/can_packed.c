@@ -0,0 +1,121 @@
+#include "can_driver.h"
+
+#include <string.h>
+
+// Mã hoá/giải mã CAN_ID_MOTOR_PACKED, không phụ thuộc TWAI/FreeRTOS
+// (tools/can_packed_test.c build file này trên PC)
+
+#define CAN_PACKED_HDR_BITS   8u
+#define CAN_PACKED_DUTY_BITS  11u
+#define CAN_PACKED_DUTY_MASK  ((1u << CAN_PACKED_DUTY_BITS) - 1u)
+#define CAN_PACKED_STAGED     0x80u
+
+esp_err_t can_driver_encode_packed(twai_message_t *msg, uint8_t first_node,
+                                   const int16_t *duty, size_t count, bool staged)
+{
+    if (!msg || !duty || count == 0 || count > CAN_PACKED_MAX_AXES ||
+        first_node + count > CAN_MAX_NODES)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    uint64_t bits = (uint64_t)(first_node & 0x0F) | ((uint64_t)count << 4) |
+                    (staged ? CAN_PACKED_STAGED : 0);
+    for (size_t k = 0; k < count; k++) {
+        int16_t d = duty[k];
+        if (d != CAN_PACKED_DUTY_KEEP) {
+            if (d > CAN_PACKED_DUTY_MAX)  d = CAN_PACKED_DUTY_MAX;
+            if (d < -CAN_PACKED_DUTY_MAX) d = -CAN_PACKED_DUTY_MAX;
+        }
+        uint64_t field = (uint16_t)d & CAN_PACKED_DUTY_MASK;
+        bits |= field << (CAN_PACKED_HDR_BITS + CAN_PACKED_DUTY_BITS * k);
+    }
+
+    size_t n_bits = CAN_PACKED_HDR_BITS + CAN_PACKED_DUTY_BITS * count;
+
+    memset(msg, 0, sizeof(*msg));
+    msg->identifier       = CAN_ID_MOTOR_PACKED;
+    msg->data_length_code = (uint8_t)((n_bits + 7) / 8);
+    for (int i = 0; i < msg->data_length_code; i++) {
+        msg->data[i] = (uint8_t)(bits >> (8 * i));
+    }
+    return ESP_OK;
+}
+
+esp_err_t can_driver_decode_packed(const twai_message_t *msg, uint8_t node,
+                                   int16_t *duty, bool *staged)
+{
+    if (!msg || !duty) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (msg->identifier != CAN_ID_MOTOR_PACKED || msg->extd != 0 || msg->rtr != 0 ||
+        msg->data_length_code == 0 || msg->data_length_code > 8)
+    {
+        return ESP_FAIL;
+    }
+
+    uint64_t bits = 0;
+    for (int i = 0; i < msg->data_length_code; i++) {
+        bits |= (uint64_t)msg->data[i] << (8 * i);
+    }
+
+    uint8_t first = (uint8_t)(bits & 0x0F);
+    uint8_t count = (uint8_t)((bits >> 4) & 0x07);
+    if (count == 0 || count > CAN_PACKED_MAX_AXES ||
+        CAN_PACKED_HDR_BITS + CAN_PACKED_DUTY_BITS * count > 8u * msg->data_length_code)
+    {
+        return ESP_FAIL;
+    }
+    if (node < first || node >= first + count) {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    uint32_t field = (uint32_t)(bits >> (CAN_PACKED_HDR_BITS + CAN_PACKED_DUTY_BITS * (node - first)))
+                     & CAN_PACKED_DUTY_MASK;
+    // Mở rộng dấu 11-bit -> 16-bit
+    int16_t d = (int16_t)((field ^ 0x400u) - 0x400u);
+    if (d == CAN_PACKED_DUTY_KEEP) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    *duty = d;
+    if (staged) {
+        *staged = (bits & CAN_PACKED_STAGED) != 0;
+    }
+    return ESP_OK;
+}
+
+esp_err_t can_driver_merge_packed(twai_message_t *newer, const twai_message_t *older)
+{
+    if (!newer || !older || newer->identifier != CAN_ID_MOTOR_PACKED ||
+        older->identifier != CAN_ID_MOTOR_PACKED || newer->extd || older->extd ||
+        newer->data_length_code == 0 || newer->data_length_code > 8 ||
+        newer->data_length_code != older->data_length_code || newer->data[0] != older->data[0])
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    uint64_t bits_new = 0, bits_old = 0;
+    for (int i = 0; i < newer->data_length_code; i++) {
+        bits_new |= (uint64_t)newer->data[i] << (8 * i);
+        bits_old |= (uint64_t)older->data[i] << (8 * i);
+    }
+
+    size_t   count = (bits_new >> 4) & 0x07;
+    uint32_t keep  = (uint16_t)CAN_PACKED_DUTY_KEEP & CAN_PACKED_DUTY_MASK;
+    if (count == 0 || count > CAN_PACKED_MAX_AXES ||
+        CAN_PACKED_HDR_BITS + CAN_PACKED_DUTY_BITS * count > 8u * newer->data_length_code)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    for (size_t k = 0; k < count; k++) {
+        unsigned shift = CAN_PACKED_HDR_BITS + CAN_PACKED_DUTY_BITS * k;
+        uint64_t mask  = (uint64_t)CAN_PACKED_DUTY_MASK << shift;
+        if (((bits_new >> shift) & CAN_PACKED_DUTY_MASK) == keep) {
+            bits_new = (bits_new & ~mask) | (bits_old & mask);
+        }
+    }
+    for (int i = 0; i < newer->data_length_code; i++) {
+        newer->data[i] = (uint8_t)(bits_new >> (8 * i));
+    }
+    return ESP_OK;
+}
@@ -0,0 +1,277 @@
+#include "can_time_sync.h"
+#include "can_driver.h"
+
+#include <stdatomic.h>
+#include <string.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+static const char *TAG = "CAN_TSYNC";
+
+#define TSYNC_OUTLIER_US        200     // |sai số| lớn hơn -> bỏ mẫu (khi đã khóa)
+#define TSYNC_LOCK_SAMPLES      4       // số mẫu đầu luôn được nhận
+#define TSYNC_MAX_REJECTS       4       // loại liên tiếp quá số này -> bắt đầu lại
+#define TSYNC_DRIFT_MAX_PPB     500000  // ±500 ppm
+#define TSYNC_KP_SHIFT          1       // offset += err / 2
+#define TSYNC_KI_SHIFT          3       // drift  += err/dt / 8
+
+// Mô hình: master = local + off_ref + drift_ppb * (local - t_ref) / 1e9
+typedef struct {
+    bool     valid;
+    int64_t  t_ref;
+    int64_t  off_ref;
+    int32_t  drift_ppb;
+    int32_t  last_error_us;
+    uint32_t samples;
+    uint32_t rejected;
+} tsync_model_t;
+
+static bool              s_is_master = false;
+static volatile uint32_t s_seq       = 0;      // seqlock cho s_model
+static tsync_model_t     s_model;
+static uint8_t           s_rejects_in_row = 0;
+
+// Slave: TIME_SYNC đang chờ FOLLOW
+static bool     s_pending       = false;
+static uint8_t  s_pending_seq   = 0;
+static int64_t  s_pending_rx_us = 0;
+
+// Master
+static uint32_t     s_period_ms = CAN_TIME_SYNC_DEFAULT_PERIOD_MS;
+static TaskHandle_t s_task      = NULL;
+
+/* ========= Mô hình offset / drift ========= */
+
+static int64_t model_offset(const tsync_model_t *m, int64_t local_us)
+{
+    return m->off_ref + (int64_t)m->drift_ppb * (local_us - m->t_ref) / 1000000000LL;
+}
+
+static void model_read(tsync_model_t *out)
+{
+    uint32_t seq;
+    do {
+        seq = s_seq;
+        atomic_thread_fence(memory_order_acquire);
+        *out = s_model;
+        atomic_thread_fence(memory_order_acquire);
+    } while ((seq & 1u) || seq != s_seq);
+}
+
+// Chỉ dispatch task ghi
+static void model_publish(const tsync_model_t *m)
+{
+    s_seq++;
+    atomic_thread_fence(memory_order_release);
+    s_model = *m;
+    atomic_thread_fence(memory_order_release);
+    s_seq++;
+}
+
+static void model_sample(int64_t local_us, int64_t master_us)
+{
+    tsync_model_t m = s_model;
+    int64_t meas = master_us - local_us;
+
+    if (!m.valid) {
+        m.valid         = true;
+        m.t_ref         = local_us;
+        m.off_ref       = meas;
+        m.drift_ppb     = 0;
+        m.last_error_us = 0;
+        m.samples       = 1;
+        model_publish(&m);
+        return;
+    }
+
+    int64_t pred = model_offset(&m, local_us);
+    int64_t err  = meas - pred;
+
+    if ((err > TSYNC_OUTLIER_US || err < -TSYNC_OUTLIER_US) && m.samples >= TSYNC_LOCK_SAMPLES) {
+        m.rejected++;
+        if (++s_rejects_in_row > TSYNC_MAX_REJECTS) {
+            // Mất khóa (master reset, đồng hồ nhảy...): bắt đầu lại từ mẫu này
+            m.valid = false;
+            s_rejects_in_row = 0;
+            model_publish(&m);
+            model_sample(local_us, master_us);
+            return;
+        }
+        model_publish(&m);
+        return;
+    }
+    s_rejects_in_row = 0;
+
+    // PI servo: khâu P kéo offset, khâu I chỉnh drift theo sai số chia khoảng thời gian
+    int64_t dt = local_us - m.t_ref;
+    if (dt > 0) {
+        int64_t drift = m.drift_ppb + ((err * 1000000000LL / dt) >> TSYNC_KI_SHIFT);
+        if (drift >  TSYNC_DRIFT_MAX_PPB) drift =  TSYNC_DRIFT_MAX_PPB;
+        if (drift < -TSYNC_DRIFT_MAX_PPB) drift = -TSYNC_DRIFT_MAX_PPB;
+        m.drift_ppb = (int32_t)drift;
+    }
+    m.off_ref       = pred + (err >> TSYNC_KP_SHIFT);
+    m.t_ref         = local_us;
+    m.last_error_us = (int32_t)err;
+    m.samples++;
+    model_publish(&m);
+}
+
+/* ========= Slave ========= */
+
+static void on_time_sync(const twai_message_t *msg, int64_t rx_us, void *arg)
+{
+    (void)arg;
+    if (msg->data_length_code < 1) {
+        return;
+    }
+    s_pending       = true;
+    s_pending_seq   = msg->data[0];
+    s_pending_rx_us = rx_us;
+}
+
+static void on_time_follow(const twai_message_t *msg, int64_t rx_us, void *arg)
+{
+    (void)rx_us;
+    (void)arg;
+    if (msg->data_length_code < 7 || !s_pending || msg->data[0] != s_pending_seq) {
+        return;
+    }
+    s_pending = false;
+
+    int64_t master_us = 0;
+    for (int i = 0; i < 6; i++) {
+        master_us |= (int64_t)msg->data[1 + i] << (8 * i);
+    }
+    model_sample(s_pending_rx_us, master_us);
+}
+
+esp_err_t can_time_sync_slave_start(void)
+{
+    esp_err_t err = can_driver_register_handler(CAN_ID_TIME_SYNC, on_time_sync, NULL);
+    if (err == ESP_OK) {
+        err = can_driver_register_handler(CAN_ID_TIME_FOLLOW, on_time_follow, NULL);
+    }
+    return err;
+}
+
+/* ========= Master ========= */
+
+static void on_tx_done(const twai_message_t *msg, bool ok, int64_t done_us,
+                       uint32_t latency_us, void *arg)
+{
+    (void)latency_us;
+    (void)arg;
+    if (!ok || msg->identifier != CAN_ID_TIME_SYNC || msg->extd) {
+        return;
+    }
+
+    twai_message_t fu = {0};
+    fu.identifier       = CAN_ID_TIME_FOLLOW;
+    fu.data_length_code = 7;
+    fu.data[0]          = msg->data[0];
+    for (int i = 0; i < 6; i++) {
+        fu.data[1 + i] = (uint8_t)(done_us >> (8 * i));
+    }
+    can_driver_transmit_async(&fu);
+}
+
+static void tsync_master_task(void *arg)
+{
+    (void)arg;
+    uint8_t    seq       = 0;
+    TickType_t last_wake = xTaskGetTickCount();
+
+    while (1) {
+        twai_message_t msg = {0};
+        msg.identifier       = CAN_ID_TIME_SYNC;
+        msg.data_length_code = 1;
+        msg.data[0]          = seq++;
+        can_driver_transmit_async(&msg);
+
+        vTaskDelayUntil(&last_wake, pdMS_TO_TICKS(s_period_ms));
+    }
+}
+
+esp_err_t can_time_sync_master_start(uint32_t period_ms)
+{
+    if (s_task) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (period_ms == 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    s_is_master = true;
+    s_period_ms = period_ms;
+
+    esp_err_t err = can_driver_add_tx_done_cb(on_tx_done, NULL);
+    if (err != ESP_OK) {
+        return err;
+    }
+    if (xTaskCreate(tsync_master_task, "TSYNC", 2048, NULL, 2, &s_task) != pdPASS) {
+        return ESP_ERR_NO_MEM;
+    }
+    ESP_LOGI(TAG, "time sync master, period %u ms", (unsigned)period_ms);
+    return ESP_OK;
+}
+
+/* ========= Chuyển đổi ========= */
+
+bool can_time_sync_valid(void)
+{
+    return s_is_master || s_model.valid;
+}
+
+int64_t can_time_sync_to_master(int64_t local_us)
+{
+    if (s_is_master) {
+        return local_us;
+    }
+    tsync_model_t m;
+    model_read(&m);
+    return m.valid ? local_us + model_offset(&m, local_us) : local_us;
+}
+
+int64_t can_time_sync_to_local(int64_t master_us)
+{
+    if (s_is_master) {
+        return master_us;
+    }
+    tsync_model_t m;
+    model_read(&m);
+    if (!m.valid) {
+        return master_us;
+    }
+    // Offset thay đổi rất chậm (drift cỡ ppm): dùng offset tại master_us - off_ref là đủ chính xác
+    int64_t local = master_us - m.off_ref;
+    return master_us - model_offset(&m, local);
+}
+
+int64_t can_time_sync_now(void)
+{
+    return can_time_sync_to_master(esp_timer_get_time());
+}
+
+void can_time_sync_get_state(can_time_sync_state_t *out)
+{
+    if (!out) {
+        return;
+    }
+    memset(out, 0, sizeof(*out));
+    if (s_is_master) {
+        out->valid = true;
+        return;
+    }
+
+    tsync_model_t m;
+    model_read(&m);
+    out->valid         = m.valid;
+    out->offset_us     = m.valid ? model_offset(&m, esp_timer_get_time()) : 0;
+    out->drift_ppb     = m.drift_ppb;
+    out->last_error_us = m.last_error_us;
+    out->samples       = m.samples;
+    out->rejected      = m.rejected;
+}
@@ -0,0 +1,58 @@
+#ifndef __CAN_BIT_TIMING_H__
+#define __CAN_BIT_TIMING_H__
+
+/*
+ * Tính bit timing (prescaler / TSEG1 / TSEG2 / SJW) cho bitrate bất kỳ.
+ * Không phụ thuộc ESP-IDF; giới hạn mặc định theo bộ TWAI của ESP32-C3.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+    uint32_t clk_hz;            // clock nguồn của bộ CAN (APB 80 MHz trên C3)
+    uint32_t brp_min, brp_max;
+    bool     brp_even;          // C3: thanh ghi lưu brp/2 - 1 nên brp phải chẵn
+    uint8_t  tseg1_max;         // PROP + PHASE1
+    uint8_t  tseg2_max;
+    uint8_t  sjw_max;
+} can_bit_timing_limits_t;
+
+#define CAN_BIT_TIMING_LIMITS_ESP32C3() {   \
+    .clk_hz    = 80000000,                  \
+    .brp_min   = 2,                         \
+    .brp_max   = 16384,                     \
+    .brp_even  = true,                      \
+    .tseg1_max = 16,                        \
+    .tseg2_max = 8,                         \
+    .sjw_max   = 4,                         \
+}
+
+typedef struct {
+    uint32_t brp;
+    uint8_t  tseg1;
+    uint8_t  tseg2;
+    uint8_t  sjw;
+    uint32_t bitrate;           // bitrate thực tế với brp/tseg đã chọn
+    uint16_t sample_point;      // điểm lấy mẫu thực tế (phần nghìn)
+} can_bit_timing_t;
+
+/**
+ * @brief Chọn bit timing cho bitrate và điểm lấy mẫu (phần nghìn, ví dụ 800 = 80%).
+ *        Ưu tiên sai số bitrate nhỏ nhất, rồi điểm lấy mẫu gần nhất, rồi nhiều
+ *        time quanta hơn (SJW rộng hơn, chịu lệch clock tốt hơn).
+ * @return false nếu không có cấu hình nào lệch bitrate <= max_err_ppm
+ */
+bool can_bit_timing_calc(const can_bit_timing_limits_t *lim, uint32_t bitrate,
+                         uint16_t sample_point, uint32_t max_err_ppm,
+                         can_bit_timing_t *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __CAN_BIT_TIMING_H__ */
@@ -0,0 +1,60 @@
+#ifndef __CAN_BUS_LOAD_H__
+#define __CAN_BUS_LOAD_H__
+
+/*
+ * Tính tải bus CAN (worst-case, có bit stuffing) cho cấu hình nhiều trục.
+ * Không phụ thuộc ESP-IDF: dùng được trên firmware và trong tool host
+ * (tools/can_bus_load.c).
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+    uint32_t bitrate;           // bit/s, ví dụ 500000
+    uint32_t loop_hz;           // tần số vòng control trên master
+    uint8_t  axes_per_frame;    // số trục trong 1 frame lệnh (1 = CAN_ID_MOTOR_CMD mỗi trục)
+    uint8_t  cmd_dlc;           // DLC frame lệnh
+    uint32_t feedback_hz;       // feedback mỗi trục về master (0 = không có)
+    uint8_t  feedback_dlc;      // DLC frame feedback
+    uint32_t extra_frames_hz;   // frame khác trên bus (SYNC, heartbeat...), DLC 8
+    bool     extended;          // ID 29-bit
+} can_bus_load_cfg_t;
+
+/**
+ * @brief Số bit tối đa của 1 frame data trên bus (gồm stuffing worst-case,
+ *        EOF và 3 bit interframe space)
+ */
+uint32_t can_frame_bits_max(uint8_t dlc, bool extended);
+
+/**
+ * @brief Số bit thật của 1 frame cụ thể trên bus: tính CRC-15 và bit stuffing
+ *        đúng theo nội dung frame (+ CRC delimiter, ACK, EOF, 3 bit IFS)
+ * @param data bỏ qua khi rtr = true
+ */
+uint32_t can_frame_bits(uint32_t id, bool extended, bool rtr, uint8_t dlc, const uint8_t *data);
+
+/**
+ * @brief Số bit/s mà n_axes trục chiếm trên bus theo cấu hình cfg
+ */
+uint64_t can_bus_load_bits_per_s(const can_bus_load_cfg_t *cfg, uint32_t n_axes);
+
+/**
+ * @brief Tải bus (phần nghìn, 1000 = 100%) với n_axes trục
+ */
+uint32_t can_bus_load_permille(const can_bus_load_cfg_t *cfg, uint32_t n_axes);
+
+/**
+ * @brief Số trục tối đa sao cho tải bus <= max_permille (0 nếu không đủ cho 1 trục)
+ */
+uint32_t can_bus_load_max_axes(const can_bus_load_cfg_t *cfg, uint32_t max_permille);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __CAN_BUS_LOAD_H__
@@ -3,6 +3,7 @@
 
 #include "esp_err.h"
 #include "driver/twai.h"
+#include <stddef.h>
 #include <stdint.h>
 #include <stdbool.h>
 
@@ -11,46 +12,376 @@ extern "C" {
 #endif
 
 // ===== Protocol ID dùng chung cho Master/Slave =====
-#define CAN_ID_SETPOINT    0x101   // (KHÔNG dùng nữa, để đó nếu cần)
-#define CAN_ID_FEEDBACK    0x102   // (KHÔNG dùng nữa, để đó nếu cần)
+#define CAN_ID_SETPOINT    0x101   // Master -> Slave: góc đặt (chế độ vòng kín trên slave)
+#define CAN_ID_FEEDBACK    0x102   // Slave -> Master: góc thực tế + duty đang áp
 #define CAN_ID_MOTOR_CMD   0x103   // Master -> Slave: lệnh motor (dir + duty)
+#define CAN_ID_MOTOR_PACKED 0x104  // Master -> mọi slave: duty có dấu 11-bit, tối đa 5 trục
+#define CAN_ID_SYNC        0x105   // Master -> mọi slave: áp các duty đã stage
+#define CAN_ID_TELEMETRY   0x106   // Slave -> Master: vị trí, vận tốc, duty, lỗi, timestamp
+#define CAN_ID_TIME_SYNC   0x107   // Master -> mọi slave: mốc đồng bộ đồng hồ (xem can_time_sync.h)
+#define CAN_ID_TIME_FOLLOW 0x108   // Master -> mọi slave: thời điểm TX xong của TIME_SYNC
+#define CAN_ID_MOTOR_RAMP  0x109   // Master -> Slave: duty đích + thời gian ramp (fade LEDC)
+#define CAN_ID_CURRENT     0x10A   // Slave -> Master: dòng motor (lọc, đỉnh, số lần ngắt)
+#define CAN_ID_MOTOR_CHAR  0x10B   // Master -> Slave: chạy / xóa đặc tính motor (motor_char)
+
+// ===== Địa chỉ node (nhiều trục) =====
+// ID thực tế = ID gốc | (node << 4), node 0..15. Node 0 trùng với ID gốc ở trên
+// (tương thích master/slave 1 trục). Ví dụ MOTOR_CMD node 2 = 0x123.
+// ID gốc luôn để trống bit 4..7 cho node.
+#define CAN_NODE_SHIFT             4
+#define CAN_MAX_NODES              16
+#define CAN_ID_NODE(base, node)    ((uint32_t)(base) | ((uint32_t)((node) & 0x0F) << CAN_NODE_SHIFT))
+#define CAN_ID_NODE_OF(id)         (((id) >> CAN_NODE_SHIFT) & 0x0F)
+#define CAN_ID_BASE_OF(id)         ((id) & ~(0x0Fu << CAN_NODE_SHIFT))
+
+// Dải ID (standard, 11-bit) mà node cần nhận, first..last (bao gồm cả hai đầu)
+typedef struct {
+    uint16_t first;
+    uint16_t last;
+} can_id_range_t;
+
+#define CAN_ID_ONE(id)            { (id), (id) }
+#define CAN_ID_RANGE(first, last) { (first), (last) }
 
 /**
  * @brief Khởi tạo TWAI (CAN) cho ESP32-C3
  * @param tx_pin GPIO TX nối với CTX của MCP2551
  * @param rx_pin GPIO RX nối với CRX của MCP2551
+ * @param accept Danh sách ID/dải ID cần nhận (NULL = nhận tất cả).
+ *               Bộ lọc phần cứng (single hoặc dual) được tính chặt nhất có thể,
+ *               frame không liên quan bị loại trước khi vào RX queue.
+ * @param n_accept Số phần tử của accept
+ */
+esp_err_t can_driver_init(gpio_num_t tx_pin, gpio_num_t rx_pin,
+                          const can_id_range_t *accept, size_t n_accept);
+
+/**
+ * @brief Đặt bitrate (gọi trước can_driver_init; mặc định CONFIG_CAN_DRIVER_BITRATE)
+ * @param sample_point điểm lấy mẫu, phần nghìn (0 = CONFIG_CAN_DRIVER_SAMPLE_POINT)
+ * @return ESP_ERR_NOT_SUPPORTED nếu không có bit timing lệch <= 0.5%
+ */
+esp_err_t can_driver_set_bitrate(uint32_t bitrate, uint16_t sample_point);
+
+uint32_t can_driver_get_bitrate(void);
+
+/**
+ * @brief Dò bitrate của bus đang chạy ở chế độ listen-only (không ACK, không
+ *        error frame). Thử lần lượt từng bitrate trong window_ms, chọn bitrate
+ *        đầu tiên nhận được 2 frame hợp lệ và đặt nó cho can_driver_init.
+ *        Gọi trước can_driver_init; bus cần có ít nhất 2 node khác đang hoạt động.
+ * @param candidates NULL = 1M, 800k, 500k, 250k, 125k, 100k, 50k, 20k, 10k
+ * @return ESP_ERR_NOT_FOUND nếu không bitrate nào khớp
+ */
+esp_err_t can_driver_auto_baud(gpio_num_t tx_pin, gpio_num_t rx_pin,
+                               const uint32_t *candidates, size_t n_candidates,
+                               uint32_t window_ms, uint32_t *found);
+
+/**
+ * @brief Tính bộ lọc acceptance chặt nhất (single hoặc dual) cho danh sách ID
  */
-esp_err_t can_driver_init(gpio_num_t tx_pin, gpio_num_t rx_pin);
+esp_err_t can_driver_calc_filter(const can_id_range_t *accept, size_t n_accept,
+                                 twai_filter_config_t *out);
 
 /**
- * @brief Gửi frame CAN raw
+ * @brief Gửi frame CAN raw (block tối đa 20 ms)
+ * @note Không trộn với can_driver_transmit_async: TX-done sẽ bị gán nhầm frame
  */
 esp_err_t can_driver_transmit(const twai_message_t *msg);
 
+/* ========== TX bất đồng bộ (hàng đợi ưu tiên phần mềm) ========== */
+#define CAN_DRIVER_TX_QUEUE_LEN   16
+
+/**
+ * Gọi từ TX task sau khi frame được gửi xong (ok = true) hoặc lỗi/timeout.
+ * done_us: esp_timer_get_time() khi TX task nhận alert TX xong.
+ * latency_us: từ lúc enqueue tới done_us.
+ */
+typedef void (*can_tx_done_cb_t)(const twai_message_t *msg, bool ok, int64_t done_us,
+                                 uint32_t latency_us, void *arg);
+
+typedef struct {
+    uint32_t queued;      // frame được enqueue
+    uint32_t replaced;    // frame cũ cùng ID bị thay bởi frame mới
+    uint32_t dropped;     // hàng đợi đầy
+    uint32_t sent;
+    uint32_t failed;
+    uint32_t latency_max_us;
+} can_tx_stats_t;
+
+/**
+ * @brief Đưa frame vào hàng đợi TX và trả về ngay (không block).
+ *        Hàng đợi sắp theo độ ưu tiên CAN (ID nhỏ gửi trước, cùng ID thì FIFO);
+ *        frame cùng ID đang chờ sẽ bị thay bằng frame mới (chỉ lệnh mới nhất có
+ *        ý nghĩa). CAN_ID_MOTOR_PACKED chỉ thay frame có cùng header; lệnh motor
+ *        có trace (DLC 6) đang chờ không bị thay.
+ * @return ESP_OK, ESP_ERR_NO_MEM nếu hàng đợi đầy và frame có ưu tiên thấp nhất
+ */
+esp_err_t can_driver_transmit_async(const twai_message_t *msg);
+
+#define CAN_DRIVER_MAX_TX_DONE_CBS  4
+
+/**
+ * @brief Thêm callback TX-done (gọi theo thứ tự đăng ký, giữ ngắn và không block)
+ * @note Gọi trước khi bắt đầu gửi; không có hàm gỡ
+ */
+esp_err_t can_driver_add_tx_done_cb(can_tx_done_cb_t cb, void *arg);
+
+/**
+ * @brief Thống kê hàng đợi TX
+ */
+void can_driver_get_tx_stats(can_tx_stats_t *out);
+
 /**
  * @brief Nhận frame CAN (block với timeout)
+ * @note Không dùng chung với dispatch task (can_driver_start_dispatch)
  */
 esp_err_t can_driver_receive(twai_message_t *msg, TickType_t timeout);
 
-/* ========== Cũ (góc setpoint/feedback) – có thể bỏ nếu không dùng ========== */
-esp_err_t can_driver_send_setpoint(int16_t angle);
-esp_err_t can_driver_send_feedback(int16_t angle);
+/* ========== RX dispatch theo CAN ID ========== */
+#define CAN_DRIVER_MAX_HANDLERS   40   // 2 ID x 16 node + broadcast; tra bảng theo ID: O(1)
+
+/**
+ * Handler chạy trong dispatch task ngay khi frame về.
+ * rx_us: esp_timer_get_time() lúc twai_receive trả về.
+ * Giữ handler ngắn: không log/format, không block.
+ */
+typedef void (*can_rx_handler_t)(const twai_message_t *msg, int64_t rx_us, void *arg);
+
+/**
+ * @brief Đăng ký handler cho một CAN ID (standard frame), ghi đè nếu đã có
+ * @note Gọi trước can_driver_start_dispatch()
+ */
+esp_err_t can_driver_register_handler(uint32_t id, can_rx_handler_t fn, void *arg);
+
+/**
+ * @brief Handler cho frame không có handler riêng (NULL = bỏ qua)
+ */
+esp_err_t can_driver_set_default_handler(can_rx_handler_t fn, void *arg);
+
+/**
+ * @brief Tạo task nhận frame và gọi handler theo ID
+ */
+esp_err_t can_driver_start_dispatch(UBaseType_t priority);
+
+/* ========== Health monitor ========== */
+#define CAN_HEALTH_DEFAULT_PERIOD_MS  100
+#define CAN_HEALTH_DEFAULT_LOG_MS     5000
+
+typedef struct {
+    twai_state_t state;
+    uint32_t tx_error_counter;      // TEC / REC hiện tại (>= 128: error passive)
+    uint32_t rx_error_counter;
+    uint32_t tx_failed;             // các bộ đếm tích lũy của twai_get_status_info
+    uint32_t rx_missed;             // RX queue đầy
+    uint32_t rx_overrun;            // RX FIFO phần cứng tràn
+    uint32_t arb_lost;
+    uint32_t bus_errors;
+    uint32_t msgs_to_tx;            // đang chờ trong TX / RX queue của driver
+    uint32_t msgs_to_rx;
+    uint32_t bus_off_count;         // số lần bus-off
+    uint32_t recoveries;            // số lần recovery xong và start lại
+    uint16_t bus_load_permille;     // cửa sổ gần nhất (phần nghìn)
+    uint16_t bus_load_max_permille;
+    uint32_t log_every_ms;
+} can_health_t;
+
+/**
+ * @brief Task giám sát bus: đọc twai_get_status_info mỗi period_ms, tự
+ *        twai_initiate_recovery() khi bus-off và twai_start() lại khi xong.
+ *        Tải bus tính từ số bit thật (gồm stuffing) của frame node này gửi và
+ *        nhận; frame bị bộ lọc acceptance loại không được đếm.
+ * @param log_every_ms chu kỳ in 1 dòng log tổng hợp (0 = không log)
+ */
+esp_err_t can_driver_start_health_monitor(uint32_t period_ms, uint32_t log_every_ms);
+
+/**
+ * @brief Bản chụp trạng thái bus mới nhất
+ */
+esp_err_t can_driver_get_health(can_health_t *out);
+
+/* ========== Địa chỉ node ========== */
+/**
+ * @brief Đặt node ID của board này (mặc định 0).
+ *        Slave chỉ parse lệnh gửi tới node của mình, feedback gửi đi mang node này.
+ */
+esp_err_t can_driver_set_node_id(uint8_t node);
+uint8_t   can_driver_get_node_id(void);
+
+/* ========== Setpoint / feedback (vòng kín chạy trên slave) ========== */
+/**
+ * SETPOINT: Byte 0-1: góc đặt (int16, LE)
+ * FEEDBACK: Byte 0-1: góc thực tế (int16, LE), Byte 2-3: duty có dấu (int16, LE)
+ */
+esp_err_t can_driver_send_setpoint(int16_t angle);                  // tới node 0
+esp_err_t can_driver_send_setpoint_to(uint8_t node, int16_t angle);
+esp_err_t can_driver_send_feedback(int16_t angle, int16_t duty);    // từ node của board
+esp_err_t can_driver_parse_setpoint(const twai_message_t *msg, int16_t *angle);
+/**
+ * Parse feedback từ bất kỳ node nào; node (có thể NULL) nhận node ID nguồn
+ */
+esp_err_t can_driver_parse_feedback(const twai_message_t *msg, uint8_t *node,
+                                    int16_t *angle, int16_t *duty);
+
+/* ========== Telemetry (Slave -> Master, định kỳ) ========== */
+/**
+ * Byte 0-1: vị trí encoder (tick, 16 bit thấp của vị trí nhiều vòng, LE)
+ * Byte 2-3: vận tốc (tick/s, int16 bão hòa, LE)
+ * Byte 4-5: bit 0..10 duty có dấu 11-bit đang áp, bit 11..15 cờ lỗi (CAN_FAULT_*)
+ * Byte 6-7: thời điểm lấy mẫu (µs, 16 bit thấp, LE) theo đồng hồ master
+ *           (can_time_sync), hoặc esp_timer của slave nếu có CAN_FAULT_TIME_UNSYNCED
+ * Vị trí và timestamp bị wrap: bên nhận mở rộng lại bằng hiệu giữa 2 frame,
+ * nên chu kỳ telemetry phải < 65 ms.
+ */
+#define CAN_FAULT_WATCHDOG      0x01   // mất lệnh từ master
+#define CAN_FAULT_OVERCURRENT   0x02
+#define CAN_FAULT_BUS           0x04   // TWAI error passive / bus-off
+#define CAN_FAULT_SYNC_LOST     0x08   // mất frame SYNC
+#define CAN_FAULT_TIME_UNSYNCED 0x10   // timestamp là đồng hồ riêng của slave (chưa đồng bộ)
+#define CAN_FAULT_MASK          0x1F
+
+typedef struct {
+    int16_t  position;
+    int16_t  velocity;
+    int16_t  duty;
+    uint8_t  faults;
+    uint16_t time_us;
+} can_telemetry_t;
+
+esp_err_t can_driver_send_telemetry(const can_telemetry_t *tm);    // từ node của board
+/**
+ * Parse telemetry từ bất kỳ node nào; node (có thể NULL) nhận node ID nguồn
+ */
+esp_err_t can_driver_parse_telemetry(const twai_message_t *msg, uint8_t *node,
+                                     can_telemetry_t *tm);
+
+/* ========== Dòng motor (Slave -> Master, CAN_ID_CURRENT) ========== */
+/**
+ * Byte 0-1: dòng đã lọc (mA, LE, bão hòa 65535)
+ * Byte 2-3: dòng đỉnh (trung bình frame ADC lớn nhất) từ frame trước (mA, LE)
+ * Byte 4-5: số lần ngắt quá dòng từ lúc khởi động (LE)
+ * Byte 6  : bit 0 = đang ngắt (cầu thả trôi tới lệnh duty 0)
+ */
+typedef struct {
+    uint16_t current_ma;
+    uint16_t peak_ma;
+    uint16_t trips;
+    bool     tripped;
+} can_current_t;
+
+esp_err_t can_driver_send_current(const can_current_t *cur);       // từ node của board
+/**
+ * Parse frame dòng từ bất kỳ node nào; node (có thể NULL) nhận node ID nguồn
+ */
+esp_err_t can_driver_parse_current(const twai_message_t *msg, uint8_t *node,
+                                   can_current_t *cur);
 
 /* ========== MỚI: Lệnh motor (Master -> Slave) ========== */
 /**
  * Byte 0: dir  (0 = backward, 1 = forward)
  * Byte 1: duty LSB (0–1023)
  * Byte 2: duty MSB
+ * Tuỳ chọn (DLC 6, lệnh được trace độ trễ, xem latency_trace.h):
+ * Byte 3: số thứ tự trace
+ * Byte 4-5: thời điểm capture (µs theo đồng hồ master, 16 bit thấp, LE)
+ */
+esp_err_t can_driver_send_motor_cmd(bool dir, uint16_t duty);                 // tới node 0
+esp_err_t can_driver_send_motor_cmd_to(uint8_t node, bool dir, uint16_t duty);
+esp_err_t can_driver_send_motor_cmd_traced(uint8_t node, bool dir, uint16_t duty,
+                                           uint8_t seq, int64_t capture_us);
+
+/**
+ * Lấy thông tin trace của frame lệnh motor
+ * @return ESP_OK, ESP_ERR_NOT_FOUND nếu frame không mang trace
  */
-esp_err_t can_driver_send_motor_cmd(bool dir, uint16_t duty);
+esp_err_t can_driver_parse_motor_cmd_trace(const twai_message_t *msg,
+                                           uint8_t *seq, uint16_t *capture_us16);
 
 /**
- * Parse frame lệnh motor
+ * Parse frame lệnh motor gửi tới node của board này
  */
 esp_err_t can_driver_parse_motor_cmd(const twai_message_t *msg,
                                      bool *dir,
                                      uint16_t *duty);
 
+/* ========== Lệnh ramp motor (CAN_ID_MOTOR_RAMP) ========== */
+/**
+ * Byte 0: dir (1 = forward, 0 = backward)
+ * Byte 1-2: duty đích (0–1023, LE)
+ * Byte 3-4: thời gian ramp (ms, LE; 0 = áp ngay như CAN_ID_MOTOR_CMD)
+ * Slave đi từ duty hiện tại tới duty đích bằng fade phần cứng (motor_ramp_to),
+ * một frame thay cho chuỗi lệnh duty từng bước.
+ */
+esp_err_t can_driver_send_motor_ramp_to(uint8_t node, bool dir, uint16_t duty, uint16_t ramp_ms);
+esp_err_t can_driver_parse_motor_ramp(const twai_message_t *msg,
+                                      bool *dir, uint16_t *duty, uint16_t *ramp_ms);
+
+/* ========== Đặc tính motor (CAN_ID_MOTOR_CHAR) ========== */
+/**
+ * Byte 0: CAN_MOTOR_CHAR_*
+ * RUN: slave quét duty (~20 s, trục phải quay tự do), lưu bảng tuyến tính hóa
+ * vào NVS. Lệnh motor trong lúc quét bị bỏ qua.
+ */
+#define CAN_MOTOR_CHAR_RUN      1
+#define CAN_MOTOR_CHAR_ERASE    2      // xóa bảng, quay về duty tối thiểu cố định
+
+esp_err_t can_driver_send_motor_char(uint8_t node, uint8_t cmd);
+esp_err_t can_driver_parse_motor_char(const twai_message_t *msg, uint8_t *cmd);
+
+/* ========== Lệnh motor gộp nhiều trục (CAN_ID_MOTOR_PACKED) ========== */
+/**
+ * Chuỗi bit little-endian (bit 0 = bit 0 của byte 0):
+ *   bit 0..3 : node đầu tiên (first_node)
+ *   bit 4..6 : số slot (1..5)
+ *   bit 7    : staged (1 = chỉ lưu, áp khi nhận CAN_ID_SYNC)
+ *   bit 8 + 11*k .. : duty slot k = node first_node + k, có dấu 11-bit
+ *                    (bù 2, dấu = chiều: > 0 forward, < 0 backward, 0 = stop)
+ * DLC = ceil((8 + 11 * count) / 8): 5 trục = 8 byte, 4 trục = 7 byte.
+ * Slot CAN_PACKED_DUTY_KEEP: node đó giữ nguyên lệnh cũ (dùng cho node
+ * nằm giữa hai trục cần gửi).
+ */
+#define CAN_PACKED_MAX_AXES     5
+#define CAN_PACKED_DUTY_MAX     1023
+#define CAN_PACKED_DUTY_KEEP    (-1024)
+
+/**
+ * @brief Đóng gói duty[0..count-1] cho các node first_node .. first_node + count - 1
+ * @param duty giá trị trong [-1023, 1023] hoặc CAN_PACKED_DUTY_KEEP
+ */
+esp_err_t can_driver_encode_packed(twai_message_t *msg, uint8_t first_node,
+                                   const int16_t *duty, size_t count, bool staged);
+
+/**
+ * @brief Lấy duty của một node từ frame gộp
+ * @param[out] staged cờ staged của frame (có thể NULL)
+ * @return ESP_OK, ESP_ERR_NOT_FOUND nếu node không có trong frame hoặc slot là KEEP,
+ *         ESP_FAIL nếu frame sai định dạng
+ */
+esp_err_t can_driver_decode_packed(const twai_message_t *msg, uint8_t node,
+                                   int16_t *duty, bool *staged);
+
+/**
+ * @brief Frame newer thay frame older cùng header đang chờ TX: slot KEEP của newer
+ *        lấy lại duty của older, để lệnh chưa kịp gửi của older không bị mất
+ * @return ESP_OK, ESP_ERR_INVALID_ARG nếu không phải 2 frame gộp cùng header
+ */
+esp_err_t can_driver_merge_packed(twai_message_t *newer, const twai_message_t *older);
+
+/**
+ * @brief Đóng gói và gửi bất đồng bộ
+ */
+esp_err_t can_driver_send_packed(uint8_t first_node, const int16_t *duty, size_t count,
+                                 bool staged);
+
+/* ========== SYNC (kiểu CANopen SYNC) ========== */
+/**
+ * Byte 0: bộ đếm SYNC (tăng mỗi lần gửi, slave dùng để phát hiện mất SYNC)
+ *
+ * ID 0x105 lớn hơn CAN_ID_MOTOR_PACKED nên SYNC luôn đứng sau các frame
+ * staged cùng chu kỳ, cả trong hàng đợi TX lẫn khi arbitration trên bus.
+ */
+esp_err_t can_driver_send_sync(uint8_t counter);
+esp_err_t can_driver_parse_sync(const twai_message_t *msg, uint8_t *counter);
+
 #ifdef __cplusplus
 }
 #endif
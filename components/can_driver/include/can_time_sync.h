@@ -0,0 +1,70 @@
+#ifndef __CAN_TIME_SYNC_H__
+#define __CAN_TIME_SYNC_H__
+
+/*
+ * Đồng bộ đồng hồ master/slave kiểu two-step (giống PTP, không có delay request):
+ *   1. Master gửi CAN_ID_TIME_SYNC  { seq }
+ *      -> slave ghi lại rx_us (đồng hồ slave) của frame này
+ *   2. Khi TX task báo frame 1 đã lên bus xong, master gửi
+ *      CAN_ID_TIME_FOLLOW { seq, done_us (48-bit, LE) }
+ *      -> slave có cặp (rx_us, done_us) cho cùng một thời điểm trên bus
+ *
+ * Cả hai timestamp đều lấy bằng phần mềm ngay sau khi TWAI báo TX xong / RX xong,
+ * độ trễ ISR + đánh thức task ở hai phía gần như bằng nhau nên phần lớn tự triệt tiêu.
+ * Slave ước lượng offset + drift (PI servo) để đổi giờ local <-> giờ master.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CAN_TIME_SYNC_DEFAULT_PERIOD_MS  100
+
+typedef struct {
+    bool     valid;         // đã có ít nhất 1 mẫu hợp lệ
+    int64_t  offset_us;     // giờ master - giờ local, tại thời điểm đọc
+    int32_t  drift_ppb;     // tốc độ đồng hồ master so với local (ppb)
+    int32_t  last_error_us; // sai số dự đoán của mẫu gần nhất (trước khi hiệu chỉnh)
+    uint32_t samples;
+    uint32_t rejected;      // mẫu bị loại do sai lệch quá lớn
+} can_time_sync_state_t;
+
+/**
+ * @brief Master: gửi TIME_SYNC mỗi period_ms, kèm FOLLOW khi TX xong
+ * @note Gọi sau can_driver_init()
+ */
+esp_err_t can_time_sync_master_start(uint32_t period_ms);
+
+/**
+ * @brief Slave: đăng ký handler TIME_SYNC / TIME_FOLLOW
+ * @note Gọi trước can_driver_start_dispatch(); slave phải nhận 2 ID này qua bộ lọc
+ */
+esp_err_t can_time_sync_slave_start(void);
+
+/**
+ * @brief Đã đồng bộ chưa (master luôn true)
+ */
+bool can_time_sync_valid(void);
+
+/**
+ * @brief Đổi giờ local (esp_timer_get_time) <-> giờ master. Chưa đồng bộ: trả về nguyên giá trị
+ */
+int64_t can_time_sync_to_master(int64_t local_us);
+int64_t can_time_sync_to_local(int64_t master_us);
+
+/**
+ * @brief Giờ master hiện tại theo ước lượng của board này
+ */
+int64_t can_time_sync_now(void);
+
+void can_time_sync_get_state(can_time_sync_state_t *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __CAN_TIME_SYNC_H__
@@ -0,0 +1,160 @@
+#include "control_loop.h"
+#include "freertos/task.h"
+#include "driver/gptimer.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include "esp_check.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define CTRL_TAG "CTRL_LOOP"
+
+struct control_loop {
+    gptimer_handle_t timer;
+    TaskHandle_t task;
+    control_loop_fn_t fn;
+    void* arg;
+    uint32_t period_us;
+    bool running;
+    control_loop_stats_t stats;
+    portMUX_TYPE mux;
+};
+
+static bool IRAM_ATTR control_loop_on_alarm(gptimer_handle_t timer,
+                                            const gptimer_alarm_event_data_t* edata,
+                                            void* arg) {
+    struct control_loop* l = (struct control_loop*)arg;
+    (void)timer;
+    (void)edata;
+    BaseType_t woken = pdFALSE;
+    vTaskNotifyGiveFromISR(l->task, &woken);
+    return woken == pdTRUE;
+}
+
+static inline uint32_t _hist_bin(uint32_t us) {
+    uint32_t bin = (us == 0) ? 0 : 32 - __builtin_clz(us);
+    return (bin < CONTROL_LOOP_HIST_BINS) ? bin : CONTROL_LOOP_HIST_BINS - 1;
+}
+
+static void _record(struct control_loop* l, uint32_t missed, uint32_t latency, uint32_t exec) {
+    control_loop_stats_t* s = &l->stats;
+    portENTER_CRITICAL(&l->mux);
+    s->missed += missed;
+    if (latency + exec > l->period_us) s->overruns++;
+    if (s->cycles == 0 || latency < s->latency_min_us) s->latency_min_us = latency;
+    if (latency > s->latency_max_us) s->latency_max_us = latency;
+    if (s->cycles == 0 || exec < s->exec_min_us) s->exec_min_us = exec;
+    if (exec > s->exec_max_us) s->exec_max_us = exec;
+    s->latency_sum_us += latency;
+    s->exec_sum_us += exec;
+    s->latency_hist[_hist_bin(latency)]++;
+    s->exec_hist[_hist_bin(exec)]++;
+    s->cycles++;
+    portEXIT_CRITICAL(&l->mux);
+}
+
+static void control_loop_task(void* arg) {
+    struct control_loop* l = (struct control_loop*)arg;
+    while (1) {
+        uint32_t n = ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        if (n == 0) continue;
+
+        // The timer auto-reloads to 0 on every alarm, so its count is the
+        // time elapsed since this release.
+        uint64_t since_release = 0;
+        gptimer_get_raw_count(l->timer, &since_release);
+
+        int64_t t0 = esp_timer_get_time();
+        l->fn(l->arg);
+        uint32_t exec = (uint32_t)(esp_timer_get_time() - t0);
+
+        _record(l, n - 1, (uint32_t)since_release, exec);
+    }
+}
+
+esp_err_t control_loop_create(const control_loop_config_t* cfg, control_loop_handle_t* out) {
+    if (!cfg || !out || !cfg->fn || cfg->period_us < 100) return ESP_ERR_INVALID_ARG;
+    esp_err_t ret = ESP_OK;
+
+    struct control_loop* l = (struct control_loop*)calloc(1, sizeof(*l));
+    if (!l) return ESP_ERR_NO_MEM;
+    l->fn = cfg->fn;
+    l->arg = cfg->arg;
+    l->period_us = cfg->period_us;
+    l->mux = (portMUX_TYPE)portMUX_INITIALIZER_UNLOCKED;
+
+    gptimer_config_t timer_cfg = {
+        .clk_src = GPTIMER_CLK_SRC_DEFAULT,
+        .direction = GPTIMER_COUNT_UP,
+        .resolution_hz = 1000000,
+    };
+    ESP_GOTO_ON_ERROR(gptimer_new_timer(&timer_cfg, &l->timer), err, CTRL_TAG, "gptimer");
+
+    gptimer_alarm_config_t alarm_cfg = {
+        .reload_count = 0,
+        .alarm_count = cfg->period_us,
+        .flags.auto_reload_on_alarm = true,
+    };
+    ESP_GOTO_ON_ERROR(gptimer_set_alarm_action(l->timer, &alarm_cfg), err, CTRL_TAG, "alarm");
+    gptimer_event_callbacks_t cbs = { .on_alarm = control_loop_on_alarm };
+    ESP_GOTO_ON_ERROR(gptimer_register_event_callbacks(l->timer, &cbs, l), err, CTRL_TAG, "callbacks");
+    ESP_GOTO_ON_ERROR(gptimer_enable(l->timer), err, CTRL_TAG, "enable");
+
+    UBaseType_t prio = cfg->priority ? cfg->priority : configMAX_PRIORITIES - 2;
+    if (xTaskCreate(control_loop_task, cfg->name ? cfg->name : "CTRL_LOOP",
+                    cfg->stack_size ? cfg->stack_size : 4096, l, prio, &l->task) != pdPASS) {
+        gptimer_disable(l->timer);
+        ret = ESP_ERR_NO_MEM;
+        goto err;
+    }
+
+    *out = l;
+    return ESP_OK;
+
+err:
+    if (l->timer) gptimer_del_timer(l->timer);
+    free(l);
+    return ret;
+}
+
+esp_err_t control_loop_start(control_loop_handle_t h) {
+    if (!h) return ESP_ERR_INVALID_ARG;
+    if (h->running) return ESP_OK;
+    ESP_RETURN_ON_ERROR(gptimer_set_raw_count(h->timer, 0), CTRL_TAG, "reset count");
+    ESP_RETURN_ON_ERROR(gptimer_start(h->timer), CTRL_TAG, "start");
+    h->running = true;
+    ESP_LOGI(CTRL_TAG, "Loop started, period %u us", (unsigned)h->period_us);
+    return ESP_OK;
+}
+
+esp_err_t control_loop_stop(control_loop_handle_t h) {
+    if (!h) return ESP_ERR_INVALID_ARG;
+    if (!h->running) return ESP_OK;
+    ESP_RETURN_ON_ERROR(gptimer_stop(h->timer), CTRL_TAG, "stop");
+    h->running = false;
+    return ESP_OK;
+}
+
+void control_loop_delete(control_loop_handle_t h) {
+    if (!h) return;
+    control_loop_stop(h);
+    gptimer_disable(h->timer);
+    gptimer_del_timer(h->timer);
+    vTaskDelete(h->task);
+    free(h);
+}
+
+esp_err_t control_loop_get_stats(control_loop_handle_t h, control_loop_stats_t* out) {
+    if (!h || !out) return ESP_ERR_INVALID_ARG;
+    portENTER_CRITICAL(&h->mux);
+    *out = h->stats;
+    portEXIT_CRITICAL(&h->mux);
+    return ESP_OK;
+}
+
+void control_loop_reset_stats(control_loop_handle_t h) {
+    if (!h) return;
+    portENTER_CRITICAL(&h->mux);
+    memset(&h->stats, 0, sizeof(h->stats));
+    portEXIT_CRITICAL(&h->mux);
+}
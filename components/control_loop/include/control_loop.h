@@ -0,0 +1,49 @@
+#pragma once
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Periodic control loop: a GPTimer alarm (1 us resolution) notifies a
+// dedicated high-priority task, so the period does not depend on the
+// FreeRTOS tick and does not drift with the loop body.
+
+#define CONTROL_LOOP_HIST_BINS  16   // bin i counts samples in [2^(i-1), 2^i) us, bin 0 = 0 us
+
+typedef struct control_loop* control_loop_handle_t;
+typedef void (*control_loop_fn_t)(void* arg);
+
+typedef struct {
+    uint32_t          period_us;     // e.g. 10000 (100 Hz), 1000 (1 kHz), 500 (2 kHz)
+    control_loop_fn_t fn;            // loop body, called once per period
+    void*             arg;
+    const char*       name;          // task name, NULL = "CTRL_LOOP"
+    uint32_t          stack_size;    // 0 = 4096
+    UBaseType_t       priority;      // 0 = configMAX_PRIORITIES - 2
+} control_loop_config_t;
+
+typedef struct {
+    uint32_t cycles;                 // loop bodies executed
+    uint32_t missed;                 // releases skipped because the previous cycle was still running
+    uint32_t overruns;               // cycles where wake-up latency + execution exceeded the period
+    uint32_t latency_min_us, latency_max_us;   // timer release -> task start (jitter)
+    uint32_t exec_min_us,    exec_max_us;
+    uint64_t latency_sum_us, exec_sum_us;
+    uint32_t latency_hist[CONTROL_LOOP_HIST_BINS];
+    uint32_t exec_hist[CONTROL_LOOP_HIST_BINS];
+} control_loop_stats_t;
+
+esp_err_t control_loop_create(const control_loop_config_t* cfg, control_loop_handle_t* out);
+esp_err_t control_loop_start(control_loop_handle_t h);
+esp_err_t control_loop_stop(control_loop_handle_t h);
+void      control_loop_delete(control_loop_handle_t h);
+esp_err_t control_loop_get_stats(control_loop_handle_t h, control_loop_stats_t* out);
+void      control_loop_reset_stats(control_loop_handle_t h);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,181 @@
+#include "current_sense.h"
+#include "esp_adc/adc_continuous.h"
+#include "esp_adc/adc_cali.h"
+#include "esp_adc/adc_cali_scheme.h"
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "soc/soc_caps.h"
+#include <string.h>
+
+static const char* TAG = "CURRENT_SENSE";
+
+#define ADC_FULL_SCALE_MV   2500    // ADC_ATTEN_DB_12 on C3 without calibration
+#define ADC_RAW_MAX         4095
+
+static struct {
+    adc_continuous_handle_t adc;
+    adc_cali_handle_t       cali;
+    motor_handle_t          motor;
+    adc_channel_t           channel;
+    uint32_t                sense_mohm;
+    uint32_t                trip_raw;       // 0 = no trip
+    uint8_t                 shift;
+
+    // Written only by the conversion-done ISR
+    volatile uint32_t       frame_raw;
+    volatile uint32_t       peak_raw;
+    volatile uint32_t       filt_q8;        // raw << 8
+    volatile uint32_t       frames;
+    volatile uint32_t       trips;
+    volatile bool           tripped;
+} s_cs;
+
+static int32_t raw_to_ma(uint32_t raw) {
+    int mv = 0;
+    if (!s_cs.cali || adc_cali_raw_to_voltage(s_cs.cali, (int)raw, &mv) != ESP_OK) {
+        mv = (int)(raw * ADC_FULL_SCALE_MV / ADC_RAW_MAX);
+    }
+    return (int32_t)((int64_t)mv * 1000 / s_cs.sense_mohm);
+}
+
+// Smallest raw code that reads >= ma (calibration curve is monotonic)
+static uint32_t ma_to_raw(uint32_t ma) {
+    uint32_t lo = 0, hi = ADC_RAW_MAX + 1;
+    while (lo < hi) {
+        uint32_t mid = (lo + hi) / 2;
+        if (raw_to_ma(mid) >= (int32_t)ma) hi = mid;
+        else                               lo = mid + 1;
+    }
+    return lo;
+}
+
+static bool IRAM_ATTR on_conv_done(adc_continuous_handle_t handle,
+                                   const adc_continuous_evt_data_t* edata, void* user_data) {
+    (void)handle;
+    (void)user_data;
+    const adc_digi_output_data_t* p = (const adc_digi_output_data_t*)edata->conv_frame_buffer;
+    uint32_t n   = edata->size / SOC_ADC_DIGI_RESULT_BYTES;
+    uint32_t sum = 0, cnt = 0;
+
+    for (uint32_t i = 0; i < n; i++) {
+        if (p[i].type2.unit == 0 && p[i].type2.channel == s_cs.channel) {
+            sum += p[i].type2.data;
+            cnt++;
+        }
+    }
+    if (!cnt) return false;
+
+    uint32_t mean = sum / cnt;
+    s_cs.frame_raw = mean;
+    if (mean > s_cs.peak_raw) s_cs.peak_raw = mean;
+    int32_t diff = (int32_t)(mean << 8) - (int32_t)s_cs.filt_q8;
+    s_cs.filt_q8 = (uint32_t)((int32_t)s_cs.filt_q8 + (diff >> s_cs.shift));
+    s_cs.frames++;
+
+    // Fast trip: no task in the path, the bridge coasts before the ISR returns
+    if (s_cs.trip_raw && mean >= s_cs.trip_raw && !s_cs.tripped) {
+        if (s_cs.motor) motor_trip_isr(s_cs.motor);
+        s_cs.tripped = true;
+        s_cs.trips++;
+    }
+    return false;
+}
+
+esp_err_t current_sense_start(const current_sense_config_t* cfg) {
+    if (!cfg || !cfg->pwm_freq_hz || !cfg->sense_mohm || !cfg->periods_per_frame) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (s_cs.adc) return ESP_ERR_INVALID_STATE;
+
+    uint32_t spp = cfg->samples_per_period;
+    if (!spp) {
+        spp = CURRENT_SENSE_MAX_SAMPLE_HZ / cfg->pwm_freq_hz;
+        if (spp > UINT8_MAX) spp = UINT8_MAX;
+    }
+    uint32_t sample_hz = spp * cfg->pwm_freq_hz;
+    if (spp == 0 || sample_hz < CURRENT_SENSE_MIN_SAMPLE_HZ || sample_hz > CURRENT_SENSE_MAX_SAMPLE_HZ) {
+        ESP_LOGE(TAG, "no sample rate for %u Hz PWM", (unsigned)cfg->pwm_freq_hz);
+        return ESP_ERR_INVALID_ARG;
+    }
+    uint32_t frame_bytes = spp * cfg->periods_per_frame * SOC_ADC_DIGI_RESULT_BYTES;
+
+    s_cs.motor      = cfg->motor;
+    s_cs.channel    = cfg->channel;
+    s_cs.sense_mohm = cfg->sense_mohm;
+    s_cs.shift      = cfg->filter_shift;
+
+    // Calibration is optional: without it raw_to_ma falls back to a linear scale
+    adc_cali_curve_fitting_config_t cali_cfg = {
+        .unit_id  = ADC_UNIT_1,
+        .chan     = cfg->channel,
+        .atten    = ADC_ATTEN_DB_12,
+        .bitwidth = ADC_BITWIDTH_12,
+    };
+    if (adc_cali_create_scheme_curve_fitting(&cali_cfg, &s_cs.cali) != ESP_OK) {
+        ESP_LOGW(TAG, "no ADC calibration, using linear scale");
+        s_cs.cali = NULL;
+    }
+    s_cs.trip_raw = cfg->trip_ma ? ma_to_raw(cfg->trip_ma) : 0;
+
+    adc_continuous_handle_cfg_t hcfg = {
+        .max_store_buf_size = frame_bytes * 4,
+        .conv_frame_size    = frame_bytes,
+        .flags.flush_pool   = 1,    // only the ISR consumes frames, never adc_continuous_read
+    };
+    esp_err_t ret = adc_continuous_new_handle(&hcfg, &s_cs.adc);
+    if (ret != ESP_OK) return ret;
+
+    adc_digi_pattern_config_t pattern = {
+        .atten     = ADC_ATTEN_DB_12,
+        .channel   = (uint8_t)cfg->channel,
+        .unit      = ADC_UNIT_1,
+        .bit_width = ADC_BITWIDTH_12,
+    };
+    adc_continuous_config_t ccfg = {
+        .pattern_num    = 1,
+        .adc_pattern    = &pattern,
+        .sample_freq_hz = sample_hz,
+        .conv_mode      = ADC_CONV_SINGLE_UNIT_1,
+        .format         = ADC_DIGI_OUTPUT_FORMAT_TYPE2,
+    };
+    adc_continuous_evt_cbs_t cbs = {
+        .on_conv_done = on_conv_done,
+    };
+    if ((ret = adc_continuous_config(s_cs.adc, &ccfg)) != ESP_OK ||
+        (ret = adc_continuous_register_event_callbacks(s_cs.adc, &cbs, NULL)) != ESP_OK ||
+        (ret = adc_continuous_start(s_cs.adc)) != ESP_OK) {
+        adc_continuous_deinit(s_cs.adc);
+        s_cs.adc = NULL;
+        return ret;
+    }
+
+    ESP_LOGI(TAG, "ch %d: %u Hz (%u/PWM period), frame %u periods, trip %u mA (raw %u)",
+             (int)cfg->channel, (unsigned)sample_hz, (unsigned)spp,
+             (unsigned)cfg->periods_per_frame, (unsigned)cfg->trip_ma, (unsigned)s_cs.trip_raw);
+    return ESP_OK;
+}
+
+int32_t current_sense_get_ma(void) {
+    if (!s_cs.adc) return 0;
+    return raw_to_ma(s_cs.filt_q8 >> 8);
+}
+
+esp_err_t current_sense_get(current_sense_reading_t* out, bool reset_peak) {
+    if (!out) return ESP_ERR_INVALID_ARG;
+    if (!s_cs.adc) return ESP_ERR_INVALID_STATE;
+
+    out->filtered_ma = raw_to_ma(s_cs.filt_q8 >> 8);
+    out->frame_ma    = raw_to_ma(s_cs.frame_raw);
+    out->peak_ma     = raw_to_ma(s_cs.peak_raw);
+    out->frames      = s_cs.frames;
+    out->trips       = s_cs.trips;
+    out->tripped     = s_cs.tripped;
+    if (reset_peak) s_cs.peak_raw = s_cs.frame_raw;
+    return ESP_OK;
+}
+
+esp_err_t current_sense_clear_trip(void) {
+    if (!s_cs.adc) return ESP_ERR_INVALID_STATE;
+    s_cs.tripped = false;
+    return s_cs.motor ? motor_clear_trip(s_cs.motor) : ESP_OK;
+}
@@ -0,0 +1,60 @@
+#pragma once
+#include "esp_err.h"
+#include "hal/adc_types.h"
+#include "motor_driver.h"
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Motor current from the bridge sense resistor, sampled with ADC continuous
+// (DMA) mode. The C3 ADC cannot be triggered by the LEDC, so the sample rate
+// is set to an integer multiple of the PWM frequency and every conversion
+// frame spans a whole number of PWM periods: the frame mean is the mean
+// current over those periods regardless of phase.
+//
+// The conversion-done callback (ISR) computes the frame mean, updates an IIR
+// filter and, above trip_ma, cuts the bridge at once with motor_trip_isr().
+//
+// With the L298N the sense resistor only carries current while the bridge
+// is driven, so the reading is the supply-side (duty-weighted) current.
+
+#define CURRENT_SENSE_MAX_SAMPLE_HZ  83333   // SOC_ADC_SAMPLE_FREQ_THRES_HIGH on C3
+#define CURRENT_SENSE_MIN_SAMPLE_HZ  611
+
+typedef struct {
+    adc_channel_t  channel;             // ADC1 channel of the sense voltage
+    motor_handle_t motor;               // bridge to trip (NULL = measure only)
+    uint32_t       pwm_freq_hz;         // motor PWM frequency
+    uint8_t        samples_per_period;  // 0 = as many as the ADC allows
+    uint8_t        periods_per_frame;   // frame length = trip detection latency
+    uint32_t       sense_mohm;          // sense resistor, times amplifier gain
+    uint32_t       trip_ma;             // frame mean above this trips (0 = off)
+    uint8_t        filter_shift;        // IIR: filt += (frame - filt) >> shift
+} current_sense_config_t;
+
+typedef struct {
+    int32_t  filtered_ma;
+    int32_t  frame_ma;      // last frame mean
+    int32_t  peak_ma;       // highest frame mean since the last get with reset_peak
+    uint32_t frames;
+    uint32_t trips;
+    bool     tripped;
+} current_sense_reading_t;
+
+// One instance (the C3 has a single ADC DMA controller)
+esp_err_t current_sense_start(const current_sense_config_t* cfg);
+
+// Filtered current in mA; cheap enough for a 1 kHz control loop
+int32_t   current_sense_get_ma(void);
+
+esp_err_t current_sense_get(current_sense_reading_t* out, bool reset_peak);
+
+// Re-arm after a trip; also releases the motor (motor_clear_trip)
+esp_err_t current_sense_clear_trip(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -1,61 +1,246 @@
 #include "encoder_driver.h"
+#include "ky040_seqlock.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/portmacro.h"
 #include "driver/gpio.h"
 #include "esp_timer.h"
 #include "esp_log.h"
 #include "esp_check.h"
+#include "soc/soc_caps.h"
+#if SOC_PCNT_SUPPORTED
+#include "driver/pulse_cnt.h"
+#endif
 #include <stdlib.h>
 
 #define KY040_TAG "KY040DRV"
 
+#define KY040_EDGE_RING           8       // edge timestamps kept for velocity (power of 2)
+#define KY040_VEL_HISPEED_US      2000    // edge period below this -> average over the ring
+#define KY040_VEL_TIMEOUT_US      500000  // no edge for this long -> standing still
+
+#define KY040_PCNT_LIMIT          30000   // watch points; the driver carries the range on overflow
+#define KY040_PCNT_GLITCH_NS_DEF  1000
+
 struct ky040_encoder {
     gpio_num_t clk, dt, sw;
-    volatile int32_t ticks;
+    // Sequence counter: the single writer (encoder ISR) makes it odd while
+    // updating ticks/last_edge_us/last_dir, readers retry on change.
+    volatile uint32_t seq;
+    volatile int32_t ticks;      // wrapped into [0, span)
+    volatile int64_t position;   // unbounded multi-turn count
     volatile int64_t last_edge_us;
+    volatile int8_t last_dir;
+    volatile uint32_t edge_us[KY040_EDGE_RING];  // low 32 bits of esp_timer, newest at edge_head
+    volatile int8_t edge_dir[KY040_EDGE_RING];
+    volatile uint8_t edge_head;
+    volatile uint8_t edge_fill;                   // valid entries, saturates at KY040_EDGE_RING
     uint32_t debounce_us;
     bool reverse;
     uint16_t ang_min, ang_max;   // inclusive
     uint16_t span;               // (ang_max - ang_min + 1)
+    uint32_t counts_per_rev;
+    uint32_t mdeg_per_count_q16; // 360000 / counts_per_rev, Q16
     portMUX_TYPE mux;
+    ky040_backend_t backend;
+#if SOC_PCNT_SUPPORTED
+    pcnt_unit_handle_t pcnt_unit;
+    pcnt_channel_handle_t pcnt_chan_a, pcnt_chan_b;
+    int64_t pcnt_offset;          // zero rebase from the switch ISR, guarded by mux
+#endif
 };
 
 static bool s_isr_service_installed = false;
 
-static inline bool _debounce_ok(volatile int64_t* last_us, uint32_t min_us) {
+static inline bool _debounce_ok(int64_t now, int64_t last_us, uint32_t min_us) {
     if (min_us == 0) return true;
-    int64_t now = esp_timer_get_time();
-    if (now - *last_us < (int64_t)min_us) return false;
-    *last_us = now;
-    return true;
+    return now - last_us >= (int64_t)min_us;
+}
+
+static inline void _write_begin(struct ky040_encoder* e) {
+    ky040_seq_write_begin(&e->seq);
+}
+
+static inline void _write_end(struct ky040_encoder* e) {
+    ky040_seq_write_end(&e->seq);
+}
+
+static void _read_snapshot(struct ky040_encoder* e, ky040_snapshot_t* out) {
+    uint32_t s0;
+    do {
+        s0 = ky040_seq_read_begin(&e->seq);
+        out->ticks        = e->ticks;
+        out->position     = e->position;
+        out->last_edge_us = e->last_edge_us;
+        out->dir          = e->last_dir;
+    } while (ky040_seq_read_retry(&e->seq, s0));
 }
 
-static inline uint16_t _angle_mod(struct ky040_encoder* e, int32_t ticks) {
+static inline int32_t _ticks_mod(struct ky040_encoder* e, int32_t ticks) {
     int32_t t = ticks % e->span;
     if (t < 0) t += e->span;
-    return (uint16_t)(e->ang_min + t);
+    return t;
 }
 
 static void IRAM_ATTR ky040_isr_clk(void* arg) {
     struct ky040_encoder* e = (struct ky040_encoder*)arg;
-    if (!_debounce_ok(&e->last_edge_us, e->debounce_us)) return;
+    int64_t now = esp_timer_get_time();
+    if (!_debounce_ok(now, e->last_edge_us, e->debounce_us)) return;
 
     int dt = gpio_get_level(e->dt);
     int delta = (dt == 0) ? +1 : -1;
     if (e->reverse) delta = -delta;
 
-    portENTER_CRITICAL_ISR(&e->mux);
-    e->ticks += delta;
-    if (e->ticks >= (int32_t)e->span) e->ticks -= e->span;
-    if (e->ticks < 0)                 e->ticks += e->span;
-    portEXIT_CRITICAL_ISR(&e->mux);
+    int32_t t = e->ticks + delta;
+    if (t >= (int32_t)e->span) t -= e->span;
+    if (t < 0)                 t += e->span;
+
+    uint8_t head = (e->edge_head + 1) & (KY040_EDGE_RING - 1);
+
+    _write_begin(e);
+    e->ticks = t;
+    e->position = e->position + delta;
+    e->last_edge_us = now;
+    e->last_dir = (int8_t)delta;
+    e->edge_us[head] = (uint32_t)now;
+    e->edge_dir[head] = (int8_t)delta;
+    e->edge_head = head;
+    if (e->edge_fill < KY040_EDGE_RING) e->edge_fill++;
+    _write_end(e);
 }
 
 static void IRAM_ATTR ky040_isr_sw(void* arg) {
     struct ky040_encoder* e = (struct ky040_encoder*)arg;
-    portENTER_CRITICAL_ISR(&e->mux);
+    _write_begin(e);
     e->ticks = 0;
-    portEXIT_CRITICAL_ISR(&e->mux);
+    e->position = 0;
+    _write_end(e);
+#if SOC_PCNT_SUPPORTED
+    if (e->backend == KY040_BACKEND_PCNT) {
+        // Rebase the offset instead of clearing the hardware counter from the ISR.
+        int count = 0;
+        portENTER_CRITICAL_ISR(&e->mux);
+        pcnt_unit_get_count(e->pcnt_unit, &count);
+        e->pcnt_offset = -count;
+        portEXIT_CRITICAL_ISR(&e->mux);
+    }
+#endif
+}
+
+#if SOC_PCNT_SUPPORTED
+// The driver folds limit overflows into the count (accum_count); the offset is
+// read with it under the mux so the 64-bit value and the count stay paired.
+static int64_t _pcnt_read(struct ky040_encoder* e) {
+    int count = 0;
+    portENTER_CRITICAL(&e->mux);
+    pcnt_unit_get_count(e->pcnt_unit, &count);
+    int64_t raw = e->pcnt_offset + count;
+    portEXIT_CRITICAL(&e->mux);
+    return e->reverse ? -raw : raw;
+}
+
+static esp_err_t _pcnt_setup(struct ky040_encoder* e, uint32_t glitch_ns) {
+    esp_err_t ret = ESP_OK;
+    pcnt_unit_config_t unit_cfg = {
+        .high_limit = KY040_PCNT_LIMIT,
+        .low_limit  = -KY040_PCNT_LIMIT,
+        .flags.accum_count = 1,
+    };
+    ESP_RETURN_ON_ERROR(pcnt_new_unit(&unit_cfg, &e->pcnt_unit), KY040_TAG, "pcnt unit");
+
+    pcnt_glitch_filter_config_t filter_cfg = {
+        .max_glitch_ns = glitch_ns ? glitch_ns : KY040_PCNT_GLITCH_NS_DEF,
+    };
+    ESP_GOTO_ON_ERROR(pcnt_unit_set_glitch_filter(e->pcnt_unit, &filter_cfg), err, KY040_TAG, "glitch filter");
+
+    // Full 4x decoding: each channel counts both edges of one phase, gated by the other phase.
+    pcnt_chan_config_t chan_a_cfg = { .edge_gpio_num = e->clk, .level_gpio_num = e->dt };
+    pcnt_chan_config_t chan_b_cfg = { .edge_gpio_num = e->dt,  .level_gpio_num = e->clk };
+    ESP_GOTO_ON_ERROR(pcnt_new_channel(e->pcnt_unit, &chan_a_cfg, &e->pcnt_chan_a), err, KY040_TAG, "pcnt chan A");
+    ESP_GOTO_ON_ERROR(pcnt_new_channel(e->pcnt_unit, &chan_b_cfg, &e->pcnt_chan_b), err, KY040_TAG, "pcnt chan B");
+    // Same sense as the GPIO backend: DT low on CLK rising edge counts up.
+    pcnt_channel_set_edge_action(e->pcnt_chan_a, PCNT_CHANNEL_EDGE_ACTION_INCREASE, PCNT_CHANNEL_EDGE_ACTION_DECREASE);
+    pcnt_channel_set_level_action(e->pcnt_chan_a, PCNT_CHANNEL_LEVEL_ACTION_INVERSE, PCNT_CHANNEL_LEVEL_ACTION_KEEP);
+    pcnt_channel_set_edge_action(e->pcnt_chan_b, PCNT_CHANNEL_EDGE_ACTION_DECREASE, PCNT_CHANNEL_EDGE_ACTION_INCREASE);
+    pcnt_channel_set_level_action(e->pcnt_chan_b, PCNT_CHANNEL_LEVEL_ACTION_INVERSE, PCNT_CHANNEL_LEVEL_ACTION_KEEP);
+
+    ESP_GOTO_ON_ERROR(pcnt_unit_add_watch_point(e->pcnt_unit, KY040_PCNT_LIMIT), err, KY040_TAG, "watch point");
+    ESP_GOTO_ON_ERROR(pcnt_unit_add_watch_point(e->pcnt_unit, -KY040_PCNT_LIMIT), err, KY040_TAG, "watch point");
+
+    ESP_GOTO_ON_ERROR(pcnt_unit_enable(e->pcnt_unit), err, KY040_TAG, "pcnt enable");
+    ESP_GOTO_ON_ERROR(pcnt_unit_clear_count(e->pcnt_unit), err, KY040_TAG, "pcnt clear");
+    ESP_GOTO_ON_ERROR(pcnt_unit_start(e->pcnt_unit), err, KY040_TAG, "pcnt start");
+    return ESP_OK;
+
+err:
+    if (e->pcnt_chan_b) pcnt_del_channel(e->pcnt_chan_b);
+    if (e->pcnt_chan_a) pcnt_del_channel(e->pcnt_chan_a);
+    pcnt_del_unit(e->pcnt_unit);
+    e->pcnt_unit = NULL;
+    return ret;
+}
+
+static void _pcnt_teardown(struct ky040_encoder* e) {
+    if (!e->pcnt_unit) return;
+    pcnt_unit_stop(e->pcnt_unit);
+    pcnt_unit_disable(e->pcnt_unit);
+    pcnt_del_channel(e->pcnt_chan_a);
+    pcnt_del_channel(e->pcnt_chan_b);
+    pcnt_del_unit(e->pcnt_unit);
+    e->pcnt_unit = NULL;
+}
+#endif
+
+// Edge history copied out of the ISR ring, index 0 = newest.
+typedef struct {
+    uint32_t us[KY040_EDGE_RING];
+    int8_t   dir[KY040_EDGE_RING];
+    uint8_t  n;
+} ky040_edges_t;
+
+static void _read_edges(struct ky040_encoder* e, ky040_edges_t* out) {
+    uint32_t s0;
+    do {
+        s0 = ky040_seq_read_begin(&e->seq);
+        uint8_t head = e->edge_head;
+        out->n = e->edge_fill;
+        for (int i = 0; i < KY040_EDGE_RING; i++) {
+            uint8_t k = (head - i) & (KY040_EDGE_RING - 1);
+            out->us[i]  = e->edge_us[k];
+            out->dir[i] = e->edge_dir[k];
+        }
+    } while (ky040_seq_read_retry(&e->seq, s0));
+}
+
+// Velocity (Q8 ticks/s) around edge k. Slow: 1/period of that edge.
+// Fast: edge count over the longest same-direction run in the ring.
+// min_period_us lets the newest estimate decay while no edge arrives.
+static int32_t _velocity_at(const ky040_edges_t* ed, int k, uint32_t min_period_us) {
+    if (ed->n < k + 2) return 0;
+    int8_t dir = ed->dir[k];
+    if (ed->dir[k + 1] != dir) return 0;
+
+    uint32_t period = ed->us[k] - ed->us[k + 1];
+    if (period < min_period_us) period = min_period_us;
+    if (period == 0) return 0;
+
+    int64_t edges = 1;
+    if (period < KY040_VEL_HISPEED_US) {
+        int n = 1;
+        while (k + n + 1 < ed->n && ed->dir[k + n + 1] == dir) n++;
+        period = ed->us[k] - ed->us[k + n];
+        edges = n;
+        if (period == 0) return 0;
+    }
+    int64_t v = (edges * (1000000LL << KY040_VEL_FRAC_BITS)) / period;
+    if (v > INT32_MAX) v = INT32_MAX;
+    return (int32_t)(dir * v);
+}
+
+static int32_t _velocity_now(const ky040_edges_t* ed, uint32_t now_us) {
+    if (ed->n == 0) return 0;
+    uint32_t idle = now_us - ed->us[0];
+    if (idle > KY040_VEL_TIMEOUT_US) return 0;
+    return _velocity_at(ed, 0, idle);
 }
 
 esp_err_t ky040_install_isr_service_once(int intr_flags) {
@@ -74,6 +259,9 @@ esp_err_t ky040_create(const ky040_config_t* cfg, ky040_handle_t* out) {
     if (cfg->angle_max < cfg->angle_min) return ESP_ERR_INVALID_ARG;
     uint32_t span = (uint32_t)cfg->angle_max - (uint32_t)cfg->angle_min + 1;
     if (span == 0 || span > 65535) return ESP_ERR_INVALID_ARG;
+#if !SOC_PCNT_SUPPORTED
+    if (cfg->backend == KY040_BACKEND_PCNT) return ESP_ERR_NOT_SUPPORTED;
+#endif
 
     ESP_RETURN_ON_ERROR(ky040_install_isr_service_once(0), KY040_TAG, "ISR service");
 
@@ -90,18 +278,32 @@ esp_err_t ky040_create(const ky040_config_t* cfg, ky040_handle_t* out) {
     e->ang_min = cfg->angle_min;
     e->ang_max = cfg->angle_max;
     e->span    = (uint16_t)span;
+    e->counts_per_rev = cfg->counts_per_rev ? cfg->counts_per_rev : span;
+    e->mdeg_per_count_q16 = (uint32_t)((360000ULL << 16) / e->counts_per_rev);
     e->mux = (portMUX_TYPE)portMUX_INITIALIZER_UNLOCKED;
+    e->backend = cfg->backend;
 
     gpio_config_t io = {
         .pin_bit_mask = (1ULL << e->clk) | (1ULL << e->dt),
         .mode = GPIO_MODE_INPUT,
         .pull_up_en = GPIO_PULLUP_ENABLE,
         .pull_down_en = GPIO_PULLDOWN_DISABLE,
-        .intr_type = GPIO_INTR_POSEDGE
+        .intr_type = (e->backend == KY040_BACKEND_PCNT) ? GPIO_INTR_DISABLE : GPIO_INTR_POSEDGE
     };
     ESP_ERROR_CHECK(gpio_config(&io));
-    ESP_ERROR_CHECK(gpio_set_intr_type(e->dt, GPIO_INTR_DISABLE));
-    ESP_ERROR_CHECK(gpio_isr_handler_add(e->clk, ky040_isr_clk, (void*)e));
+#if SOC_PCNT_SUPPORTED
+    if (e->backend == KY040_BACKEND_PCNT) {
+        esp_err_t err = _pcnt_setup(e, cfg->glitch_ns);
+        if (err != ESP_OK) {
+            free(e);
+            return err;
+        }
+    } else
+#endif
+    {
+        ESP_ERROR_CHECK(gpio_set_intr_type(e->dt, GPIO_INTR_DISABLE));
+        ESP_ERROR_CHECK(gpio_isr_handler_add(e->clk, ky040_isr_clk, (void*)e));
+    }
 
     if (e->sw >= 0) {
         gpio_config_t io_sw = {
@@ -121,6 +323,10 @@ esp_err_t ky040_create(const ky040_config_t* cfg, ky040_handle_t* out) {
 
 void ky040_delete(ky040_handle_t h) {
     if (!h) return;
+#if SOC_PCNT_SUPPORTED
+    if (h->backend == KY040_BACKEND_PCNT) _pcnt_teardown(h);
+    else
+#endif
     gpio_isr_handler_remove(h->clk);
     if (h->sw >= 0) gpio_isr_handler_remove(h->sw);
     free(h);
@@ -133,8 +339,19 @@ void ky040_set_reverse(ky040_handle_t h, bool reverse) {
 
 void ky040_reset_zero(ky040_handle_t h) {
     if (!h) return;
+    // Task-side writers mask the ISR so the single-writer rule still holds.
     portENTER_CRITICAL(&h->mux);
+#if SOC_PCNT_SUPPORTED
+    // Cleared with the offset so _pcnt_read never pairs a new count with an old offset.
+    if (h->backend == KY040_BACKEND_PCNT) pcnt_unit_clear_count(h->pcnt_unit);
+#endif
+    _write_begin(h);
     h->ticks = 0;
+    h->position = 0;
+    _write_end(h);
+#if SOC_PCNT_SUPPORTED
+    h->pcnt_offset = 0;
+#endif
     portEXIT_CRITICAL(&h->mux);
 }
 
@@ -148,23 +365,91 @@ esp_err_t ky040_set_range(ky040_handle_t h, uint16_t angle_min, uint16_t angle_m
     h->ang_min = angle_min;
     h->ang_max = angle_max;
     h->span    = (uint16_t)span;
+    _write_begin(h);
     if (h->ticks >= (int32_t)h->span) h->ticks %= h->span;
     if (h->ticks < 0)                 h->ticks = (h->ticks % h->span + h->span) % h->span;
+    _write_end(h);
     portEXIT_CRITICAL(&h->mux);
     return ESP_OK;
 }
 
 int32_t ky040_get_ticks(ky040_handle_t h) {
     if (!h) return 0;
-    int32_t t;
-    portENTER_CRITICAL(&h->mux);
-    t = h->ticks;
-    portEXIT_CRITICAL(&h->mux);
-    return t;
+#if SOC_PCNT_SUPPORTED
+    if (h->backend == KY040_BACKEND_PCNT) return _ticks_mod(h, (int32_t)(_pcnt_read(h) % h->span));
+#endif
+    ky040_snapshot_t snap;
+    _read_snapshot(h, &snap);
+    return snap.ticks;
+}
+
+int32_t ky040_get_velocity(ky040_handle_t h) {
+    if (!h || h->backend != KY040_BACKEND_GPIO_ISR) return 0;
+    ky040_edges_t ed;
+    _read_edges(h, &ed);
+    return _velocity_now(&ed, (uint32_t)esp_timer_get_time());
+}
+
+int32_t ky040_get_accel(ky040_handle_t h) {
+    if (!h || h->backend != KY040_BACKEND_GPIO_ISR) return 0;
+    ky040_edges_t ed;
+    _read_edges(h, &ed);
+    if (ed.n < 3) return 0;
+
+    uint32_t now = (uint32_t)esp_timer_get_time();
+    int32_t v0 = _velocity_now(&ed, now);
+    int32_t v1 = _velocity_at(&ed, 1, 0);
+    // The two estimates sit at the midpoints of edge intervals 0-1 and 1-2.
+    uint32_t dt = (ed.us[0] - ed.us[2]) / 2;
+    uint32_t idle = now - ed.us[0];
+    if (idle > ed.us[0] - ed.us[1]) dt += (idle - (ed.us[0] - ed.us[1])) / 2;
+    if (dt == 0) return 0;
+
+    int64_t a = ((int64_t)(v0 - v1) * 1000000LL) / dt;
+    if (a > INT32_MAX) a = INT32_MAX;
+    if (a < INT32_MIN) a = INT32_MIN;
+    return (int32_t)a;
+}
+
+esp_err_t ky040_get_snapshot(ky040_handle_t h, ky040_snapshot_t* out) {
+    if (!h || !out) return ESP_ERR_INVALID_ARG;
+    _read_snapshot(h, out);
+#if SOC_PCNT_SUPPORTED
+    if (h->backend == KY040_BACKEND_PCNT) {
+        out->position = _pcnt_read(h);
+        out->ticks = _ticks_mod(h, (int32_t)(out->position % h->span));
+    }
+#endif
+    return ESP_OK;
 }
 
 uint16_t ky040_get_angle(ky040_handle_t h) {
     if (!h) return 0;
+    // ticks are kept wrapped by the ISR, so no modulo on this path
     int32_t t = ky040_get_ticks(h);
-    return _angle_mod(h, t);
+    return (uint16_t)(h->ang_min + t);
+}
+
+int64_t ky040_get_position(ky040_handle_t h) {
+    if (!h) return 0;
+#if SOC_PCNT_SUPPORTED
+    if (h->backend == KY040_BACKEND_PCNT) return _pcnt_read(h);
+#endif
+    ky040_snapshot_t snap;
+    _read_snapshot(h, &snap);
+    return snap.position;
+}
+
+int64_t ky040_get_position_mdeg(ky040_handle_t h) {
+    if (!h) return 0;
+    return (ky040_get_position(h) * (int64_t)h->mdeg_per_count_q16) >> 16;
+}
+
+int32_t ky040_shortest_error(ky040_handle_t h, int32_t target, int32_t actual) {
+    if (!h) return 0;
+    int32_t span = h->span;
+    int32_t err = target - actual;
+    if (err >  span / 2)  err -= span;
+    if (err < -span / 2)  err += span;
+    return err;
 }
\ No newline at end of file
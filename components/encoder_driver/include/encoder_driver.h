@@ -10,16 +10,34 @@ extern "C" {
 
 typedef struct ky040_encoder* ky040_handle_t;
 
+#define KY040_VEL_FRAC_BITS 8     // velocity/accel are fixed-point, 1.0 = (1 << 8)
+
+typedef enum {
+    KY040_BACKEND_GPIO_ISR = 0,   // CLK edge interrupt, 1 tick per detent
+    KY040_BACKEND_PCNT,           // pulse counter, 4x quadrature (4 ticks per detent), no CPU per edge
+} ky040_backend_t;
+
 typedef struct {
     gpio_num_t gpio_clk;
     gpio_num_t gpio_dt;
     gpio_num_t gpio_sw;           // set to -1 if unused
     bool       reverse_dir;
-    uint32_t   debounce_us;       // 0 = off
+    uint32_t   debounce_us;       // 0 = off (GPIO_ISR backend only)
     uint16_t   angle_min;         // e.g., 0
     uint16_t   angle_max;         // e.g., 90
+    ky040_backend_t backend;      // default GPIO_ISR
+    uint32_t   glitch_ns;         // PCNT glitch filter, 0 = default (1000 ns)
+    uint32_t   counts_per_rev;    // scale for ky040_get_position_mdeg, 0 = angle span
 } ky040_config_t;
 
+// Consistent view of the ISR-published state, read without masking interrupts.
+typedef struct {
+    int32_t ticks;                // wrapped into [0, span)
+    int64_t position;             // unbounded multi-turn count
+    int64_t last_edge_us;         // esp_timer time of the last counted edge (GPIO_ISR backend)
+    int8_t  dir;                  // +1 / -1 for the last edge, 0 before the first one
+} ky040_snapshot_t;
+
 esp_err_t ky040_install_isr_service_once(int intr_flags);
 esp_err_t ky040_create(const ky040_config_t* cfg, ky040_handle_t* out);
 void      ky040_delete(ky040_handle_t h);
@@ -28,6 +46,21 @@ void      ky040_reset_zero(ky040_handle_t h);
 esp_err_t ky040_set_range(ky040_handle_t h, uint16_t angle_min, uint16_t angle_max);
 int32_t   ky040_get_ticks(ky040_handle_t h);
 uint16_t  ky040_get_angle(ky040_handle_t h);
+esp_err_t ky040_get_snapshot(ky040_handle_t h, ky040_snapshot_t* out);
+
+// Multi-turn position: raw counts (never wraps) and millidegrees scaled by
+// counts_per_rev with a precomputed Q16 factor (no division per read).
+int64_t   ky040_get_position(ky040_handle_t h);
+int64_t   ky040_get_position_mdeg(ky040_handle_t h);
+
+// Shortest signed distance from actual to target on the wrapped [0, span) circle.
+// Both inputs must already be within one span (ticks or angles of the same encoder).
+int32_t   ky040_shortest_error(ky040_handle_t h, int32_t target, int32_t actual);
+
+// Velocity in ticks/s and acceleration in ticks/s^2, both Q(KY040_VEL_FRAC_BITS).
+// Computed from the ISR edge-timestamp ring (GPIO_ISR backend only, 0 otherwise).
+int32_t   ky040_get_velocity(ky040_handle_t h);
+int32_t   ky040_get_accel(ky040_handle_t h);
 
 #ifdef __cplusplus
 }
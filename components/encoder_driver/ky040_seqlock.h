@@ -0,0 +1,34 @@
+#pragma once
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+// Single-writer sequence counter shared by the encoder ISR and its readers.
+// IDF-free so the host stress test (tools/ky040_seqlock_stress.c) runs the
+// same code. The writer makes the counter odd while it updates the guarded
+// fields; a reader copies them and retries if the counter moved.
+
+static inline void ky040_seq_write_begin(volatile uint32_t* seq) {
+    *seq = *seq + 1;
+    atomic_thread_fence(memory_order_release);
+}
+
+static inline void ky040_seq_write_end(volatile uint32_t* seq) {
+    atomic_thread_fence(memory_order_release);
+    *seq = *seq + 1;
+}
+
+// Waits out a write in progress. On the target the writer is an ISR (or a
+// task with the ISR masked), so it always finishes before the reader resumes.
+static inline uint32_t ky040_seq_read_begin(const volatile uint32_t* seq) {
+    uint32_t s0;
+    while ((s0 = *seq) & 1u) { }
+    atomic_thread_fence(memory_order_acquire);
+    return s0;
+}
+
+// True if a write overlapped the copy and it must be taken again
+static inline bool ky040_seq_read_retry(const volatile uint32_t* seq, uint32_t s0) {
+    atomic_thread_fence(memory_order_acquire);
+    return *seq != s0;
+}
@@ -0,0 +1,51 @@
+#pragma once
+#include "esp_err.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// End-to-end latency tracer. A command is tagged with a sequence number and
+// the timestamp of the event that caused it (e.g. an encoder edge). Each
+// pipeline stage then calls ltrace_mark(), which stores, per stage, the time
+// since capture and the time since the previous stage in a ring buffer.
+// ltrace_report() prints min/avg/p99/max of both per stage.
+//
+// All timestamps of one tag must be on the same clock; across boards use
+// master time (can_time_sync_to_master()).
+
+#define LTRACE_MAX_STAGES   8
+#define LTRACE_RING_LEN     128
+
+typedef struct {
+    uint8_t seq;
+    int64_t capture_us;     // event that caused the command
+    int64_t last_us;        // previous mark (capture_us before the first one)
+} ltrace_tag_t;
+
+// stage_names must stay valid (string literals); n_stages <= LTRACE_MAX_STAGES
+esp_err_t ltrace_init(const char* const* stage_names, size_t n_stages);
+
+// Start a new tag with the next sequence number
+void ltrace_begin(ltrace_tag_t* tag, int64_t capture_us);
+
+// Rebuild a tag received from another node (seq and capture carried in the frame)
+void ltrace_resume(ltrace_tag_t* tag, uint8_t seq, int64_t capture_us);
+
+// Record that the tagged command reached `stage` at now_us. Safe from any task.
+void ltrace_mark(ltrace_tag_t* tag, size_t stage, int64_t now_us);
+
+void ltrace_reset(void);
+
+// Print per-stage statistics with ESP_LOGI
+void ltrace_report(void);
+
+// Low-priority task reading the console: 't' = report, 'r' = reset
+esp_err_t ltrace_start_console(void);
+
+#ifdef __cplusplus
+}
+#endif
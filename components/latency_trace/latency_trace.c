@@ -0,0 +1,171 @@
+#include "latency_trace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+static const char* TAG = "LTRACE";
+
+typedef struct {
+    uint8_t  seq;
+    uint32_t total_us;      // capture -> this stage
+    uint32_t stage_us;      // previous stage -> this stage
+} ltrace_sample_t;
+
+typedef struct {
+    ltrace_sample_t ring[LTRACE_RING_LEN];
+    uint32_t        head;   // total samples written; ring index = head % LEN
+} ltrace_stage_t;
+
+static const char* const* s_names = NULL;
+static size_t             s_n_stages = 0;
+static ltrace_stage_t     s_stages[LTRACE_MAX_STAGES];
+static uint8_t            s_next_seq = 0;
+static portMUX_TYPE       s_mux = portMUX_INITIALIZER_UNLOCKED;
+
+esp_err_t ltrace_init(const char* const* stage_names, size_t n_stages)
+{
+    if (!stage_names || n_stages == 0 || n_stages > LTRACE_MAX_STAGES) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    s_names = stage_names;
+    s_n_stages = n_stages;
+    ltrace_reset();
+    return ESP_OK;
+}
+
+void ltrace_begin(ltrace_tag_t* tag, int64_t capture_us)
+{
+    portENTER_CRITICAL(&s_mux);
+    uint8_t seq = s_next_seq++;
+    portEXIT_CRITICAL(&s_mux);
+    ltrace_resume(tag, seq, capture_us);
+}
+
+void ltrace_resume(ltrace_tag_t* tag, uint8_t seq, int64_t capture_us)
+{
+    tag->seq = seq;
+    tag->capture_us = capture_us;
+    tag->last_us = capture_us;
+}
+
+static uint32_t clamp_us(int64_t v)
+{
+    if (v < 0) return 0;
+    if (v > UINT32_MAX) return UINT32_MAX;
+    return (uint32_t)v;
+}
+
+void ltrace_mark(ltrace_tag_t* tag, size_t stage, int64_t now_us)
+{
+    if (!tag || stage >= s_n_stages) {
+        return;
+    }
+    ltrace_sample_t smp = {
+        .seq = tag->seq,
+        .total_us = clamp_us(now_us - tag->capture_us),
+        .stage_us = clamp_us(now_us - tag->last_us),
+    };
+    tag->last_us = now_us;
+
+    ltrace_stage_t* st = &s_stages[stage];
+    portENTER_CRITICAL(&s_mux);
+    st->ring[st->head % LTRACE_RING_LEN] = smp;
+    st->head++;
+    portEXIT_CRITICAL(&s_mux);
+}
+
+void ltrace_reset(void)
+{
+    portENTER_CRITICAL(&s_mux);
+    memset(s_stages, 0, sizeof(s_stages));
+    portEXIT_CRITICAL(&s_mux);
+}
+
+static int cmp_u32(const void* a, const void* b)
+{
+    uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+    return (x > y) - (x < y);
+}
+
+typedef struct {
+    uint32_t min, avg, p99, max;
+} ltrace_summary_t;
+
+// Sorts v in place
+static ltrace_summary_t summarize(uint32_t* v, size_t n)
+{
+    qsort(v, n, sizeof(v[0]), cmp_u32);
+    uint64_t sum = 0;
+    for (size_t i = 0; i < n; i++) {
+        sum += v[i];
+    }
+    size_t p99 = (n * 99 + 99) / 100;   // nearest-rank
+    return (ltrace_summary_t){
+        .min = v[0],
+        .avg = (uint32_t)(sum / n),
+        .p99 = v[(p99 ? p99 : 1) - 1],
+        .max = v[n - 1],
+    };
+}
+
+void ltrace_report(void)
+{
+    static ltrace_sample_t snap[LTRACE_RING_LEN];   // console task only
+    static uint32_t total[LTRACE_RING_LEN], stage[LTRACE_RING_LEN];
+
+    ESP_LOGI(TAG, "%-10s %5s | %-27s | %-27s", "stage", "n",
+             "since capture min/avg/p99/max", "since prev stage min/avg/p99/max");
+    for (size_t s = 0; s < s_n_stages; s++) {
+        portENTER_CRITICAL(&s_mux);
+        uint32_t head = s_stages[s].head;
+        memcpy(snap, s_stages[s].ring, sizeof(snap));
+        portEXIT_CRITICAL(&s_mux);
+
+        size_t n = head < LTRACE_RING_LEN ? head : LTRACE_RING_LEN;
+        if (n == 0) {
+            ESP_LOGI(TAG, "%-10s %5u | -", s_names[s], 0u);
+            continue;
+        }
+        for (size_t i = 0; i < n; i++) {
+            total[i] = snap[i].total_us;
+            stage[i] = snap[i].stage_us;
+        }
+        ltrace_summary_t t = summarize(total, n);
+        ltrace_summary_t d = summarize(stage, n);
+        ESP_LOGI(TAG, "%-10s %5u | %6u %6u %6u %6u | %6u %6u %6u %6u",
+                 s_names[s], (unsigned)n,
+                 (unsigned)t.min, (unsigned)t.avg, (unsigned)t.p99, (unsigned)t.max,
+                 (unsigned)d.min, (unsigned)d.avg, (unsigned)d.p99, (unsigned)d.max);
+    }
+}
+
+static void ltrace_console_task(void* arg)
+{
+    (void)arg;
+    while (1) {
+        int c = getchar();
+        if (c == 't') {
+            ltrace_report();
+        } else if (c == 'r') {
+            ltrace_reset();
+            ESP_LOGI(TAG, "reset");
+        } else if (c == EOF) {
+            // UART console is non-blocking by default: poll
+            clearerr(stdin);
+            vTaskDelay(pdMS_TO_TICKS(100));
+        }
+    }
+}
+
+esp_err_t ltrace_start_console(void)
+{
+    if (xTaskCreate(ltrace_console_task, "LTRACE", 3072, NULL, 1, NULL) != pdPASS) {
+        return ESP_ERR_NO_MEM;
+    }
+    ESP_LOGI(TAG, "console: 't' = latency report, 'r' = reset");
+    return ESP_OK;
+}
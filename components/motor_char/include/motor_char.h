@@ -0,0 +1,89 @@
+#pragma once
+#include "esp_err.h"
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Motor self-characterization and command linearization.
+//
+// motor_char_run() sweeps the duty with the motor free to turn and watches
+// the encoder: it finds the breakaway duty of each direction, then measures
+// the steady speed at MOTOR_CHAR_POINTS duties from breakaway to duty_max.
+// From that curve it builds a lookup table that maps a control effort
+// (fraction of the slower direction's top speed) to the duty that produces
+// it, so the loop sees a roughly linear plant with no static-friction gap.
+// The result is stored in NVS and reloaded at boot.
+
+#define MOTOR_CHAR_VERSION   1
+#define MOTOR_CHAR_POINTS    16                            // speed samples per direction
+#define MOTOR_CHAR_LUT_BITS  6
+#define MOTOR_CHAR_LUT_N     ((1 << MOTOR_CHAR_LUT_BITS) + 1)
+#define MOTOR_CHAR_FWD       0
+#define MOTOR_CHAR_REV       1
+
+typedef struct {
+    uint16_t version;                               // MOTOR_CHAR_VERSION
+    uint16_t duty_max;
+    bool     measured;                              // false = motor_char_default()
+    uint16_t breakaway[2];                          // [MOTOR_CHAR_FWD / _REV]
+    uint16_t duty[2][MOTOR_CHAR_POINTS];
+    int32_t  speed[2][MOTOR_CHAR_POINTS];           // tick/s, made monotonic
+    uint32_t effort_q16;                            // (LUT_N - 1) / duty_max, Q16
+    uint16_t lut[2][MOTOR_CHAR_LUT_N];              // effort k*duty_max/(LUT_N-1) -> duty
+} motor_char_t;
+
+typedef struct {
+    // Signed duty in [-duty_max, duty_max], 0 = stop; an error aborts the sweep
+    esp_err_t (*apply)(int32_t duty, void* ctx);
+    int32_t   (*position)(void* ctx);               // multi-turn encoder ticks
+    void*     ctx;
+    int32_t   duty_max;
+    int32_t   step;                                 // breakaway search increment, 0 = duty_max / 128
+    uint32_t  step_ms;                              // dwell per increment, 0 = 40
+    int32_t   move_ticks;                           // travel that counts as moving, 0 = 2
+    uint32_t  settle_ms;                            // per speed point before measuring, 0 = 200
+    uint32_t  measure_ms;                           // speed averaging window, 0 = 300
+    int32_t   max_travel;                           // |position - start| limit, checked every
+                                                    // tick; reaching it aborts. 0 = unlimited
+} motor_char_config_t;
+
+// Blocking (~20 s with defaults); run it from its own task with the control
+// loop and command watchdog parked. Directions alternate at every point so
+// the axis stays near where it started.
+// ESP_ERR_NOT_FOUND: the motor never moved; ESP_ERR_INVALID_STATE: max_travel hit.
+esp_err_t motor_char_run(const motor_char_config_t* cfg, motor_char_t* out);
+
+// Table equivalent to a fixed minimum duty: non-zero effort e maps
+// linearly to [min_duty, duty_max] in both directions.
+void      motor_char_default(motor_char_t* c, int32_t duty_max, int32_t min_duty);
+
+// NVS namespace "motor_char", one blob per key
+esp_err_t motor_char_save(const motor_char_t* c, const char* key);
+// ESP_ERR_NOT_FOUND if absent, ESP_ERR_INVALID_VERSION if stored with another layout
+esp_err_t motor_char_load(motor_char_t* c, const char* key);
+esp_err_t motor_char_erase(const char* key);
+
+// Effort in [-duty_max, duty_max] -> signed duty. Two table reads and one
+// multiply; safe to call from the control loop.
+static inline int32_t motor_char_linearize(const motor_char_t* c, int32_t effort) {
+    if (effort == 0) return 0;
+    int      dir = effort < 0 ? MOTOR_CHAR_REV : MOTOR_CHAR_FWD;
+    uint32_t mag = (uint32_t)(effort < 0 ? -effort : effort);
+    uint32_t pos = mag * c->effort_q16;
+    uint32_t idx = pos >> 16;
+    int32_t  out;
+    if (idx >= MOTOR_CHAR_LUT_N - 1) {
+        out = c->lut[dir][MOTOR_CHAR_LUT_N - 1];
+    } else {
+        int32_t a = c->lut[dir][idx], b = c->lut[dir][idx + 1];
+        out = a + (int32_t)(((int64_t)(b - a) * (pos & 0xFFFF)) >> 16);
+    }
+    return dir == MOTOR_CHAR_REV ? -out : out;
+}
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,231 @@
+#include "motor_char.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "nvs.h"
+#include "esp_log.h"
+#include <stdlib.h>
+#include <string.h>
+
+static const char* TAG = "MOTOR_CHAR";
+
+#define MOTOR_CHAR_NVS_NS  "motor_char"
+
+static void build_lut(motor_char_t* c) {
+    c->effort_q16 = ((uint32_t)(MOTOR_CHAR_LUT_N - 1) << 16) / c->duty_max;
+    if (!c->measured) return;
+
+    // Both directions share the slower top speed, so equal efforts give equal speeds
+    int32_t vmax = c->speed[MOTOR_CHAR_FWD][MOTOR_CHAR_POINTS - 1];
+    if (c->speed[MOTOR_CHAR_REV][MOTOR_CHAR_POINTS - 1] < vmax) {
+        vmax = c->speed[MOTOR_CHAR_REV][MOTOR_CHAR_POINTS - 1];
+    }
+
+    for (int d = 0; d < 2; d++) {
+        const int32_t*  v    = c->speed[d];
+        const uint16_t* duty = c->duty[d];
+        size_t i = 0;
+        c->lut[d][0] = c->breakaway[d];
+        for (int k = 1; k < MOTOR_CHAR_LUT_N; k++) {
+            int32_t target = (int32_t)((int64_t)vmax * k / (MOTOR_CHAR_LUT_N - 1));
+            while (i + 1 < MOTOR_CHAR_POINTS && v[i + 1] < target) i++;
+            if (target <= v[i]) {
+                c->lut[d][k] = duty[i];
+            } else if (i + 1 >= MOTOR_CHAR_POINTS) {
+                c->lut[d][k] = duty[MOTOR_CHAR_POINTS - 1];
+            } else {
+                // v[i] < target <= v[i + 1]: interpolate the duty
+                c->lut[d][k] = (uint16_t)(duty[i] + (int64_t)(duty[i + 1] - duty[i]) *
+                                          (target - v[i]) / (v[i + 1] - v[i]));
+            }
+        }
+    }
+}
+
+void motor_char_default(motor_char_t* c, int32_t duty_max, int32_t min_duty) {
+    if (!c || duty_max <= 0) return;
+    if (min_duty < 0)        min_duty = 0;
+    if (min_duty > duty_max) min_duty = duty_max;
+
+    memset(c, 0, sizeof(*c));
+    c->version  = MOTOR_CHAR_VERSION;
+    c->duty_max = (uint16_t)duty_max;
+    c->breakaway[MOTOR_CHAR_FWD] = c->breakaway[MOTOR_CHAR_REV] = (uint16_t)min_duty;
+    for (int k = 0; k < MOTOR_CHAR_LUT_N; k++) {
+        uint16_t d = (uint16_t)(min_duty + (duty_max - min_duty) * k / (MOTOR_CHAR_LUT_N - 1));
+        c->lut[MOTOR_CHAR_FWD][k] = c->lut[MOTOR_CHAR_REV][k] = d;
+    }
+    build_lut(c);
+}
+
+// ---- Sweep ----
+
+static void delay_ms(uint32_t ms) {
+    TickType_t t = pdMS_TO_TICKS(ms);
+    vTaskDelay(t ? t : 1);
+}
+
+static bool travel_exceeded(const motor_char_config_t* cfg, int32_t start) {
+    return cfg->max_travel && abs(cfg->position(cfg->ctx) - start) >= cfg->max_travel;
+}
+
+// Apply duty for ms, checking the travel limit every tick so the sweep stops
+// close to the limit instead of one full dwell past it
+static esp_err_t hold(const motor_char_config_t* cfg, int32_t duty, uint32_t ms, int32_t start) {
+    esp_err_t err = cfg->apply(duty, cfg->ctx);
+    if (err != ESP_OK) return err;
+    if (!cfg->max_travel) {
+        delay_ms(ms);
+        return ESP_OK;
+    }
+    TickType_t t0 = xTaskGetTickCount();
+    TickType_t n  = pdMS_TO_TICKS(ms) ? pdMS_TO_TICKS(ms) : 1;
+    do {
+        vTaskDelay(1);
+        if (travel_exceeded(cfg, start)) {
+            cfg->apply(0, cfg->ctx);
+            return ESP_ERR_INVALID_STATE;
+        }
+    } while (xTaskGetTickCount() - t0 < n);
+    return ESP_OK;
+}
+
+static esp_err_t find_breakaway(const motor_char_config_t* cfg, int32_t sign, int32_t start,
+                                uint16_t* out) {
+    int32_t p0 = cfg->position(cfg->ctx);
+    for (int32_t duty = cfg->step; duty <= cfg->duty_max; duty += cfg->step) {
+        esp_err_t err = hold(cfg, sign * duty, cfg->step_ms, start);
+        if (err != ESP_OK) return err;
+        if (abs(cfg->position(cfg->ctx) - p0) >= cfg->move_ticks) {
+            *out = (uint16_t)duty;
+            return ESP_OK;
+        }
+    }
+    return ESP_ERR_NOT_FOUND;
+}
+
+static esp_err_t sweep(const motor_char_config_t* cfg, motor_char_t* c) {
+    int32_t   start = cfg->position(cfg->ctx);
+    esp_err_t err;
+
+    for (int d = 0; d < 2; d++) {
+        err = find_breakaway(cfg, d == MOTOR_CHAR_FWD ? 1 : -1, start, &c->breakaway[d]);
+        if (err == ESP_OK) err = hold(cfg, 0, cfg->settle_ms, start);
+        if (err != ESP_OK) return err;
+    }
+
+    // Alternate directions at every point to keep the axis near its start
+    for (int i = 0; i < MOTOR_CHAR_POINTS; i++) {
+        for (int d = 0; d < 2; d++) {
+            int32_t b    = c->breakaway[d];
+            int32_t duty = b + (cfg->duty_max - b) * i / (MOTOR_CHAR_POINTS - 1);
+            err = hold(cfg, d == MOTOR_CHAR_FWD ? duty : -duty, cfg->settle_ms, start);
+            if (err != ESP_OK) return err;
+
+            int32_t    p0 = cfg->position(cfg->ctx);
+            TickType_t t0 = xTaskGetTickCount();
+            err = hold(cfg, d == MOTOR_CHAR_FWD ? duty : -duty, cfg->measure_ms, start);
+            if (err != ESP_OK) return err;
+            uint32_t dt_ms = (uint32_t)(xTaskGetTickCount() - t0) * portTICK_PERIOD_MS;
+
+            int32_t v = (int32_t)((int64_t)abs(cfg->position(cfg->ctx) - p0) * 1000 /
+                                  (dt_ms ? dt_ms : 1));
+            // Noise can make the raw curve dip; the inverse lookup needs it monotonic
+            if (i > 0 && v < c->speed[d][i - 1]) v = c->speed[d][i - 1];
+            c->duty[d][i]  = (uint16_t)duty;
+            c->speed[d][i] = v;
+        }
+    }
+    return cfg->apply(0, cfg->ctx);
+}
+
+esp_err_t motor_char_run(const motor_char_config_t* cfg_in, motor_char_t* out) {
+    if (!cfg_in || !out || !cfg_in->apply || !cfg_in->position || cfg_in->duty_max <= 0 ||
+        cfg_in->duty_max > UINT16_MAX) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    motor_char_config_t cfg = *cfg_in;
+    if (cfg.step <= 0)       cfg.step       = cfg.duty_max / 128 ? cfg.duty_max / 128 : 1;
+    if (!cfg.step_ms)        cfg.step_ms    = 40;
+    if (cfg.move_ticks <= 0) cfg.move_ticks = 2;
+    if (!cfg.settle_ms)      cfg.settle_ms  = 200;
+    if (!cfg.measure_ms)     cfg.measure_ms = 300;
+
+    motor_char_t c;
+    memset(&c, 0, sizeof(c));
+    c.version  = MOTOR_CHAR_VERSION;
+    c.duty_max = (uint16_t)cfg.duty_max;
+    c.measured = true;
+
+    esp_err_t err = sweep(&cfg, &c);
+    if (err != ESP_OK) {
+        cfg.apply(0, cfg.ctx);
+        ESP_LOGE(TAG, "sweep aborted: %s", esp_err_to_name(err));
+        return err;
+    }
+    if (c.speed[MOTOR_CHAR_FWD][MOTOR_CHAR_POINTS - 1] <= 0 ||
+        c.speed[MOTOR_CHAR_REV][MOTOR_CHAR_POINTS - 1] <= 0) {
+        ESP_LOGE(TAG, "no speed measured");
+        return ESP_ERR_NOT_FOUND;
+    }
+    build_lut(&c);
+
+    ESP_LOGI(TAG, "breakaway fwd=%u rev=%u, top speed fwd=%d rev=%d tick/s",
+             c.breakaway[MOTOR_CHAR_FWD], c.breakaway[MOTOR_CHAR_REV],
+             (int)c.speed[MOTOR_CHAR_FWD][MOTOR_CHAR_POINTS - 1],
+             (int)c.speed[MOTOR_CHAR_REV][MOTOR_CHAR_POINTS - 1]);
+    for (int i = 0; i < MOTOR_CHAR_POINTS; i++) {
+        ESP_LOGD(TAG, "  fwd %4u -> %6d   rev %4u -> %6d",
+                 c.duty[MOTOR_CHAR_FWD][i], (int)c.speed[MOTOR_CHAR_FWD][i],
+                 c.duty[MOTOR_CHAR_REV][i], (int)c.speed[MOTOR_CHAR_REV][i]);
+    }
+    *out = c;
+    return ESP_OK;
+}
+
+// ---- NVS ----
+
+esp_err_t motor_char_save(const motor_char_t* c, const char* key) {
+    if (!c || !key) return ESP_ERR_INVALID_ARG;
+    nvs_handle_t h;
+    esp_err_t err = nvs_open(MOTOR_CHAR_NVS_NS, NVS_READWRITE, &h);
+    if (err != ESP_OK) return err;
+    err = nvs_set_blob(h, key, c, sizeof(*c));
+    if (err == ESP_OK) err = nvs_commit(h);
+    nvs_close(h);
+    return err;
+}
+
+esp_err_t motor_char_load(motor_char_t* c, const char* key) {
+    if (!c || !key) return ESP_ERR_INVALID_ARG;
+    nvs_handle_t h;
+    esp_err_t err = nvs_open(MOTOR_CHAR_NVS_NS, NVS_READONLY, &h);
+    if (err == ESP_ERR_NVS_NOT_FOUND) return ESP_ERR_NOT_FOUND;
+    if (err != ESP_OK) return err;
+
+    motor_char_t tmp;
+    size_t len = sizeof(tmp);
+    err = nvs_get_blob(h, key, &tmp, &len);
+    nvs_close(h);
+    if (err == ESP_ERR_NVS_NOT_FOUND) return ESP_ERR_NOT_FOUND;
+    if (err == ESP_ERR_NVS_INVALID_LENGTH) return ESP_ERR_INVALID_VERSION;
+    if (err != ESP_OK) return err;
+    if (len != sizeof(tmp) || tmp.version != MOTOR_CHAR_VERSION || tmp.duty_max == 0) {
+        return ESP_ERR_INVALID_VERSION;
+    }
+
+    build_lut(&tmp);    // effort_q16 / lut derived from the measured points
+    *c = tmp;
+    return ESP_OK;
+}
+
+esp_err_t motor_char_erase(const char* key) {
+    if (!key) return ESP_ERR_INVALID_ARG;
+    nvs_handle_t h;
+    esp_err_t err = nvs_open(MOTOR_CHAR_NVS_NS, NVS_READWRITE, &h);
+    if (err != ESP_OK) return err;
+    err = nvs_erase_key(h, key);
+    if (err == ESP_ERR_NVS_NOT_FOUND) err = ESP_OK;
+    if (err == ESP_OK) err = nvs_commit(h);
+    nvs_close(h);
+    return err;
+}
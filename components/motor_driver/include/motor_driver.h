@@ -1,29 +1,143 @@
 #ifndef __MOTOR_DRIVER_H__
 #define __MOTOR_DRIVER_H__
 
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include "esp_err.h"
 #include "driver/gpio.h"
 
+// Số motor tối đa = số kênh LEDC của ESP32-C3
+#define MOTOR_DRIVER_MAX            6
+#define MOTOR_DRIVER_DEFAULT_FREQ   20000   // trên ngưỡng nghe
+#define MOTOR_PWM_CLK_HZ            80000000 // APB, clock của timer LEDC
+#define MOTOR_PWM_RES_MAX           14      // bit duty tối đa của LEDC trên C3
+
+// Duty chuẩn hóa Q15: 0 = 0%, MOTOR_DUTY_FULL = 100%, không phụ thuộc độ phân giải PWM
+#define MOTOR_DUTY_FULL             0x8000u
+#define MOTOR_DUTY_Q15(num, den)    ((uint32_t)(((uint64_t)(num) * MOTOR_DUTY_FULL) / (den)))
+
+typedef struct motor_dev *motor_handle_t;
+
+// Trạng thái cầu H (chân IN1 / IN2 của L298N)
+typedef enum
+{
+    MOTOR_MODE_COAST = 0,   // 00 + EN = 0: thả trôi (00 khi EN còn PWM là hãm nhanh)
+    MOTOR_MODE_FORWARD,     // 10
+    MOTOR_MODE_REVERSE,     // 01
+    MOTOR_MODE_BRAKE,       // 11: hãm chủ động, duty = lực hãm
+} motor_mode_t;
+
+typedef struct
+{
+    motor_mode_t mode;
+    uint32_t     duty;      // Q15, 0..MOTOR_DUTY_FULL
+} motor_cmd_t;
+
+// Kết quả motor_apply_benchmark (chu kỳ CPU, gồm cả ngắt xảy ra trong lúc đo)
+typedef struct
+{
+    uint32_t iterations;
+    uint32_t min_cycles;        // đường thường: cùng chế độ, đổi duty
+    uint32_t avg_cycles;
+    uint32_t max_cycles;
+    uint32_t max_us;
+    uint32_t switch_max_cycles; // đổi chế độ FORWARD <-> REVERSE (gồm dead time)
+    uint32_t switch_max_us;
+} motor_bench_t;
+
 typedef struct
 {
     gpio_num_t pwm_pin;
     gpio_num_t forward_pin;
     gpio_num_t backward_pin;
+    uint32_t   pwm_freq_hz;     // 0 = MOTOR_DRIVER_DEFAULT_FREQ; cùng tần số thì dùng chung timer
+    uint8_t    pwm_resolution;  // bit duty, 0 = cao nhất cho tần số (motor_pwm_max_resolution)
+    uint32_t   dead_time_us;    // thả trôi tối thiểu khi rời chế độ đang lái cầu (đổi chiều, hãm)
 
 } motor_config_t;
 
+// Một phần tử của motor_apply_batch
+typedef struct
+{
+    motor_handle_t motor;
+    motor_cmd_t    cmd;
+} motor_update_t;
+
 #ifdef __cplusplus
 extern "C"
 {
 #endif
 
-    esp_err_t motor_driver_init(motor_config_t *config);
-    esp_err_t motor_set_direction(bool forward);
-    esp_err_t motor_set_speed(uint32_t speed);
-    esp_err_t motor_stop(void);
+    /**
+     * @brief Cấp 1 kênh LEDC (và timer theo tần số) + 2 chân hướng cho 1 motor
+     * @note  Các hàm lái motor (apply / ramp / set_* / stop / brake / batch) giữ khóa
+     *        của handle, gọi được từ nhiều task. Không gọi từ ISR (dùng motor_trip_isr).
+     * @return ESP_ERR_NOT_FOUND khi hết kênh / timer
+     */
+    esp_err_t motor_driver_init(const motor_config_t *config, motor_handle_t *out);
+    esp_err_t motor_driver_deinit(motor_handle_t motor);
+
+    /**
+     * @brief Độ phân giải duty cao nhất (bit) mà clock LEDC cho phép ở freq_hz:
+     *        80 MHz / freq >= 2^bit, tối đa MOTOR_PWM_RES_MAX. Ví dụ 20 kHz -> 11 bit,
+     *        5 kHz -> 13 bit. Trả 0 nếu tần số quá cao (< 1 bit).
+     */
+    uint8_t motor_pwm_max_resolution(uint32_t freq_hz);
+
+    /**
+     * @brief Đổi tần số / độ phân giải lúc chạy. Timer dùng chung nên mọi motor cùng
+     *        timer đổi theo; duty chuẩn hóa của từng motor được giữ nguyên.
+     * @param resolution 0 = motor_pwm_max_resolution(freq_hz)
+     */
+    esp_err_t motor_set_pwm(motor_handle_t motor, uint32_t freq_hz, uint8_t resolution);
+    esp_err_t motor_get_pwm(motor_handle_t motor, uint32_t *freq_hz, uint8_t *resolution);
+
+    /**
+     * @brief Áp chế độ cầu H + duty trong 1 lệnh. Chân IN ghi thẳng thanh ghi
+     *        GPIO_OUT_W1TC rồi W1TS (xóa trước, set sau). Thả trôi: EN về 0 (ledc_stop)
+     *        rồi IN 00, duty chỉ được ghi nhớ. Đổi chế độ: EN = 0 + IN 00 -> chờ
+     *        max(dead time, 1 chu kỳ PWM để EN = 0 đã chốt) -> chân chế độ mới -> duty
+     *        mới, nên không bao giờ lái chiều mới bằng duty cũ, cũng không hãm trong
+     *        dead time. Cùng chế độ: chỉ ghi duty, không chờ.
+     */
+    esp_err_t motor_apply(motor_handle_t motor, const motor_cmd_t *cmd);
+
+    // duty / speed / strength: Q15, 0..MOTOR_DUTY_FULL (đều đi qua motor_apply)
+    esp_err_t motor_set_direction(motor_handle_t motor, bool forward);
+    esp_err_t motor_set_speed(motor_handle_t motor, uint32_t duty);
+    esp_err_t motor_stop(motor_handle_t motor);                 // thả trôi
+    esp_err_t motor_brake(motor_handle_t motor, uint32_t strength);
+    esp_err_t motor_ramp_to(motor_handle_t motor, uint32_t duty, uint32_t time_ms);
+    esp_err_t motor_ramp_down(motor_handle_t motor, uint32_t time_ms);
+
+    /**
+     * @brief Ngắt bảo vệ, gọi được từ ISR (vd. quá dòng trong callback ADC): thả trôi
+     *        cầu H ngay bằng 1 lần ghi GPIO_OUT_W1TC và tắt đầu ra EN của kênh LEDC.
+     *        Sau đó motor_apply chỉ cho thả trôi (trả ESP_ERR_INVALID_STATE) tới khi
+     *        motor_clear_trip.
+     */
+    void      motor_trip_isr(motor_handle_t motor);
+    bool      motor_is_tripped(motor_handle_t motor);
+    esp_err_t motor_clear_trip(motor_handle_t motor);
+
+    /**
+     * @brief motor_apply cho nhiều motor một lần: motor thả trôi / đổi chế độ tắt EN
+     *        trước, chân IN của mọi motor đổi trong cùng 1 cặp ghi W1TC / W1TS, rồi
+     *        ghi duty của mọi kênh và bật cờ update liên tiếp trong critical section,
+     *        nên các kênh dùng chung timer (cùng tần số) chốt duty mới ở cùng một đầu
+     *        chu kỳ PWM.
+     */
+    esp_err_t motor_apply_batch(const motor_update_t *updates, size_t n);
+
+    /**
+     * @brief Đo thời gian motor_apply (duty 0, motor không chạy): đường cùng chế độ
+     *        và đường đổi chiều. Dùng lúc khởi động, trước khi nhận lệnh.
+     */
+    esp_err_t motor_apply_benchmark(motor_handle_t motor, uint32_t iterations, motor_bench_t *out);
 
 #ifdef __cplusplus
 }
 #endif
 
-#endif // __MOTOR_DRIVER_H__
\ No newline at end of file
+#endif // __MOTOR_DRIVER_H__
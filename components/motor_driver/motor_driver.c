@@ -1,36 +1,233 @@
 #include <stdio.h>
+#include <string.h>
 
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
 #include "driver/ledc.h"
 #include "esp_err.h"
 #include "esp_log.h"
+#include "esp_attr.h"
+#include "esp_cpu.h"
+#include "esp_rom_sys.h"
+#include "soc/soc.h"
+#include "soc/gpio_reg.h"
+#include "hal/ledc_ll.h"
 
 #include "motor_driver.h"
 
 #define TAG "motor_driver"
 
-static motor_config_t motor = {0};
+#define MOTOR_LEDC_MODE     LEDC_LOW_SPEED_MODE
 
-esp_err_t motor_driver_init(motor_config_t *config)
+struct motor_dev {
+    bool           used;
+    ledc_channel_t channel;
+    uint8_t        timer;       // chỉ số trong s_timers
+    gpio_num_t     pwm_pin;
+    gpio_num_t     forward_pin;
+    gpio_num_t     backward_pin;
+    uint32_t       fwd_mask;    // bit của chân trong GPIO_OUT (C3: GPIO 0..21)
+    uint32_t       bwd_mask;
+    uint32_t       dead_time_us;
+    motor_mode_t   mode;
+    uint32_t       duty_q15;    // duty chuẩn hóa đang áp / đang fade tới
+
+    // Đang có fade phần cứng: ledc_set_duty sẽ chờ fade xong, nên phải dừng fade trước
+    volatile bool  fading;
+    // EN đang xuất PWM (false sau ledc_stop: chân EN giữ mức 0)
+    volatile bool  en_on;
+    // Ngắt bảo vệ (motor_trip_isr): cầu bị thả trôi tới khi motor_clear_trip
+    volatile bool  tripped;
+
+    // Khóa đệ quy cho mọi hàm lái motor (apply / ramp gọi lồng nhau), để nhiều task
+    // (dispatch CAN, esp_timer watchdog, ...) cùng lái một motor không xen ngang nhau
+    SemaphoreHandle_t lock;
+    StaticSemaphore_t lock_buf;
+};
+
+// Timer LEDC dùng chung giữa các motor cùng tần số
+typedef struct {
+    uint32_t freq_hz;
+    uint8_t  bits;
+    uint8_t  users;
+} motor_timer_t;
+
+static struct motor_dev s_motors[MOTOR_DRIVER_MAX];
+static motor_timer_t    s_timers[LEDC_TIMER_MAX];
+static bool             s_fade_installed = false;
+static portMUX_TYPE     s_batch_mux      = portMUX_INITIALIZER_UNLOCKED;
+static portMUX_TYPE     s_pin_mux        = portMUX_INITIALIZER_UNLOCKED;
+
+// Q15 -> số đếm LEDC theo độ phân giải timer của motor (100% = 2^bits)
+static uint32_t duty_counts(const struct motor_dev *m, uint32_t q15)
 {
-    esp_err_t ret = ESP_OK;
+    if (q15 > MOTOR_DUTY_FULL) {
+        q15 = MOTOR_DUTY_FULL;
+    }
+    return (uint32_t)(((uint64_t)q15 << s_timers[m->timer].bits) >> 15);
+}
+
+static inline void motor_lock(struct motor_dev *m)
+{
+    xSemaphoreTakeRecursive(m->lock, portMAX_DELAY);
+}
+
+static inline void motor_unlock(struct motor_dev *m)
+{
+    xSemaphoreGiveRecursive(m->lock);
+}
+
+static void fade_cancel(struct motor_dev *m)
+{
+    if (m->fading) {
+        ledc_fade_stop(MOTOR_LEDC_MODE, m->channel);
+        m->fading = false;
+    }
+}
+
+// Tắt EN ngay (ledc_stop, mức nghỉ 0). L298N chỉ thả trôi khi EN = 0: IN1 = IN2 = 0
+// trong lúc EN còn PWM là hãm nhanh. Lần ledc_update_duty sau bật lại đầu ra.
+static void en_off(struct motor_dev *m)
+{
+    fade_cancel(m);
+    if (m->en_on) {
+        ledc_stop(MOTOR_LEDC_MODE, m->channel, 0);
+        m->en_on = false;
+    }
+}
+
+static void en_set(struct motor_dev *m, uint32_t q15)
+{
+    ledc_set_duty(MOTOR_LEDC_MODE, m->channel, duty_counts(m, q15));
+    ledc_update_duty(MOTOR_LEDC_MODE, m->channel);
+    m->en_on = true;
+}
+
+// Chân IN của cầu H cho từng chế độ (L298N: 10 / 01 chạy, 11 hãm, 00 + EN = 0 thả trôi)
+static void mode_masks(const struct motor_dev *m, motor_mode_t mode, uint32_t *set, uint32_t *clr)
+{
+    switch (mode) {
+    case MOTOR_MODE_FORWARD: *set = m->fwd_mask;               *clr = m->bwd_mask;               break;
+    case MOTOR_MODE_REVERSE: *set = m->bwd_mask;               *clr = m->fwd_mask;               break;
+    case MOTOR_MODE_BRAKE:   *set = m->fwd_mask | m->bwd_mask; *clr = 0;                         break;
+    default:                 *set = 0;                         *clr = m->fwd_mask | m->bwd_mask; break;
+    }
+}
+
+// Xóa trước rồi mới set: trạng thái trung gian luôn tiến về thả trôi, không bao giờ
+// đi qua chiều ngược lại. Mỗi lệnh chỉ là 2 lần ghi thanh ghi GPIO_OUT_W1TC / W1TS.
+static inline void pins_write(uint32_t clr, uint32_t set)
+{
+    REG_WRITE(GPIO_OUT_W1TC_REG, clr);
+    REG_WRITE(GPIO_OUT_W1TS_REG, set);
+}
 
+uint8_t motor_pwm_max_resolution(uint32_t freq_hz)
+{
+    if (freq_hz == 0) {
+        return 0;
+    }
+    uint32_t ratio = MOTOR_PWM_CLK_HZ / freq_hz;
+    uint8_t  bits  = 0;
+    while (bits < MOTOR_PWM_RES_MAX && (ratio >> (bits + 1)) != 0) {
+        bits++;
+    }
+    return bits;
+}
+
+static esp_err_t timer_config(int idx, uint32_t freq_hz, uint8_t bits)
+{
     ledc_timer_config_t ledc_timer = {
-        .speed_mode       = LEDC_LOW_SPEED_MODE,
-        .timer_num        = LEDC_TIMER_0,
-        .duty_resolution  = LEDC_TIMER_10_BIT,
-        .freq_hz          = 5000,
-        .clk_cfg          = LEDC_AUTO_CLK
+        .speed_mode       = MOTOR_LEDC_MODE,
+        .timer_num        = (ledc_timer_t)idx,
+        .duty_resolution  = (ledc_timer_bit_t)bits,
+        .freq_hz          = freq_hz,
+        .clk_cfg          = LEDC_USE_APB_CLK
     };
-    ret = ledc_timer_config(&ledc_timer);
+    esp_err_t ret = ledc_timer_config(&ledc_timer);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "ledc_timer_config failed (%u Hz, %u bit)", (unsigned)freq_hz, bits);
+    }
+    return ret;
+}
+
+// Timer đang chạy đúng tần số + độ phân giải, hoặc timer trống đầu tiên
+static esp_err_t timer_acquire(uint32_t freq_hz, uint8_t bits, uint8_t *out)
+{
+    int free_idx = -1;
+    for (int i = 0; i < LEDC_TIMER_MAX; i++) {
+        if (s_timers[i].users && s_timers[i].freq_hz == freq_hz && s_timers[i].bits == bits) {
+            s_timers[i].users++;
+            *out = (uint8_t)i;
+            return ESP_OK;
+        }
+        if (!s_timers[i].users && free_idx < 0) {
+            free_idx = i;
+        }
+    }
+    if (free_idx < 0) {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    esp_err_t ret = timer_config(free_idx, freq_hz, bits);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+    s_timers[free_idx].freq_hz = freq_hz;
+    s_timers[free_idx].bits    = bits;
+    s_timers[free_idx].users   = 1;
+    *out = (uint8_t)free_idx;
+    return ESP_OK;
+}
+
+static void timer_release(uint8_t idx)
+{
+    if (s_timers[idx].users && --s_timers[idx].users == 0) {
+        ledc_timer_pause(MOTOR_LEDC_MODE, (ledc_timer_t)idx);
+    }
+}
+
+esp_err_t motor_driver_init(const motor_config_t *config, motor_handle_t *out)
+{
+    if (!config || !out) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    // Chân hướng ghi qua GPIO_OUT_W1TS/W1TC (32 bit thấp)
+    if (config->forward_pin < 0 || config->forward_pin >= 32 ||
+        config->backward_pin < 0 || config->backward_pin >= 32) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    struct motor_dev *m = NULL;
+    for (int i = 0; i < MOTOR_DRIVER_MAX; i++) {
+        if (!s_motors[i].used) {
+            m = &s_motors[i];
+            m->channel = (ledc_channel_t)i;
+            break;
+        }
+    }
+    if (!m) {
+        ESP_LOGE(TAG, "no free LEDC channel");
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    uint32_t freq = config->pwm_freq_hz ? config->pwm_freq_hz : MOTOR_DRIVER_DEFAULT_FREQ;
+    uint8_t  max  = motor_pwm_max_resolution(freq);
+    uint8_t  bits = config->pwm_resolution ? config->pwm_resolution : max;
+    if (bits == 0 || bits > max) {
+        ESP_LOGE(TAG, "%u bit PWM not possible at %u Hz (max %u)", bits, (unsigned)freq, max);
+        return ESP_ERR_INVALID_ARG;
+    }
+    esp_err_t ret = timer_acquire(freq, bits, &m->timer);
     if (ret != ESP_OK) {
-        ESP_LOGE(TAG, "ledc_timer_config failed");
+        ESP_LOGE(TAG, "no LEDC timer for %u Hz", (unsigned)freq);
         return ret;
     }
 
     ledc_channel_config_t ledc_channel = {
-        .speed_mode     = LEDC_LOW_SPEED_MODE,
-        .channel        = LEDC_CHANNEL_0,
-        .timer_sel      = LEDC_TIMER_0,
+        .speed_mode     = MOTOR_LEDC_MODE,
+        .channel        = m->channel,
+        .timer_sel      = (ledc_timer_t)m->timer,
         .intr_type      = LEDC_INTR_DISABLE,
         .gpio_num       = config->pwm_pin,
         .duty           = 0,  // Set duty to 0%
@@ -39,48 +236,451 @@ esp_err_t motor_driver_init(motor_config_t *config)
     ret = ledc_channel_config(&ledc_channel);
     if (ret != ESP_OK) {
         ESP_LOGE(TAG, "ledc_channel_config failed");
+        timer_release(m->timer);
         return ret;
     }
-    motor.pwm_pin = config->pwm_pin;
-    motor.forward_pin = config->forward_pin;
-    motor.backward_pin = config->backward_pin;
+
+    // Fade phần cứng cho motor_ramp_to / motor_ramp_down, cài 1 lần cho mọi kênh
+    if (!s_fade_installed) {
+        ret = ledc_fade_func_install(0);
+        if (ret != ESP_OK && ret != ESP_ERR_INVALID_STATE) {
+            ESP_LOGE(TAG, "ledc_fade_func_install failed");
+            timer_release(m->timer);
+            return ret;
+        }
+        s_fade_installed = true;
+    }
+
+    m->pwm_pin      = config->pwm_pin;
+    m->forward_pin  = config->forward_pin;
+    m->backward_pin = config->backward_pin;
+    m->fwd_mask     = 1u << config->forward_pin;
+    m->bwd_mask     = 1u << config->backward_pin;
+    m->dead_time_us = config->dead_time_us;
+    m->mode         = MOTOR_MODE_COAST;
+    m->fading       = false;
+    m->en_on        = false;
+    m->tripped      = false;
+    m->duty_q15     = 0;
+    if (!m->lock) {
+        m->lock = xSemaphoreCreateRecursiveMutexStatic(&m->lock_buf);
+    }
 
     // Configure GPIO pins for direction control
     gpio_config_t io_conf = {
         .intr_type = GPIO_INTR_DISABLE,
         .mode = GPIO_MODE_OUTPUT,
-        .pin_bit_mask = (1ULL << motor.forward_pin) | (1ULL << motor.backward_pin),
+        .pin_bit_mask = (1ULL << m->forward_pin) | (1ULL << m->backward_pin),
         .pull_down_en = GPIO_PULLDOWN_DISABLE,
         .pull_up_en = GPIO_PULLUP_DISABLE
     };
     ret = gpio_config(&io_conf);
     if (ret != ESP_OK) {
         ESP_LOGE(TAG, "gpio_config failed");
+        ledc_stop(MOTOR_LEDC_MODE, m->channel, 0);
+        timer_release(m->timer);
         return ret;
     }
+    pins_write(m->fwd_mask | m->bwd_mask, 0);
 
+    m->used = true;
+    *out = m;
+    ESP_LOGI(TAG, "motor on channel %d, timer %d (%u Hz, %u bit)",
+             (int)m->channel, m->timer, (unsigned)freq, bits);
     return ESP_OK;
 }
 
-esp_err_t motor_set_direction(bool forward) {
-    gpio_set_level(motor.forward_pin, forward ? 1 : 0);
-    gpio_set_level(motor.backward_pin, forward ? 0 : 1);
+esp_err_t motor_driver_deinit(motor_handle_t m)
+{
+    if (!m || !m->used) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    motor_stop(m);
+    ledc_stop(MOTOR_LEDC_MODE, m->channel, 0);
+    timer_release(m->timer);
+    m->used = false;
     return ESP_OK;
 }
 
-// Set motor speed (0-1023)
-esp_err_t motor_set_speed(uint32_t duty) {
-    ledc_set_duty(LEDC_LOW_SPEED_MODE, LEDC_CHANNEL_0, duty);
-    ledc_update_duty(LEDC_LOW_SPEED_MODE, LEDC_CHANNEL_0);
+esp_err_t motor_set_pwm(motor_handle_t m, uint32_t freq_hz, uint8_t resolution)
+{
+    if (!m || !m->used) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    uint8_t max  = motor_pwm_max_resolution(freq_hz);
+    uint8_t bits = resolution ? resolution : max;
+    if (bits == 0 || bits > max) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    // Khóa mọi motor dùng chung timer, theo thứ tự chỉ số (như motor_apply_batch)
+    uint8_t t = m->timer;
+    for (int i = 0; i < MOTOR_DRIVER_MAX; i++) {
+        if (s_motors[i].used && s_motors[i].timer == t) {
+            motor_lock(&s_motors[i]);
+            fade_cancel(&s_motors[i]);
+        }
+    }
+    esp_err_t ret = timer_config(t, freq_hz, bits);
+    if (ret == ESP_OK) {
+        s_timers[t].freq_hz = freq_hz;
+        s_timers[t].bits    = bits;
+    }
+
+    // Số đếm duty đổi theo độ phân giải mới, tỉ lệ duty giữ nguyên
+    for (int i = 0; i < MOTOR_DRIVER_MAX; i++) {
+        struct motor_dev *o = &s_motors[i];
+        if (o->used && o->timer == t) {
+            if (ret == ESP_OK && o->en_on) {
+                ledc_set_duty(MOTOR_LEDC_MODE, o->channel, duty_counts(o, o->duty_q15));
+                ledc_update_duty(MOTOR_LEDC_MODE, o->channel);
+            }
+            motor_unlock(o);
+        }
+    }
+    if (ret != ESP_OK) {
+        return ret;
+    }
+    ESP_LOGI(TAG, "timer %u: %u Hz, %u bit", t, (unsigned)freq_hz, bits);
     return ESP_OK;
 }
 
-esp_err_t motor_stop(void)
+esp_err_t motor_get_pwm(motor_handle_t m, uint32_t *freq_hz, uint8_t *resolution)
 {
-    // Set duty cycle to 0 to stop the motor
-    gpio_set_level(motor.forward_pin, 0);
-    gpio_set_level(motor.backward_pin, 0);
-    ledc_set_duty(LEDC_LOW_SPEED_MODE, LEDC_CHANNEL_0, 0);
-    ledc_update_duty(LEDC_LOW_SPEED_MODE, LEDC_CHANNEL_0);
+    if (!m || !m->used) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (freq_hz) {
+        *freq_hz = s_timers[m->timer].freq_hz;
+    }
+    if (resolution) {
+        *resolution = s_timers[m->timer].bits;
+    }
     return ESP_OK;
-}
\ No newline at end of file
+}
+
+// Thời gian chờ trước khi bật chân chế độ mới: đủ dead time khi rời một chế độ đang
+// lái cầu, và đủ 1 chu kỳ PWM khi EN vừa bị tắt (ledc_stop chốt ở chu kỳ kế tiếp)
+static uint32_t switch_wait_us(const struct motor_dev *m, motor_mode_t from, bool en_was_on)
+{
+    uint32_t wait = (from != MOTOR_MODE_COAST) ? m->dead_time_us : 0;
+    if (en_was_on) {
+        uint32_t f      = s_timers[m->timer].freq_hz;
+        uint32_t period = (1000000u + f - 1) / f;
+        if (period > wait) {
+            wait = period;
+        }
+    }
+    return wait;
+}
+
+esp_err_t motor_apply(motor_handle_t m, const motor_cmd_t *cmd)
+{
+    if (!m || !cmd || cmd->mode > MOTOR_MODE_BRAKE) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    uint32_t duty = cmd->duty > MOTOR_DUTY_FULL ? MOTOR_DUTY_FULL : cmd->duty;
+    motor_mode_t mode = cmd->mode;
+    esp_err_t ret = ESP_OK;
+    motor_lock(m);
+    if (m->tripped && mode != MOTOR_MODE_COAST) {
+        // Đang bị ngắt bảo vệ: chỉ cho thả trôi, vẫn ghi duty để tiếp tục từ đó khi xóa
+        mode = MOTOR_MODE_COAST;
+        ret  = ESP_ERR_INVALID_STATE;
+    }
+    bool duty_changed = m->fading || duty != m->duty_q15 || !m->en_on;
+
+    uint32_t set, clr;
+    mode_masks(m, mode, &set, &clr);
+
+    if (mode == MOTOR_MODE_COAST) {
+        // Thả trôi: tắt EN trước rồi mới thả chân IN; duty chỉ được ghi nhớ
+        en_off(m);
+        if (m->mode != MOTOR_MODE_COAST) {
+            pins_write(clr, set);
+        }
+    } else if (mode == m->mode) {
+        // Cùng chế độ: chỉ đổi duty
+        if (duty_changed) {
+            fade_cancel(m);
+            en_set(m, duty);
+        }
+    } else {
+        // Đổi chế độ: EN = 0 + IN 00 -> chờ -> chân chế độ mới -> duty mới
+        uint32_t wait = switch_wait_us(m, m->mode, m->en_on);
+        en_off(m);
+        pins_write(m->fwd_mask | m->bwd_mask, 0);
+        if (wait) {
+            esp_rom_delay_us(wait);
+        }
+        // motor_trip_isr có thể chạy giữa lúc kiểm tra tripped ở trên và lúc này
+        portENTER_CRITICAL(&s_pin_mux);
+        if (!m->tripped) {
+            pins_write(clr, set);
+            en_set(m, duty);
+        } else {
+            mode = MOTOR_MODE_COAST;
+            ret  = ESP_ERR_INVALID_STATE;
+        }
+        portEXIT_CRITICAL(&s_pin_mux);
+    }
+    m->mode     = mode;
+    m->duty_q15 = duty;
+    motor_unlock(m);
+    return ret;
+}
+
+// Gọi được từ ISR (callback ADC): ngắt chân IN bằng 1 lần ghi W1TC, rồi tắt EN qua
+// thanh ghi LEDC (ledc_stop không gọi được từ ISR). IN 00 khi EN còn PWM là hãm,
+// chưa phải thả trôi.
+void IRAM_ATTR motor_trip_isr(motor_handle_t m)
+{
+    REG_WRITE(GPIO_OUT_W1TC_REG, m->fwd_mask | m->bwd_mask);
+    ledc_ll_set_idle_level(LEDC_LL_GET_HW(), MOTOR_LEDC_MODE, m->channel, 0);
+    ledc_ll_set_sig_out_en(LEDC_LL_GET_HW(), MOTOR_LEDC_MODE, m->channel, false);
+    ledc_ll_ls_channel_update(LEDC_LL_GET_HW(), MOTOR_LEDC_MODE, m->channel);
+    m->tripped = true;
+    m->en_on   = false;
+    m->mode    = MOTOR_MODE_COAST;
+}
+
+bool motor_is_tripped(motor_handle_t m)
+{
+    return m && m->tripped;
+}
+
+esp_err_t motor_clear_trip(motor_handle_t m)
+{
+    if (!m) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    m->tripped = false;
+    return ESP_OK;
+}
+
+esp_err_t motor_set_direction(motor_handle_t m, bool forward) {
+    if (!m) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    motor_lock(m);
+    motor_cmd_t cmd = {
+        .mode = forward ? MOTOR_MODE_FORWARD : MOTOR_MODE_REVERSE,
+        .duty = m->duty_q15,
+    };
+    esp_err_t ret = motor_apply(m, &cmd);
+    motor_unlock(m);
+    return ret;
+}
+
+// Set motor speed (Q15, 0..MOTOR_DUTY_FULL)
+esp_err_t motor_set_speed(motor_handle_t m, uint32_t duty) {
+    if (!m) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    motor_lock(m);
+    motor_cmd_t cmd = { .mode = m->mode, .duty = duty };
+    esp_err_t ret = motor_apply(m, &cmd);
+    motor_unlock(m);
+    return ret;
+}
+
+esp_err_t motor_stop(motor_handle_t m)
+{
+    if (!m) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    // Thả trôi (cả 2 chân IN = 0), duty về 0
+    motor_cmd_t cmd = { .mode = MOTOR_MODE_COAST, .duty = 0 };
+    return motor_apply(m, &cmd);
+}
+
+esp_err_t motor_brake(motor_handle_t m, uint32_t strength)
+{
+    motor_cmd_t cmd = { .mode = MOTOR_MODE_BRAKE, .duty = strength };
+    return motor_apply(m, &cmd);
+}
+
+// Đưa duty tới target (Q15) bằng fade phần cứng của LEDC trong time_ms:
+// LEDC tự bước duty theo chu kỳ PWM, không tốn CPU hay frame CAN.
+// Chỉ đổi độ lớn duty, chế độ cầu H do motor_apply quyết định.
+esp_err_t motor_ramp_to(motor_handle_t m, uint32_t duty, uint32_t time_ms)
+{
+    if (!m) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (duty > MOTOR_DUTY_FULL) {
+        duty = MOTOR_DUTY_FULL;
+    }
+    motor_lock(m);
+    if (m->tripped) {
+        motor_unlock(m);
+        return ESP_ERR_INVALID_STATE;
+    }
+    fade_cancel(m);
+    uint32_t cur    = ledc_get_duty(MOTOR_LEDC_MODE, m->channel);
+    uint32_t target = duty_counts(m, duty);
+    esp_err_t ret;
+    // Thả trôi: EN phải giữ 0, chỉ ghi nhớ duty (motor_set_speed)
+    if (time_ms == 0 || cur == target || m->mode == MOTOR_MODE_COAST || !m->en_on) {
+        ret = motor_set_speed(m, duty);
+        motor_unlock(m);
+        return ret;
+    }
+
+    m->duty_q15 = duty;
+    ret = ledc_set_fade_with_time(MOTOR_LEDC_MODE, m->channel, target, (int)time_ms);
+    if (ret == ESP_OK) {
+        ret = ledc_fade_start(MOTOR_LEDC_MODE, m->channel, LEDC_FADE_NO_WAIT);
+    }
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "ledc fade failed, setting duty directly");
+        ret = motor_set_speed(m, duty);
+    } else {
+        m->fading = true;
+    }
+    motor_unlock(m);
+    return ret;
+}
+
+// Giảm duty về 0 bằng fade trong time_ms; chân hướng giữ nguyên để motor hãm dần
+esp_err_t motor_ramp_down(motor_handle_t m, uint32_t time_ms)
+{
+    if (!m) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    motor_lock(m);
+    esp_err_t ret = ledc_get_duty(MOTOR_LEDC_MODE, m->channel) == 0 ? motor_stop(m)
+                                                                     : motor_ramp_to(m, 0, time_ms);
+    motor_unlock(m);
+    return ret;
+}
+
+esp_err_t motor_apply_batch(const motor_update_t *u, size_t n)
+{
+    if (!u || n > MOTOR_DRIVER_MAX) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    for (size_t i = 0; i < n; i++) {
+        if (!u[i].motor || !u[i].motor->used || u[i].cmd.mode > MOTOR_MODE_BRAKE) {
+            return ESP_ERR_INVALID_ARG;
+        }
+    }
+
+    // Khóa theo thứ tự chỉ số motor (không theo thứ tự trong u[]) để 2 batch không khóa chéo
+    for (int j = 0; j < MOTOR_DRIVER_MAX; j++) {
+        for (size_t i = 0; i < n; i++) {
+            if (u[i].motor == &s_motors[j]) {
+                motor_lock(&s_motors[j]);
+                break;
+            }
+        }
+    }
+
+    // 1. Motor thả trôi / đổi chế độ: tắt EN, rồi thả chân IN (1 lần ghi cho mọi motor),
+    //    tính thời gian chờ
+    uint32_t pre_clr = 0, clr = 0, set = 0, wait = 0;
+    for (size_t i = 0; i < n; i++) {
+        struct motor_dev *m = u[i].motor;
+        motor_mode_t mode = m->tripped ? MOTOR_MODE_COAST : u[i].cmd.mode;
+        uint32_t s, c;
+        mode_masks(m, mode, &s, &c);
+        set |= s;
+        clr |= c;
+        if (mode == MOTOR_MODE_COAST || mode != m->mode) {
+            if (mode != MOTOR_MODE_COAST) {
+                uint32_t w = switch_wait_us(m, m->mode, m->en_on);
+                wait = w > wait ? w : wait;
+            }
+            en_off(m);
+            pre_clr |= m->fwd_mask | m->bwd_mask;
+        }
+    }
+    if (pre_clr) {
+        pins_write(pre_clr, 0);
+    }
+
+    // 2. Chân IN của mọi motor trong 1 cặp ghi W1TC / W1TS
+    if (wait) {
+        esp_rom_delay_us(wait);
+    }
+    portENTER_CRITICAL(&s_pin_mux);
+    for (size_t i = 0; i < n; i++) {
+        if (u[i].motor->tripped) {
+            set &= ~(u[i].motor->fwd_mask | u[i].motor->bwd_mask);
+        }
+    }
+    pins_write(clr, set);
+    portEXIT_CRITICAL(&s_pin_mux);
+
+    // 3. Ghi duty vào thanh ghi (chưa có hiệu lực tới khi bật cờ update), rồi bật cờ
+    //    update của mọi kênh liền nhau: các kênh cùng timer chốt duty ở cùng lần tràn
+    //    bộ đếm kế tiếp. Motor thả trôi giữ EN = 0.
+    for (size_t i = 0; i < n; i++) {
+        struct motor_dev *m = u[i].motor;
+        m->duty_q15 = u[i].cmd.duty > MOTOR_DUTY_FULL ? MOTOR_DUTY_FULL : u[i].cmd.duty;
+        m->mode     = m->tripped ? MOTOR_MODE_COAST : u[i].cmd.mode;
+        if (m->mode != MOTOR_MODE_COAST) {
+            fade_cancel(m);
+            ledc_set_duty(MOTOR_LEDC_MODE, m->channel, duty_counts(m, m->duty_q15));
+        }
+    }
+    portENTER_CRITICAL(&s_batch_mux);
+    for (size_t i = 0; i < n; i++) {
+        struct motor_dev *m = u[i].motor;
+        if (m->mode != MOTOR_MODE_COAST && !m->tripped) {
+            ledc_update_duty(MOTOR_LEDC_MODE, m->channel);
+            m->en_on = true;
+        }
+    }
+    portEXIT_CRITICAL(&s_batch_mux);
+
+    for (int j = 0; j < MOTOR_DRIVER_MAX; j++) {
+        for (size_t i = 0; i < n; i++) {
+            if (u[i].motor == &s_motors[j]) {
+                motor_unlock(&s_motors[j]);
+                break;
+            }
+        }
+    }
+    return ESP_OK;
+}
+
+esp_err_t motor_apply_benchmark(motor_handle_t m, uint32_t iterations, motor_bench_t *out)
+{
+    if (!m || !m->used || !out || iterations == 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    memset(out, 0, sizeof(*out));
+    out->min_cycles = UINT32_MAX;
+    uint64_t sum = 0;
+
+    // Duty 0 suốt benchmark: chân IN đổi nhưng cầu không cấp dòng, motor đứng yên.
+    // Đường thường: cùng chế độ, đổi duty (ghi LEDC, không đụng chân IN).
+    // Đường đổi chế độ: FORWARD <-> REVERSE, gồm thả trôi + dead time.
+    motor_cmd_t fwd = { .mode = MOTOR_MODE_FORWARD, .duty = 0 };
+    motor_cmd_t rev = { .mode = MOTOR_MODE_REVERSE, .duty = 0 };
+    // Mỗi vòng: đưa về FORWARD (không đo), đo FORWARD -> FORWARD, rồi đo FORWARD -> REVERSE
+    uint32_t per_us = esp_rom_get_cpu_ticks_per_us();
+    for (uint32_t i = 0; i < iterations; i++) {
+        motor_apply(m, &fwd);
+        m->duty_q15 = 1;    // ép đường ghi duty như khi duty thay đổi
+        uint32_t t0 = esp_cpu_get_cycle_count();
+        motor_apply(m, &fwd);
+        uint32_t c  = esp_cpu_get_cycle_count() - t0;
+        if (c < out->min_cycles) out->min_cycles = c;
+        if (c > out->max_cycles) out->max_cycles = c;
+        sum += c;
+
+        t0 = esp_cpu_get_cycle_count();
+        motor_apply(m, &rev);
+        c  = esp_cpu_get_cycle_count() - t0;
+        if (c > out->switch_max_cycles) out->switch_max_cycles = c;
+    }
+    motor_stop(m);
+
+    out->iterations    = iterations;
+    out->avg_cycles    = (uint32_t)(sum / iterations);
+    out->max_us        = (out->max_cycles + per_us - 1) / per_us;
+    out->switch_max_us = (out->switch_max_cycles + per_us - 1) / per_us;
+    return ESP_OK;
+}
@@ -0,0 +1,53 @@
+#pragma once
+#include "esp_err.h"
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Fixed-point PID for position loops. Gains are Q16 and already include the
+// loop period (ki per cycle, kd per cycle of measurement change); the update
+// path is integer-only.
+
+#define PID_Q16(x)          ((int32_t)((x) * 65536.0f))   // compile-time use only
+#define PID_GAIN_TABLE_MAX  4
+
+typedef struct pid_ctrl* pid_handle_t;
+
+// Gain set used while |error| <= err_max. Entries sorted by err_max;
+// the last entry applies to any larger error.
+typedef struct {
+    int32_t err_max;
+    int32_t kp_q16;
+    int32_t ki_q16;
+    int32_t kd_q16;
+} pid_gains_t;
+
+typedef struct {
+    const pid_gains_t* gains;
+    size_t   n_gains;          // 1..PID_GAIN_TABLE_MAX
+    int32_t  out_max;          // |output| limit, e.g. 1023
+    int32_t  min_duty;         // non-zero outputs are mapped to [min_duty, out_max], 0 = off
+    int32_t  integ_limit;      // |integral term| limit in output units
+    int32_t  slew_max;         // max effort change per cycle, 0 = off
+    int32_t  deadband;         // |error| <= deadband -> output 0
+} pid_config_t;
+
+esp_err_t pid_create(const pid_config_t* cfg, pid_handle_t* out);
+void      pid_delete(pid_handle_t h);
+// Clear integral/slew state; measurement seeds the derivative term.
+void      pid_reset(pid_handle_t h, int32_t measurement);
+// error = setpoint - measurement (caller supplies it so wrapped axes can use
+// a shortest-path error). Returns signed output in [-out_max, out_max].
+int32_t   pid_update(pid_handle_t h, int32_t error, int32_t measurement);
+// Same as pid_update, but the derivative term uses a measured rate instead of
+// differencing the measurement: rate_q8 = measurement change per cycle, Q8
+// (e.g. encoder velocity * loop period). Does not track the measurement, so
+// call pid_reset before switching back to pid_update.
+int32_t   pid_update_rate(pid_handle_t h, int32_t error, int32_t rate_q8);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,118 @@
+#include "pid_controller.h"
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct pid_ctrl {
+    pid_gains_t gains[PID_GAIN_TABLE_MAX];
+    size_t   n_gains;
+    int32_t  out_max;
+    int32_t  min_duty;
+    int32_t  deadband;
+    int32_t  slew_max;
+    int64_t  integ_limit_q16;
+    int32_t  min_scale_q16;    // (out_max - min_duty) / out_max
+    int64_t  integ_q16;
+    int32_t  prev_meas;
+    int32_t  prev_effort;
+};
+
+static inline int32_t _clamp(int64_t v, int32_t lim) {
+    if (v >  lim) return lim;
+    if (v < -lim) return -lim;
+    return (int32_t)v;
+}
+
+static inline const pid_gains_t* _select_gains(const struct pid_ctrl* p, int32_t abs_err) {
+    for (size_t i = 0; i + 1 < p->n_gains; i++) {
+        if (abs_err <= p->gains[i].err_max) return &p->gains[i];
+    }
+    return &p->gains[p->n_gains - 1];
+}
+
+esp_err_t pid_create(const pid_config_t* cfg, pid_handle_t* out) {
+    if (!cfg || !out || !cfg->gains) return ESP_ERR_INVALID_ARG;
+    if (cfg->n_gains == 0 || cfg->n_gains > PID_GAIN_TABLE_MAX) return ESP_ERR_INVALID_ARG;
+    if (cfg->out_max <= 0 || cfg->min_duty < 0 || cfg->min_duty >= cfg->out_max) return ESP_ERR_INVALID_ARG;
+
+    struct pid_ctrl* p = (struct pid_ctrl*)calloc(1, sizeof(*p));
+    if (!p) return ESP_ERR_NO_MEM;
+
+    memcpy(p->gains, cfg->gains, cfg->n_gains * sizeof(pid_gains_t));
+    p->n_gains   = cfg->n_gains;
+    p->out_max   = cfg->out_max;
+    p->min_duty  = cfg->min_duty;
+    p->deadband  = cfg->deadband;
+    p->slew_max  = cfg->slew_max;
+    p->integ_limit_q16 = (int64_t)cfg->integ_limit << 16;
+    p->min_scale_q16 = (int32_t)(((int64_t)(cfg->out_max - cfg->min_duty) << 16) / cfg->out_max);
+
+    *out = p;
+    return ESP_OK;
+}
+
+void pid_delete(pid_handle_t h) {
+    free(h);
+}
+
+void pid_reset(pid_handle_t h, int32_t measurement) {
+    if (!h) return;
+    h->integ_q16   = 0;
+    h->prev_meas   = measurement;
+    h->prev_effort = 0;
+}
+
+// d_meas_q8: measurement change over the last cycle, Q8
+static int32_t _update(struct pid_ctrl* h, int32_t error, int64_t d_meas_q8) {
+    int32_t abs_err = (error >= 0) ? error : -error;
+    if (abs_err <= h->deadband) {
+        // Hold the integral so a small steady load does not have to rebuild it.
+        h->prev_effort = 0;
+        return 0;
+    }
+
+    const pid_gains_t* g = _select_gains(h, abs_err);
+    int64_t p_q16 = (int64_t)g->kp_q16 * error;
+    int64_t d_q16 = -(((int64_t)g->kd_q16 * d_meas_q8) >> 8);   // derivative on measurement: no setpoint kick
+    int64_t limit_q16 = (int64_t)h->out_max << 16;
+
+    // Conditional integration: stop accumulating while the output is
+    // saturated in the direction the error pushes it.
+    int64_t i_next = h->integ_q16 + (int64_t)g->ki_q16 * error;
+    if (i_next >  h->integ_limit_q16) i_next =  h->integ_limit_q16;
+    if (i_next < -h->integ_limit_q16) i_next = -h->integ_limit_q16;
+    int64_t u_q16 = p_q16 + i_next + d_q16;
+    bool saturated = (u_q16 > limit_q16 && error > 0) || (u_q16 < -limit_q16 && error < 0);
+    if (!saturated) h->integ_q16 = i_next;
+    u_q16 = p_q16 + h->integ_q16 + d_q16;
+
+    int32_t effort = _clamp(u_q16 >> 16, h->out_max);
+
+    if (h->slew_max > 0) {
+        int32_t step = effort - h->prev_effort;
+        if (step >  h->slew_max) effort = h->prev_effort + h->slew_max;
+        if (step < -h->slew_max) effort = h->prev_effort - h->slew_max;
+    }
+    h->prev_effort = effort;
+
+    if (effort == 0 || h->min_duty == 0) return effort;
+
+    // Static-friction compensation: any non-zero effort starts at min_duty.
+    int32_t mag = (effort > 0) ? effort : -effort;
+    int32_t out = h->min_duty + (int32_t)(((int64_t)mag * h->min_scale_q16) >> 16);
+    if (out > h->out_max) out = h->out_max;
+    return (effort > 0) ? out : -out;
+}
+
+int32_t pid_update(pid_handle_t h, int32_t error, int32_t measurement) {
+    if (!h) return 0;
+
+    int32_t d_meas = measurement - h->prev_meas;
+    h->prev_meas = measurement;
+    return _update(h, error, (int64_t)d_meas << 8);
+}
+
+int32_t pid_update_rate(pid_handle_t h, int32_t error, int32_t rate_q8) {
+    if (!h) return 0;
+    return _update(h, error, rate_q8);
+}
@@ -54,7 +54,19 @@ esp_err_t app_driver_init(void)
     ESP_LOGI(TAG, "Both encoders initialized (desired + actual)");
 
     // ===== CAN (TWAI) =====
-    ESP_ERROR_CHECK(can_driver_init(MASTER_CAN_TX_PIN, MASTER_CAN_RX_PIN));
+    // Master chỉ nhận feedback + telemetry + dòng từ các slave trong bảng trục
+    static const uint8_t axis_nodes[MASTER_AXIS_COUNT] = MASTER_AXIS_NODES;
+    can_id_range_t can_accept[3 * MASTER_AXIS_COUNT];
+    for (size_t i = 0; i < MASTER_AXIS_COUNT; i++) {
+        can_accept[3 * i].first     = CAN_ID_NODE(CAN_ID_FEEDBACK, axis_nodes[i]);
+        can_accept[3 * i].last      = can_accept[3 * i].first;
+        can_accept[3 * i + 1].first = CAN_ID_NODE(CAN_ID_TELEMETRY, axis_nodes[i]);
+        can_accept[3 * i + 1].last  = can_accept[3 * i + 1].first;
+        can_accept[3 * i + 2].first = CAN_ID_NODE(CAN_ID_CURRENT, axis_nodes[i]);
+        can_accept[3 * i + 2].last  = can_accept[3 * i + 2].first;
+    }
+    ESP_ERROR_CHECK(can_driver_init(MASTER_CAN_TX_PIN, MASTER_CAN_RX_PIN,
+                                    can_accept, 3 * MASTER_AXIS_COUNT));
     ESP_LOGI(TAG, "CAN driver initialized on MASTER (TX=%d, RX=%d)",
              MASTER_CAN_TX_PIN, MASTER_CAN_RX_PIN);
 
@@ -95,6 +107,16 @@ uint16_t app_driver_encoder_get_desired(void)
     return (uint16_t)ky040_get_angle(s_enc_desired);
 }
 
+// Cạnh encoder mong muốn gần nhất (ISR ghi esp_timer_get_time())
+int64_t app_driver_encoder_get_desired_edge_us(void)
+{
+    ky040_snapshot_t snap;
+    if (!s_enc_desired || ky040_get_snapshot(s_enc_desired, &snap) != ESP_OK) {
+        return 0;
+    }
+    return snap.last_edge_us;
+}
+
 // Lấy giá trị encoder thực tế (gắn trục gương/motor)
 uint16_t app_driver_encoder_get_current(void)
 {
@@ -105,6 +127,44 @@ uint16_t app_driver_encoder_get_current(void)
     return (uint16_t)ky040_get_angle(s_enc_actual);
 }
 
+// Sai số góc theo đường ngắn nhất (tránh nhảy sai số ở mối nối 0/180)
+int16_t app_driver_angle_error(uint16_t desired, uint16_t current)
+{
+    if (!s_enc_actual) {
+        return (int16_t)desired - (int16_t)current;
+    }
+    return (int16_t)ky040_shortest_error(s_enc_actual,
+                                         (int32_t)desired - ANGLE_MIN,
+                                         (int32_t)current - ANGLE_MIN);
+}
+
+// Vị trí nhiều vòng của encoder thực tế (tick, không wrap)
+int32_t app_driver_encoder_get_current_position(void)
+{
+    if (!s_enc_actual) {
+        return 0;
+    }
+    return (int32_t)ky040_get_position(s_enc_actual);
+}
+
+// Vận tốc trục motor (ticks/s, Q8) – dùng cho khâu D / feed-forward
+int32_t app_driver_encoder_get_current_velocity(void)
+{
+    if (!s_enc_actual) {
+        return 0;
+    }
+    return ky040_get_velocity(s_enc_actual);
+}
+
+// Gia tốc trục motor (ticks/s^2, Q8)
+int32_t app_driver_encoder_get_current_accel(void)
+{
+    if (!s_enc_actual) {
+        return 0;
+    }
+    return ky040_get_accel(s_enc_actual);
+}
+
 // Queue: gửi dữ liệu cho task display
 bool app_driver_send_angle_data(uint16_t current, uint16_t desired)
 {
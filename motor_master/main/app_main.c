@@ -1,29 +1,51 @@
 #include <stdio.h>
 
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 
 #include "app_driver.h"
 #include "can_driver.h"
+#include "can_time_sync.h"
+#include "control_loop.h"
+#include "pid_controller.h"
+#include "master_pid.h"
+#include "axis_table.h"
+#include "latency_trace.h"
 
 #define TAG "MASTER_MAIN"
 
-#define CONTROL_PERIOD_MS      10      // 100 Hz
-#define ANGLE_DEADBAND_DEG      2      // |error| <= 4° -> stop
-#define ANGLE_FULL_SCALE_DEG  180      // dải điều khiển (0–180°)
+// 1: slew DUTY_STEP_MAX thực hiện trên slave bằng fade LEDC (CAN_ID_MOTOR_RAMP),
+// chỉ tốn 1 frame khi duty đích không đổi thay vì 1 frame mỗi bước.
+// 0: slew trong PID, gửi duty từng chu kỳ (CAN_ID_MOTOR_CMD / frame gộp).
+#define DUTY_RAMP_HW            0
+#define CMD_REFRESH_CYCLES       5     // gửi lại lệnh mỗi 50 ms (watchdog lệnh trên slave)
+#define AXIS_LOCAL               0     // trục có encoder 2 trên master
 
-#define DUTY_MAX             1023      // 10-bit PWM
-#define DUTY_MIN              250      // duty tối thiểu để motor chạy
-#define DUTY_STEP_MAX          20      // giới hạn thay đổi duty mỗi chu kỳ
+static const pid_gains_t s_pid_gains[] = MASTER_PID_GAINS;
+
+// Latency trace: cạnh encoder 1 -> control -> vào hàng đợi TX -> TX xong.
+// Slave đo tiếp can_rx -> pwm theo cùng seq và đồng hồ master.
+enum { TRACE_CTRL = 0, TRACE_ENQUEUE, TRACE_TX_DONE, TRACE_N_STAGES };
+static const char *const s_trace_stages[TRACE_N_STAGES] = { "ctrl", "enqueue", "tx_done" };
+#define TRACE_INFLIGHT  16
+static ltrace_tag_t s_trace_inflight[TRACE_INFLIGHT];   // tag theo seq, chờ TX-done
+// CTRL task ghi, TX task (on_tx_done_trace) đọc: copy tag dưới critical section
+static portMUX_TYPE s_trace_mux = portMUX_INITIALIZER_UNLOCKED;
+
+// Task / loop handles
+static control_loop_handle_t s_ctrl_loop = NULL;
+static pid_handle_t          s_pid       = NULL;
 
-// Task handles
-static TaskHandle_t s_task_control  = NULL;
 static TaskHandle_t s_task_display  = NULL;
 
-// Task prototypes
-static void task_control(void *pvParameters);
+// Prototypes
+static void control_step(void *arg);
+static void control_step_remote(void *arg);
 static void task_display(void *pvParameters);
+static void on_tx_done_trace(const twai_message_t *msg, bool ok, int64_t done_us,
+                             uint32_t latency_us, void *arg);
 
 void app_main(void)
 {
@@ -37,8 +59,48 @@ void app_main(void)
         }
     }
 
-    xTaskCreate(task_control,
-                "CTRL",  4096, NULL, 5, &s_task_control);
+    pid_config_t pid_cfg = {
+        .gains       = s_pid_gains,
+        .n_gains     = sizeof(s_pid_gains) / sizeof(s_pid_gains[0]),
+        .out_max     = DUTY_MAX,
+        .min_duty    = DUTY_MIN,
+        .integ_limit = INTEG_LIMIT,
+        .slew_max    = DUTY_RAMP_HW ? 0 : DUTY_STEP_MAX,
+        .deadband    = ANGLE_DEADBAND_DEG,
+    };
+    ESP_ERROR_CHECK(pid_create(&pid_cfg, &s_pid));
+    pid_reset(s_pid, app_driver_encoder_get_current_position());
+
+    // Bảng trục + CAN RX: chỉ cần feedback từ các slave
+    static const uint8_t axis_nodes[MASTER_AXIS_COUNT] = MASTER_AXIS_NODES;
+    ESP_ERROR_CHECK(axis_table_init(axis_nodes, MASTER_AXIS_COUNT));
+    ESP_ERROR_CHECK(axis_table_register_feedback());
+    axis_table_set_sync_mode(MASTER_SYNC_MODE);
+    ESP_ERROR_CHECK(can_time_sync_master_start(CAN_TIME_SYNC_DEFAULT_PERIOD_MS));
+
+    ESP_ERROR_CHECK(ltrace_init(s_trace_stages, TRACE_N_STAGES));
+    ESP_ERROR_CHECK(can_driver_add_tx_done_cb(on_tx_done_trace, NULL));
+    ESP_ERROR_CHECK(ltrace_start_console());
+    ESP_ERROR_CHECK(can_driver_start_dispatch(configMAX_PRIORITIES - 3));
+    ESP_ERROR_CHECK(can_driver_start_health_monitor(CAN_HEALTH_DEFAULT_PERIOD_MS,
+                                                    CAN_HEALTH_DEFAULT_LOG_MS));
+
+    if (MASTER_MOTOR_CHAR_ON_BOOT) {
+        for (size_t i = 0; i < MASTER_AXIS_COUNT; i++) {
+            ESP_ERROR_CHECK(can_driver_send_motor_char(axis_nodes[i], CAN_MOTOR_CHAR_RUN));
+        }
+        ESP_LOGW(TAG, "Motor characterization requested, slaves ignore commands for ~20 s");
+    }
+
+    control_loop_config_t loop_cfg = {
+        .period_us  = CONTROL_PERIOD_US,
+        .fn         = CONTROL_ON_SLAVE ? control_step_remote : control_step,
+        .arg        = NULL,
+        .name       = "CTRL",
+        .stack_size = 4096,
+    };
+    ESP_ERROR_CHECK(control_loop_create(&loop_cfg, &s_ctrl_loop));
+    ESP_ERROR_CHECK(control_loop_start(s_ctrl_loop));
 
     xTaskCreate(task_display,
                 "DISPLAY", 4096, NULL, 3, &s_task_display);
@@ -46,73 +108,123 @@ void app_main(void)
     ESP_LOGI(TAG, "All tasks created successfully");
 }
 
-// Task CONTROL
-static void task_control(void *pvParameters)
+// Một chu kỳ CONTROL – gọi bởi control_loop mỗi CONTROL_PERIOD_US
+static void control_step(void *arg)
 {
-    (void)pvParameters;
+    (void)arg;
 
-    uint16_t last_duty = 0;
-    bool     last_dir  = true;
+    static int64_t last_edge_us = 0;
+    int64_t        t_start      = esp_timer_get_time();
+    ltrace_tag_t   trace;
+    ltrace_tag_t  *tag          = NULL;
 
-    ESP_LOGI(TAG, "Control Task started");
+    // Cạnh mới trên núm xoay: lệnh của chu kỳ này được trace từ thời điểm cạnh
+    int64_t edge_us = app_driver_encoder_get_desired_edge_us();
+    if (edge_us != last_edge_us && edge_us != 0) {
+        ltrace_begin(&trace, edge_us);
+        ltrace_mark(&trace, TRACE_CTRL, t_start);
+        tag = &trace;
+    }
+    last_edge_us = edge_us;
 
-    while (1) {
-        // 1. Đọc 2 encoder
-        uint16_t desired = app_driver_encoder_get_desired(); // angle_setpoint
-        uint16_t actual  = app_driver_encoder_get_current(); // angle_actual
+    // 1. Đọc 2 encoder
+    uint16_t desired = app_driver_encoder_get_desired(); // angle_setpoint
+    uint16_t actual  = app_driver_encoder_get_current(); // angle_actual
 
-        // 2. Tính sai số
-        int16_t error   = (int16_t)desired - (int16_t)actual;
-        int16_t abs_err = (error >= 0) ? error : -error;
+    // 2. Tính sai số (đường ngắn nhất, không nhảy ở mối nối 0/180)
+    int16_t error = app_driver_angle_error(desired, actual);
 
-        bool dir  = (error > 0);  // 1 = forward, 0 = backward
-        uint16_t duty = 0;
+    // PID: deadband, anti-windup, slew và bù duty tối thiểu nằm trong pid_controller.
+    // Khâu D lấy vận tốc encoder (ticks/s Q8 -> thay đổi mỗi chu kỳ) thay vì sai phân vị trí:
+    // không nhảy ở mối nối và mịn hơn lượng tử 1 tick / chu kỳ.
+    int32_t rate_q8 = (int32_t)((int64_t)app_driver_encoder_get_current_velocity()
+                                * CONTROL_PERIOD_US / 1000000);
+    int32_t out = pid_update_rate(s_pid, error, rate_q8);
 
-        if (abs_err <= ANGLE_DEADBAND_DEG) {
-           
-            duty = 0;
-        } else {
-            // P-control đơn giản: duty ~ |error|
-            float ratio = (float)abs_err / (float)ANGLE_FULL_SCALE_DEG;
-            if (ratio > 1.0f) ratio = 1.0f;
-
-            uint32_t d = (uint32_t)(DUTY_MIN + ratio * (float)(DUTY_MAX - DUTY_MIN));
-            if (d > DUTY_MAX) d = DUTY_MAX;
-            duty = (uint16_t)d;
-
-            // Slew-rate limit
-            if (duty > last_duty) {
-                uint16_t diff = duty - last_duty;
-                if (diff > DUTY_STEP_MAX) {
-                    duty = last_duty + DUTY_STEP_MAX;
-                }
-            } else {
-                uint16_t diff = last_duty - duty;
-                if (diff > DUTY_STEP_MAX) {
-                    duty = last_duty - DUTY_STEP_MAX;
-                }
-            }
-        }
+    // 3. Ghi lệnh vào bảng trục; flush chỉ gửi frame cho trục có lệnh thay đổi,
+    //    và gửi lại định kỳ để watchdog trên slave không ngắt khi lệnh đứng yên
+    static uint32_t refresh = 0;
+    size_t n_frames = 0;
+    if (DUTY_RAMP_HW) {
+        // Thời gian ramp giữ đúng tốc độ DUTY_STEP_MAX mỗi CONTROL_PERIOD_US
+        static int32_t last_target = 0;
+        int32_t  delta   = out > last_target ? out - last_target : last_target - out;
+        uint32_t ramp_ms = (uint32_t)delta * (CONTROL_PERIOD_US / 1000) / DUTY_STEP_MAX;
+        axis_table_set_ramp(AXIS_LOCAL, (int16_t)out, (uint16_t)ramp_ms);
+        last_target = out;
+    } else {
+        axis_table_set_duty(AXIS_LOCAL, (int16_t)out);
+    }
+    if (++refresh >= CMD_REFRESH_CYCLES) {
+        axis_table_mark_all_dirty();
+        refresh = 0;
+    }
+    if (tag && axis_table_trace(AXIS_LOCAL, tag->seq, tag->capture_us) != ESP_OK) {
+        tag = NULL;
+    }
+    if (tag) {
+        // Đăng ký tag trước khi frame vào hàng đợi để TX-done luôn tìm thấy nó
+        portENTER_CRITICAL(&s_trace_mux);
+        s_trace_inflight[tag->seq % TRACE_INFLIGHT] = *tag;
+        portEXIT_CRITICAL(&s_trace_mux);
+    }
+    esp_err_t ret = axis_table_flush(&n_frames);
+    if (tag) {
+        ltrace_mark(tag, TRACE_ENQUEUE, esp_timer_get_time());
+        portENTER_CRITICAL(&s_trace_mux);
+        s_trace_inflight[tag->seq % TRACE_INFLIGHT] = *tag;
+        portEXIT_CRITICAL(&s_trace_mux);
+    }
+    if (ret != ESP_OK) {
+        ESP_LOGW(TAG, "Failed to send motor cmd (out=%d)", (int)out);
+    } else if (n_frames) {
+        ESP_LOGD(TAG, "Motor cmd: desired=%u, actual=%u, err=%d, out=%d",
+                 desired, actual, (int)error, (int)out);
+    }
 
-        // 3. Chỉ gửi CAN khi dir/duty thay đổi để giảm traffic
-        if (duty != last_duty || dir != last_dir) {
-            esp_err_t ret = can_driver_send_motor_cmd(dir, duty);
-            if (ret != ESP_OK) {
-                ESP_LOGW(TAG, "Failed to send motor cmd (dir=%d, duty=%u)",
-                         (int)dir, (unsigned)duty);
-            } else {
-                ESP_LOGD(TAG, "Send motor cmd: desired=%u, actual=%u, err=%d, dir=%d, duty=%u",
-                         desired, actual, (int)error, (int)dir, (unsigned)duty);
-            }
+    // 4. Gửi dữ liệu cho task display (OLED)
+    app_driver_send_angle_data(actual, desired);
+}
 
-            last_duty = duty;
-            last_dir  = dir;
-        }
+// Một chu kỳ khi vòng kín chạy trên SLAVE: chỉ gửi setpoint, nhận feedback
+static void control_step_remote(void *arg)
+{
+    (void)arg;
+
+    static uint32_t refresh = 0;
 
-        // 4. Gửi dữ liệu cho task display (OLED)
-        app_driver_send_angle_data(actual, desired);
+    uint16_t desired = app_driver_encoder_get_desired();
 
-        vTaskDelay(pdMS_TO_TICKS(CONTROL_PERIOD_MS));
+    // Setpoint gửi khi thay đổi, và định kỳ để slave không mất lệnh
+    axis_table_set_setpoint(AXIS_LOCAL, (int16_t)desired);
+    if (++refresh >= CMD_REFRESH_CYCLES) {
+        axis_table_mark_all_dirty();
+        refresh = 0;
+    }
+    axis_table_flush(NULL);
+
+    axis_feedback_t fb = {0};
+    axis_table_get_feedback(AXIS_LOCAL, &fb);
+    app_driver_send_angle_data((uint16_t)fb.angle, desired);
+}
+
+// TX-done của frame lệnh có trace (TX task)
+static void on_tx_done_trace(const twai_message_t *msg, bool ok, int64_t done_us,
+                             uint32_t latency_us, void *arg)
+{
+    (void)latency_us;
+    (void)arg;
+    uint8_t  seq;
+    uint16_t cap16;
+
+    if (!ok || can_driver_parse_motor_cmd_trace(msg, &seq, &cap16) != ESP_OK) {
+        return;
+    }
+    portENTER_CRITICAL(&s_trace_mux);
+    ltrace_tag_t tag = s_trace_inflight[seq % TRACE_INFLIGHT];
+    portEXIT_CRITICAL(&s_trace_mux);
+    if (tag.seq == seq && (uint16_t)tag.capture_us == cap16) {
+        ltrace_mark(&tag, TRACE_TX_DONE, done_us);
     }
 }
 
@@ -134,6 +246,35 @@ static void task_display(void *pvParameters)
 
             if (display_count % 20 == 0) {
                 ESP_LOGI(TAG, "Displayed %u frames", display_count);
+
+                control_loop_stats_t st;
+                if (control_loop_get_stats(s_ctrl_loop, &st) == ESP_OK && st.cycles) {
+                    ESP_LOGI(TAG, "CTRL: cycles=%u lat avg/max=%u/%u us exec avg/max=%u/%u us missed=%u overrun=%u",
+                             (unsigned)st.cycles,
+                             (unsigned)(st.latency_sum_us / st.cycles), (unsigned)st.latency_max_us,
+                             (unsigned)(st.exec_sum_us / st.cycles), (unsigned)st.exec_max_us,
+                             (unsigned)st.missed, (unsigned)st.overruns);
+                }
+
+                can_tx_stats_t tx;
+                can_driver_get_tx_stats(&tx);
+                ESP_LOGI(TAG, "CAN TX: sent=%u failed=%u replaced=%u dropped=%u lat_max=%u us",
+                         (unsigned)tx.sent, (unsigned)tx.failed, (unsigned)tx.replaced,
+                         (unsigned)tx.dropped, (unsigned)tx.latency_max_us);
+
+                axis_telemetry_t tm;
+                if (axis_table_get_telemetry(AXIS_LOCAL, &tm) == ESP_OK && tm.count) {
+                    ESP_LOGI(TAG, "Node %u: pos=%d vel=%d duty=%d faults=0x%02X age=%d ms lat=%d us",
+                             axis_table_node(AXIS_LOCAL), (int)tm.position, tm.velocity,
+                             tm.duty, tm.faults,
+                             (int)((esp_timer_get_time() - tm.rx_us) / 1000),
+                             tm.sample_us ? (int)(tm.rx_us - tm.sample_us) : -1);
+                    if (tm.current_rx_us) {
+                        ESP_LOGI(TAG, "Node %u: I=%u mA peak=%u mA trips=%u%s",
+                                 axis_table_node(AXIS_LOCAL), tm.current_ma, tm.peak_ma,
+                                 tm.trips, (tm.faults & CAN_FAULT_OVERCURRENT) ? " TRIPPED" : "");
+                    }
+                }
             }
         } else {
             // Nếu không có dữ liệu mới, vẫn cập nhật với giá trị hiện tại
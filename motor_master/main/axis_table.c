@@ -0,0 +1,425 @@
+#include <stdatomic.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+
+#include "axis_table.h"
+#include "can_driver.h"
+
+#define TAG "AXIS_TABLE"
+
+typedef struct {
+    uint8_t    node;
+    axis_cmd_t cmd;
+    int16_t    value;       // duty có dấu hoặc góc đặt, tuỳ cmd
+    uint16_t   ramp_ms;     // AXIS_CMD_RAMP
+    axis_cmd_t sent_cmd;
+    int16_t    sent_value;
+    bool       dirty;
+
+    // Lệnh duty kế tiếp gửi bằng frame có trace (xem latency_trace.h)
+    bool       trace_pending;
+    uint8_t    trace_seq;
+    int64_t    trace_capture_us;
+
+    // Feedback / telemetry: CAN dispatch task là writer duy nhất, control / display đọc.
+    // Double buffer: bản hiện hành là buf[gen & 1], writer ghi bản kia rồi tăng gen.
+    axis_feedback_t   fb_buf[2];
+    _Atomic uint32_t  fb_gen;
+    axis_telemetry_t  tm_buf[2];
+    _Atomic uint32_t  tm_gen;
+
+    // Bản làm việc của dispatch task (telemetry + dòng), publish vào tm_buf sau mỗi frame
+    axis_telemetry_t  tm;
+    // Trạng thái mở rộng wrap 16-bit, chỉ dispatch task dùng
+    int16_t           tm_pos_raw;
+    uint16_t          tm_time_raw;
+} axis_entry_t;
+
+static axis_entry_t s_axes[AXIS_TABLE_MAX];
+static size_t       s_n_axes = 0;
+static int8_t       s_axis_of_node[CAN_MAX_NODES];   // node -> axis, -1 = không dùng
+static bool         s_sync_mode  = false;
+static uint8_t      s_sync_count = 0;
+
+esp_err_t axis_table_init(const uint8_t *nodes, size_t n_axes)
+{
+    if (!nodes || n_axes == 0 || n_axes > AXIS_TABLE_MAX) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    memset(s_axes, 0, sizeof(s_axes));
+    memset(s_axis_of_node, -1, sizeof(s_axis_of_node));
+
+    for (size_t i = 0; i < n_axes; i++) {
+        if (nodes[i] >= CAN_MAX_NODES || s_axis_of_node[nodes[i]] >= 0) {
+            ESP_LOGE(TAG, "invalid or duplicate node %u", nodes[i]);
+            return ESP_ERR_INVALID_ARG;
+        }
+        s_axes[i].node = nodes[i];
+        s_axis_of_node[nodes[i]] = (int8_t)i;
+    }
+    s_n_axes = n_axes;
+
+    ESP_LOGI(TAG, "%u axes", (unsigned)n_axes);
+    return ESP_OK;
+}
+
+size_t axis_table_count(void)
+{
+    return s_n_axes;
+}
+
+uint8_t axis_table_node(size_t axis)
+{
+    return (axis < s_n_axes) ? s_axes[axis].node : 0;
+}
+
+static esp_err_t axis_set(size_t axis, axis_cmd_t cmd, int16_t value)
+{
+    if (axis >= s_n_axes) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    axis_entry_t *a = &s_axes[axis];
+    a->cmd   = cmd;
+    a->value = value;
+    if (cmd != a->sent_cmd || value != a->sent_value) {
+        a->dirty = true;
+    }
+    return ESP_OK;
+}
+
+esp_err_t axis_table_set_duty(size_t axis, int16_t duty)
+{
+    if (duty > 1023 || duty < -1023) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    return axis_set(axis, AXIS_CMD_DUTY, duty);
+}
+
+esp_err_t axis_table_set_setpoint(size_t axis, int16_t angle)
+{
+    return axis_set(axis, AXIS_CMD_SETPOINT, angle);
+}
+
+esp_err_t axis_table_set_ramp(size_t axis, int16_t duty, uint16_t ramp_ms)
+{
+    if (duty > 1023 || duty < -1023) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    esp_err_t ret = axis_set(axis, AXIS_CMD_RAMP, duty);
+    if (ret == ESP_OK) {
+        s_axes[axis].ramp_ms = ramp_ms;
+    }
+    return ret;
+}
+
+void axis_table_mark_all_dirty(void)
+{
+    for (size_t i = 0; i < s_n_axes; i++) {
+        if (s_axes[i].cmd != AXIS_CMD_NONE) {
+            s_axes[i].dirty = true;
+        }
+    }
+}
+
+static axis_entry_t *dirty_duty_axis(unsigned node)
+{
+    if (node >= CAN_MAX_NODES || s_axis_of_node[node] < 0) {
+        return NULL;
+    }
+    axis_entry_t *a = &s_axes[s_axis_of_node[node]];
+    return (a->dirty && a->cmd == AXIS_CMD_DUTY && !a->trace_pending) ? a : NULL;
+}
+
+static void mark_sent(axis_entry_t *a)
+{
+    a->sent_cmd   = a->cmd;
+    a->sent_value = a->value;
+    a->dirty      = false;
+}
+
+// Gộp duty của các node liên tiếp (cửa sổ CAN_PACKED_MAX_AXES) vào CAN_ID_MOTOR_PACKED.
+// Cửa sổ chỉ có 1 trục đổi lệnh thì để lại cho frame CAN_ID_MOTOR_CMD riêng,
+// trừ chế độ SYNC: mọi duty đều phải đi qua frame gộp có cờ staged.
+static esp_err_t flush_packed(size_t *sent)
+{
+    size_t min_dirty = s_sync_mode ? 1 : 2;
+
+    esp_err_t ret  = ESP_OK;
+    unsigned  node = 0;
+
+    while (node < CAN_MAX_NODES) {
+        if (!dirty_duty_axis(node)) {
+            node++;
+            continue;
+        }
+
+        int16_t       duty[CAN_PACKED_MAX_AXES];
+        axis_entry_t *slot[CAN_PACKED_MAX_AXES] = {0};
+        size_t        count   = 0;
+        size_t        n_dirty = 0;
+
+        for (size_t k = 0; k < CAN_PACKED_MAX_AXES; k++) {
+            slot[k] = dirty_duty_axis(node + k);
+            duty[k] = slot[k] ? slot[k]->value : CAN_PACKED_DUTY_KEEP;
+            if (slot[k]) {
+                count = k + 1;
+                n_dirty++;
+            }
+        }
+        if (n_dirty < min_dirty) {
+            node++;
+            continue;
+        }
+
+        esp_err_t err = can_driver_send_packed((uint8_t)node, duty, count, s_sync_mode);
+        if (err == ESP_OK) {
+            for (size_t k = 0; k < count; k++) {
+                if (slot[k]) {
+                    mark_sent(slot[k]);
+                }
+            }
+            (*sent)++;
+        } else {
+            ret = err;
+        }
+        node += count;
+    }
+    return ret;
+}
+
+void axis_table_set_sync_mode(bool enable)
+{
+    s_sync_mode = enable;
+}
+
+esp_err_t axis_table_trace(size_t axis, uint8_t seq, int64_t capture_us)
+{
+    if (axis >= s_n_axes) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    axis_entry_t *a = &s_axes[axis];
+    if (s_sync_mode || a->cmd != AXIS_CMD_DUTY) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    a->trace_pending    = true;
+    a->trace_seq        = seq;
+    a->trace_capture_us = capture_us;
+    return ESP_OK;
+}
+
+esp_err_t axis_table_flush(size_t *n_frames)
+{
+    size_t    sent = 0;
+    esp_err_t ret  = flush_packed(&sent);
+
+    // Các slave áp duty đã stage cùng lúc khi nhận SYNC (xếp sau frame staged)
+    if (s_sync_mode && sent > 0) {
+        esp_err_t err = can_driver_send_sync(s_sync_count);
+        if (err == ESP_OK) {
+            s_sync_count++;
+            sent++;
+        } else {
+            ret = err;
+        }
+    }
+
+    for (size_t i = 0; i < s_n_axes; i++) {
+        axis_entry_t *a = &s_axes[i];
+        if (!a->dirty && !a->trace_pending) {
+            continue;
+        }
+
+        esp_err_t err;
+        if (a->cmd == AXIS_CMD_DUTY && a->trace_pending) {
+            // Frame trace luôn được gửi, kể cả khi duty không đổi
+            int16_t d = a->value;
+            err = can_driver_send_motor_cmd_traced(a->node, d >= 0, (uint16_t)(d >= 0 ? d : -d),
+                                                   a->trace_seq, a->trace_capture_us);
+            a->trace_pending = false;
+        } else if (a->cmd == AXIS_CMD_DUTY) {
+            int16_t d = a->value;
+            err = can_driver_send_motor_cmd_to(a->node, d >= 0, (uint16_t)(d >= 0 ? d : -d));
+        } else if (a->cmd == AXIS_CMD_RAMP) {
+            int16_t d = a->value;
+            err = can_driver_send_motor_ramp_to(a->node, d >= 0, (uint16_t)(d >= 0 ? d : -d),
+                                                a->ramp_ms);
+        } else if (a->cmd == AXIS_CMD_SETPOINT) {
+            err = can_driver_send_setpoint_to(a->node, a->value);
+        } else {
+            a->dirty = false;
+            continue;
+        }
+
+        if (err == ESP_OK) {
+            mark_sent(a);
+            sent++;
+        } else {
+            // Giữ dirty để thử lại ở chu kỳ sau
+            ret = err;
+        }
+    }
+
+    if (n_frames) {
+        *n_frames = sent;
+    }
+    return ret;
+}
+
+// ========== Feedback ==========
+
+// Ghi vào bản không hiện hành rồi đổi index (release): reader luôn có 1 bản đầy đủ,
+// không phải chờ writer nên vòng control ưu tiên cao không thể quay chờ trên lõi đơn.
+#define RX_PUBLISH(buf, gen, val)                                                 \
+    do {                                                                          \
+        uint32_t g_ = atomic_load_explicit(&(gen), memory_order_relaxed) + 1;     \
+        (buf)[g_ & 1] = (val);                                                    \
+        atomic_store_explicit(&(gen), g_, memory_order_release);                  \
+    } while (0)
+
+// Copy bản hiện hành. Chỉ lấy lại khi writer đã publish >= 2 lần trong lúc copy (có thể
+// ghi đè đúng bản đang đọc): reader ưu tiên thấp hơn dispatch task bị chen giữa chừng.
+// Vòng control (ưu tiên cao hơn dispatch) không bao giờ lặp. Writer không chờ reader.
+#define RX_READ(buf, gen, out)                                                    \
+    do {                                                                          \
+        uint32_t g_;                                                              \
+        do {                                                                      \
+            g_ = atomic_load_explicit(&(gen), memory_order_acquire);              \
+            *(out) = (buf)[g_ & 1];                                               \
+            atomic_thread_fence(memory_order_acquire);                            \
+        } while (atomic_load_explicit(&(gen), memory_order_relaxed) - g_ >= 2);   \
+    } while (0)
+
+static void on_feedback(const twai_message_t *msg, int64_t rx_us, void *arg)
+{
+    (void)arg;
+    uint8_t node;
+    int16_t angle, duty;
+
+    if (can_driver_parse_feedback(msg, &node, &angle, &duty) != ESP_OK) {
+        return;
+    }
+    int8_t axis = s_axis_of_node[node];
+    if (axis < 0) {
+        return;
+    }
+
+    axis_entry_t         *a  = &s_axes[axis];
+    const axis_feedback_t fb = { .angle = angle, .duty = duty, .rx_us = rx_us };
+    RX_PUBLISH(a->fb_buf, a->fb_gen, fb);
+}
+
+static void on_telemetry(const twai_message_t *msg, int64_t rx_us, void *arg)
+{
+    (void)arg;
+    uint8_t         node;
+    can_telemetry_t raw;
+
+    if (can_driver_parse_telemetry(msg, &node, &raw) != ESP_OK) {
+        return;
+    }
+    int8_t axis = s_axis_of_node[node];
+    if (axis < 0) {
+        return;
+    }
+
+    axis_entry_t    *a  = &s_axes[axis];
+    axis_telemetry_t tm = a->tm;     // bản làm việc, chỉ task này đọc / ghi
+
+    // Mở rộng vị trí / timestamp 16-bit theo hiệu so với frame trước
+    // (frame đầu tiên hoặc slave vừa chuyển sang giờ master thì lấy lại mốc)
+    bool base_changed = ((raw.faults ^ tm.faults) & CAN_FAULT_TIME_UNSYNCED) != 0;
+    if (tm.count == 0) {
+        tm.position = raw.position;
+    } else {
+        tm.position += (int16_t)(raw.position - a->tm_pos_raw);
+    }
+    if (tm.count == 0 || base_changed) {
+        tm.slave_us = raw.time_us;
+    } else {
+        tm.slave_us += (uint16_t)(raw.time_us - a->tm_time_raw);
+    }
+    a->tm_pos_raw  = raw.position;
+    a->tm_time_raw = raw.time_us;
+
+    tm.velocity = raw.velocity;
+    tm.duty     = raw.duty;
+    tm.faults   = raw.faults;
+    tm.rx_us    = rx_us;
+    tm.count++;
+
+    // Slave đã đồng bộ: 16 bit thấp là giờ master, ghép với rx_us (độ trễ < 65 ms)
+    tm.sample_us = (raw.faults & CAN_FAULT_TIME_UNSYNCED)
+                 ? 0 : rx_us - (uint16_t)((uint16_t)rx_us - raw.time_us);
+
+    a->tm = tm;
+    RX_PUBLISH(a->tm_buf, a->tm_gen, tm);
+}
+
+static void on_current(const twai_message_t *msg, int64_t rx_us, void *arg)
+{
+    (void)arg;
+    uint8_t       node;
+    can_current_t cur;
+
+    if (can_driver_parse_current(msg, &node, &cur) != ESP_OK) {
+        return;
+    }
+    int8_t axis = s_axis_of_node[node];
+    if (axis < 0) {
+        return;
+    }
+
+    axis_entry_t *a = &s_axes[axis];
+    a->tm.current_ma    = cur.current_ma;
+    a->tm.peak_ma       = cur.peak_ma;
+    a->tm.trips         = cur.trips;
+    a->tm.current_rx_us = rx_us;
+    RX_PUBLISH(a->tm_buf, a->tm_gen, a->tm);
+}
+
+esp_err_t axis_table_register_feedback(void)
+{
+    for (size_t i = 0; i < s_n_axes; i++) {
+        esp_err_t err = can_driver_register_handler(CAN_ID_NODE(CAN_ID_FEEDBACK, s_axes[i].node),
+                                                    on_feedback, NULL);
+        if (err == ESP_OK) {
+            err = can_driver_register_handler(CAN_ID_NODE(CAN_ID_TELEMETRY, s_axes[i].node),
+                                              on_telemetry, NULL);
+        }
+        if (err == ESP_OK) {
+            err = can_driver_register_handler(CAN_ID_NODE(CAN_ID_CURRENT, s_axes[i].node),
+                                              on_current, NULL);
+        }
+        if (err != ESP_OK) {
+            return err;
+        }
+    }
+    return ESP_OK;
+}
+
+esp_err_t axis_table_get_feedback(size_t axis, axis_feedback_t *fb)
+{
+    if (axis >= s_n_axes || !fb) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    axis_entry_t *a = &s_axes[axis];
+    RX_READ(a->fb_buf, a->fb_gen, fb);
+
+    return ESP_OK;
+}
+
+esp_err_t axis_table_get_telemetry(size_t axis, axis_telemetry_t *tm)
+{
+    if (axis >= s_n_axes || !tm) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    axis_entry_t *a = &s_axes[axis];
+    RX_READ(a->tm_buf, a->tm_gen, tm);
+
+    return ESP_OK;
+}
@@ -30,6 +30,25 @@
 #define I2C_MASTER_SCL_IO    3
 #define I2C_MASTER_FREQ_HZ   400000
 
+// Chế độ điều khiển:
+//  0 = vòng kín trên MASTER (encoder 2 + PID, gửi CAN_ID_MOTOR_CMD)
+//  1 = vòng kín trên SLAVE (chỉ gửi CAN_ID_SETPOINT, đọc CAN_ID_FEEDBACK)
+#define CONTROL_ON_SLAVE     0
+
+// Bảng trục: axis i <-> slave node MASTER_AXIS_NODES[i] (xem axis_table.h).
+// Axis 0 là trục có encoder 2 trên master.
+#define MASTER_AXIS_NODES    { 0 }
+#define MASTER_AXIS_COUNT    1
+
+// 1 = stage duty rồi gửi CAN_ID_SYNC mỗi chu kỳ có lệnh mới, các trục đổi duty
+//     cùng lúc (tốn thêm 1 frame SYNC mỗi chu kỳ)
+#define MASTER_SYNC_MODE     0
+
+// 1 = gửi CAN_MOTOR_CHAR_RUN tới mọi trục lúc khởi động: slave quét duty (~20 s,
+//     trục phải quay tự do) và lưu bảng tuyến tính hóa vào NVS. Chỉ cần chạy 1 lần
+//     mỗi motor; bảng được nạp lại mỗi lần slave khởi động.
+#define MASTER_MOTOR_CHAR_ON_BOOT  0
+
 // CAN TX/RX MASTER 
 #define MASTER_CAN_TX_PIN    GPIO_NUM_5
 #define MASTER_CAN_RX_PIN    GPIO_NUM_6
@@ -49,6 +68,19 @@ uint16_t app_driver_encoder_get_desired(void);
 // Lấy giá trị encoder hiện tại (encoder 2 gắn trên trục gương)
 uint16_t app_driver_encoder_get_current(void);
 
+// Sai số desired - current theo đường ngắn nhất trên vòng [ANGLE_MIN, ANGLE_MAX]
+int16_t app_driver_angle_error(uint16_t desired, uint16_t current);
+
+// Vị trí nhiều vòng encoder 2 (tick, không wrap) – dùng cho khâu D của PID
+int32_t app_driver_encoder_get_current_position(void);
+
+// Thời điểm (esp_timer) của cạnh encoder 1 gần nhất – mốc capture cho latency trace
+int64_t app_driver_encoder_get_desired_edge_us(void);
+
+// Vận tốc / gia tốc encoder 2 (ticks/s và ticks/s^2, fixed-point Q8)
+int32_t app_driver_encoder_get_current_velocity(void);
+int32_t app_driver_encoder_get_current_accel(void);
+
 // Queue cho task display
 bool app_driver_send_angle_data(uint16_t current, uint16_t desired);
 bool app_driver_receive_angle_data(angle_data_t *data, TickType_t timeout);
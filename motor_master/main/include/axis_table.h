@@ -0,0 +1,93 @@
+#ifndef AXIS_TABLE_H
+#define AXIS_TABLE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "esp_err.h"
+#include "can_driver.h"
+
+// Số trục tối đa master điều khiển (mỗi trục là một slave node trên bus)
+#define AXIS_TABLE_MAX          CAN_MAX_NODES
+
+// Kiểu lệnh của một trục trong chu kỳ hiện tại
+typedef enum {
+    AXIS_CMD_NONE = 0,
+    AXIS_CMD_DUTY,          // duty có dấu -> CAN_ID_MOTOR_CMD (vòng kín trên master)
+    AXIS_CMD_SETPOINT,      // góc đặt     -> CAN_ID_SETPOINT  (vòng kín trên slave)
+    AXIS_CMD_RAMP,          // duty đích + thời gian ramp -> CAN_ID_MOTOR_RAMP (fade trên slave)
+} axis_cmd_t;
+
+// Feedback mới nhất của một trục (CAN_ID_FEEDBACK)
+typedef struct {
+    int16_t angle;
+    int16_t duty;
+    int64_t rx_us;          // 0 = chưa nhận frame nào
+} axis_feedback_t;
+
+// Telemetry mới nhất của một trục (CAN_ID_TELEMETRY), đã mở rộng wrap 16-bit
+typedef struct {
+    int32_t  position;      // tick, nhiều vòng
+    int16_t  velocity;      // tick/s
+    int16_t  duty;          // duty có dấu slave đang áp
+    uint8_t  faults;        // CAN_FAULT_*
+    uint32_t slave_us;      // timestamp trong frame (µs, chỉ hiệu giữa 2 mẫu có nghĩa)
+    int64_t  rx_us;         // đồng hồ master lúc nhận frame
+    int64_t  sample_us;     // thời điểm lấy mẫu theo đồng hồ master (0 = slave chưa đồng bộ)
+    uint32_t count;         // số frame đã nhận, 0 = chưa có dữ liệu
+    // Từ CAN_ID_CURRENT (chu kỳ thưa hơn telemetry)
+    uint16_t current_ma;    // dòng đã lọc
+    uint16_t peak_ma;       // dòng đỉnh giữa 2 frame CAN_ID_CURRENT
+    uint16_t trips;         // số lần ngắt quá dòng
+    int64_t  current_rx_us; // 0 = slave không gửi dòng
+} axis_telemetry_t;
+
+// Khởi tạo bảng trục: axis i <-> slave node nodes[i]
+esp_err_t axis_table_init(const uint8_t *nodes, size_t n_axes);
+size_t    axis_table_count(void);
+uint8_t   axis_table_node(size_t axis);
+
+// Đặt lệnh cho một trục (chỉ ghi vào bảng, chưa gửi)
+esp_err_t axis_table_set_duty(size_t axis, int16_t duty);
+esp_err_t axis_table_set_setpoint(size_t axis, int16_t angle);
+
+/**
+ * @brief Duty đích có dấu, slave tự ramp tới trong ramp_ms bằng fade LEDC.
+ *        Chỉ gửi frame khi duty đích đổi (và khi refresh); đổi riêng ramp_ms không gửi lại.
+ */
+esp_err_t axis_table_set_ramp(size_t axis, int16_t duty, uint16_t ramp_ms);
+
+/**
+ * @brief Chế độ stage-then-SYNC: duty gửi bằng frame gộp có cờ staged, sau đó
+ *        1 frame CAN_ID_SYNC để mọi slave áp duty cùng một thời điểm.
+ *        Setpoint (vòng kín trên slave) không bị ảnh hưởng.
+ */
+void axis_table_set_sync_mode(bool enable);
+
+/**
+ * @brief Gửi duty của trục ở lần flush kế tiếp bằng frame CAN_ID_MOTOR_CMD có trace
+ *        (seq + thời điểm capture), kể cả khi duty không đổi.
+ * @return ESP_ERR_NOT_SUPPORTED ở chế độ SYNC hoặc khi trục không ở chế độ duty
+ */
+esp_err_t axis_table_trace(size_t axis, uint8_t seq, int64_t capture_us);
+
+// Gửi lại toàn bộ lệnh ở lần flush kế tiếp (refresh định kỳ cho slave)
+void axis_table_mark_all_dirty(void);
+
+/**
+ * @brief Gửi các lệnh đã thay đổi từ lần flush trước, gọi 1 lần mỗi chu kỳ control.
+ *        Trục không đổi lệnh không tốn frame nào trên bus; duty của các node gần nhau
+ *        (tối đa CAN_PACKED_MAX_AXES node liên tiếp) đi chung 1 frame CAN_ID_MOTOR_PACKED.
+ * @param[out] n_frames số frame đã đưa vào hàng đợi TX (có thể NULL)
+ */
+esp_err_t axis_table_flush(size_t *n_frames);
+
+// Đăng ký handler CAN_ID_FEEDBACK + CAN_ID_TELEMETRY + CAN_ID_CURRENT cho từng node
+// (gọi trước can_driver_start_dispatch)
+esp_err_t axis_table_register_feedback(void);
+
+// Copy bản mới nhất từ double buffer, không khóa, không chờ bus: gọi được từ vòng control
+esp_err_t axis_table_get_feedback(size_t axis, axis_feedback_t *fb);
+esp_err_t axis_table_get_telemetry(size_t axis, axis_telemetry_t *tm);
+
+#endif
@@ -0,0 +1,23 @@
+#ifndef MASTER_PID_H
+#define MASTER_PID_H
+
+// Tham số PID của vòng control trên master. Tách khỏi app_main.c để test host
+// (tools/pid_step_test.c) chạy đúng bảng gain này trên mô hình motor.
+
+#define CONTROL_PERIOD_US   10000      // 100 Hz (GPTimer, không phụ thuộc FreeRTOS tick)
+#define ANGLE_DEADBAND_DEG      2      // |error| <= 2° -> stop
+
+#define DUTY_MAX             1023      // 10-bit PWM
+// Không bù duty tối thiểu ở master: slave tuyến tính hóa mọi lệnh duty qua bảng
+// đặc tính motor (duty khởi động từng chiều, motor_char), duty gửi đi là effort.
+#define DUTY_MIN                0
+#define DUTY_STEP_MAX          20      // giới hạn thay đổi duty mỗi chu kỳ
+#define INTEG_LIMIT           300      // giới hạn khâu I (đơn vị duty)
+
+// Bảng gain theo |error| (độ); gain đã tính theo chu kỳ 10 ms
+#define MASTER_PID_GAINS { \
+    { .err_max = 10,  .kp_q16 = PID_Q16(6.0f), .ki_q16 = PID_Q16(0.4f), .kd_q16 = PID_Q16(6.0f) }, \
+    { .err_max = 180, .kp_q16 = PID_Q16(5.7f), .ki_q16 = 0,             .kd_q16 = PID_Q16(4.0f) }, \
+}
+
+#endif
@@ -1,29 +1,75 @@
 #include "app_driver.h"
 
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "motor_driver.h"
 #include "encoder_driver.h"
 #include "can_driver.h"
+#include "current_sense.h"
 
 static const char *TAG = "APP_DRIVER_SLAVE";
 
 // Encoder handle
 static ky040_handle_t s_enc = NULL;
+static motor_handle_t s_motor = NULL;
 
 esp_err_t app_driver_init(const app_driver_config_t *cfg)
 {
     if (!cfg) return ESP_ERR_INVALID_ARG;
 
     // ===== CAN =====
-    ESP_ERROR_CHECK(can_driver_init(cfg->can_tx_pin, cfg->can_rx_pin));
+    // Slave chỉ nhận lệnh motor và setpoint gửi tới node của mình,
+    // phần còn lại bị lọc bằng phần cứng
+    static const can_id_range_t can_accept[] = {
+        CAN_ID_ONE(CAN_ID_NODE(CAN_ID_SETPOINT, SLAVE_NODE_ID)),
+        CAN_ID_ONE(CAN_ID_NODE(CAN_ID_MOTOR_CMD, SLAVE_NODE_ID)),
+        CAN_ID_RANGE(CAN_ID_MOTOR_PACKED, CAN_ID_SYNC),
+        CAN_ID_RANGE(CAN_ID_TIME_SYNC, CAN_ID_TIME_FOLLOW),
+        CAN_ID_ONE(CAN_ID_NODE(CAN_ID_MOTOR_RAMP, SLAVE_NODE_ID)),
+        CAN_ID_ONE(CAN_ID_NODE(CAN_ID_MOTOR_CHAR, SLAVE_NODE_ID)),
+    };
+    ESP_ERROR_CHECK(can_driver_set_node_id(SLAVE_NODE_ID));
+#if SLAVE_CAN_AUTO_BAUD_MS > 0
+    uint32_t bitrate = 0;
+    int64_t  until   = esp_timer_get_time() + SLAVE_CAN_AUTO_BAUD_MS * 1000LL;
+    while (can_driver_auto_baud(cfg->can_tx_pin, cfg->can_rx_pin, NULL, 0,
+                                SLAVE_CAN_AUTO_BAUD_WIN, &bitrate) == ESP_ERR_NOT_FOUND &&
+           esp_timer_get_time() < until) {
+    }
+    if (!bitrate) {
+        ESP_LOGW(TAG, "Auto-baud: no traffic, using %u bit/s", (unsigned)can_driver_get_bitrate());
+    }
+#endif
+    ESP_ERROR_CHECK(can_driver_init(cfg->can_tx_pin, cfg->can_rx_pin,
+                                    can_accept, sizeof(can_accept) / sizeof(can_accept[0])));
 
     // ===== MOTOR =====
     motor_config_t mcfg = {
-        .pwm_pin      = cfg->motor_pwm_pin,
-        .forward_pin  = cfg->motor_forward_pin,
-        .backward_pin = cfg->motor_backward_pin,
+        .pwm_pin        = cfg->motor_pwm_pin,
+        .forward_pin    = cfg->motor_forward_pin,
+        .backward_pin   = cfg->motor_backward_pin,
+        .pwm_freq_hz    = cfg->motor_pwm_freq_hz,
+        .pwm_resolution = cfg->motor_pwm_resolution,
+        .dead_time_us   = cfg->motor_dead_time_us,
     };
-    ESP_ERROR_CHECK(motor_driver_init(&mcfg));
+    ESP_ERROR_CHECK(motor_driver_init(&mcfg, &s_motor));
+
+    // ===== CURRENT SENSE =====
+    // Tần số mẫu ADC bám theo tần số PWM thực tế của motor
+    if (cfg->motor_isense_channel >= 0) {
+        uint32_t pwm_hz = 0;
+        ESP_ERROR_CHECK(motor_get_pwm(s_motor, &pwm_hz, NULL));
+        current_sense_config_t icfg = {
+            .channel           = (adc_channel_t)cfg->motor_isense_channel,
+            .motor             = s_motor,
+            .pwm_freq_hz       = pwm_hz,
+            .periods_per_frame = MOTOR_ISENSE_PERIODS,
+            .sense_mohm        = cfg->motor_sense_mohm,
+            .trip_ma           = cfg->motor_trip_ma,
+            .filter_shift      = MOTOR_ISENSE_FILTER,
+        };
+        ESP_ERROR_CHECK(current_sense_start(&icfg));
+    }
 
     // ===== ENCODER =====
     ky040_config_t ecfg = {
@@ -42,8 +88,33 @@ esp_err_t app_driver_init(const app_driver_config_t *cfg)
     return ESP_OK;
 }
 
+motor_handle_t app_driver_get_motor(void)
+{
+    return s_motor;
+}
+
 int16_t app_driver_get_encoder_angle(void)
 {
     if (!s_enc) return 0;
     return (int16_t)ky040_get_angle(s_enc);
 }
+
+int32_t app_driver_get_encoder_position(void)
+{
+    if (!s_enc) return 0;
+    return (int32_t)ky040_get_position(s_enc);
+}
+
+int32_t app_driver_get_encoder_velocity(void)
+{
+    if (!s_enc) return 0;
+    return ky040_get_velocity(s_enc) >> KY040_VEL_FRAC_BITS;
+}
+
+int16_t app_driver_angle_error(int16_t target, int16_t current)
+{
+    if (!s_enc) return target - current;
+    return (int16_t)ky040_shortest_error(s_enc,
+                                         target  - ENC_ANGLE_MIN,
+                                         current - ENC_ANGLE_MIN);
+}
@@ -1,33 +1,187 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
 
 #include "esp_log.h"
+#include "esp_timer.h"
 
 #include "app_driver.h"
 #include "motor_driver.h"
 #include "can_driver.h"
+#include "can_time_sync.h"
+#include "latency_trace.h"
+#include "control_loop.h"
+#include "pid_controller.h"
+#include "current_sense.h"
+#include "motor_char.h"
+#include "nvs_flash.h"
 
 static const char *TAG = "SLAVE_APP";
 
-void task_can_rx(void *arg);
+#define DUTY_MAX             1023      // thang duty của giao thức CAN (100%), độc lập độ phân giải PWM
+#define DUTY_Q15(d)          MOTOR_DUTY_Q15(d, DUTY_MAX)
+#define DUTY_MIN              250      // duty tối thiểu để motor chạy khi chưa có bảng motor_char
+#define ANGLE_DEADBAND_DEG      2
+
+// Gain cho vòng 1 kHz (ki / kd đã quy đổi theo chu kỳ 1 ms)
+static const pid_gains_t s_pid_gains[] = {
+    { .err_max = 10,  .kp_q16 = PID_Q16(6.0f), .ki_q16 = PID_Q16(0.04f), .kd_q16 = PID_Q16(60.0f) },
+    { .err_max = 180, .kp_q16 = PID_Q16(5.7f), .ki_q16 = 0,              .kd_q16 = PID_Q16(40.0f) },
+};
+
+// Nguồn lệnh hiện tại: master gửi duty trực tiếp, hoặc gửi setpoint cho vòng kín trên slave
+typedef enum {
+    SLAVE_MODE_DIRECT = 0,
+    SLAVE_MODE_LOCAL_LOOP,
+} slave_mode_t;
+
+static volatile slave_mode_t s_mode     = SLAVE_MODE_DIRECT;
+static volatile int16_t      s_setpoint = 0;
+static volatile int16_t      s_applied  = 0;   // effort có dấu đang áp (trước bảng s_lin)
+// Duty có dấu thật sự ghi ra cầu (thang DUTY_MAX, sau bảng s_lin và hạn dòng mềm),
+// báo trong telemetry / feedback
+static volatile int16_t      s_applied_duty = 0;
+
+// Cờ lỗi gửi trong telemetry (CAN_FAULT_*): s_faults là trạng thái kéo dài,
+// s_fault_events là sự kiện chỉ báo 1 lần rồi xóa sau khi gửi
+static volatile uint8_t      s_faults       = 0;
+static volatile uint8_t      s_fault_events = 0;
+static portMUX_TYPE          s_fault_mux    = portMUX_INITIALIZER_UNLOCKED;
+
+// Hạn dòng mềm: hệ số Q15 nhân vào độ lớn duty, task telemetry cập nhật theo dòng đã lọc.
+// Vòng kín cục bộ áp lại khi hệ số đổi; lệnh DIRECT nhận hệ số mới ở lần refresh kế tiếp.
+static volatile uint16_t     s_ilimit_q15    = MOTOR_DUTY_FULL;
+static uint16_t              s_ilimit_applied = MOTOR_DUTY_FULL;
+
+// Tuyến tính hóa effort -> duty (motor_char): s_lin trỏ tới 1 trong 2 bảng, bảng mới
+// được dựng ở bản còn lại rồi đổi con trỏ (ghi nguyên tử), người đọc không cần khóa.
+static motor_char_t                   s_char_tab[2];
+static const motor_char_t *volatile   s_lin          = &s_char_tab[0];
+static volatile bool                  s_char_running = false;   // đang quét: bỏ qua lệnh duty
+static bool                           s_char_busy    = false;   // task motor_char đang chạy
+
+static control_loop_handle_t s_loop  = NULL;
+static motor_handle_t        s_motor = NULL;
+static pid_handle_t          s_pid  = NULL;
+
+// Stage-then-SYNC: duty từ frame gộp có cờ staged chỉ được áp khi nhận CAN_ID_SYNC.
+// Cả hai handler chạy trong dispatch task nên không cần khóa.
+static int16_t s_staged_duty  = 0;
+static bool    s_staged_valid = false;
+
+// Thống kê độ trễ SYNC nhận (twai_receive trả về) -> đã ghi duty vào LEDC
+typedef struct {
+    uint32_t count;
+    uint32_t missed;        // SYNC bị mất, suy từ bộ đếm trong frame
+    uint32_t lat_min_us;
+    uint32_t lat_max_us;
+    uint64_t lat_sum_us;
+} sync_stats_t;
+
+#define SYNC_REPORT_EVERY    100       // gửi thống kê sang task log mỗi 100 SYNC
+
+static sync_stats_t s_sync_stats;
+static sync_stats_t s_sync_report;     // bản chụp cho task log (s_report_mux)
+static bool         s_sync_seen  = false;
+static uint8_t      s_sync_last  = 0;
+
+// Watchdog lệnh: handler CAN (dispatch task) ghi thời điểm lệnh cuối, esp_timer
+// kiểm tra định kỳ. Thống kê khoảng cách giữa 2 lệnh liên tiếp để chỉnh timeout.
+// s_cmd_lock: quyết định + cập nhật trạng thái lệnh (s_mode, s_applied*, s_wdt_tripped,
+// thời điểm lệnh cuối) và lệnh ra motor đi cùng nhau, giữa handler CAN, watchdog,
+// vòng kín cục bộ và task motor_char.
+#define CMD_GAP_BUCKETS      12        // bucket i: [2^(i-1), 2^i) ms, bucket cuối: >= 1024 ms
+
+typedef struct {
+    uint32_t count;
+    uint32_t gap_min_us;
+    uint32_t gap_max_us;
+    uint64_t gap_sum_us;
+    uint32_t hist[CMD_GAP_BUCKETS];
+    uint32_t trips;
+} cmd_stats_t;
+
+static esp_timer_handle_t s_wdt_timer    = NULL;
+static volatile uint32_t  s_cmd_last_us  = 0;      // 32 bit thấp, ghi/đọc nguyên tử
+static volatile bool      s_cmd_seen     = false;
+static volatile bool      s_wdt_tripped  = false;
+static volatile uint32_t  s_wdt_trips    = 0;
+static int64_t            s_cmd_prev_us  = 0;
+static cmd_stats_t        s_cmd_stats;
+static cmd_stats_t        s_cmd_report;            // bản chụp cho task log (s_report_mux)
+static SemaphoreHandle_t  s_cmd_lock     = NULL;
+static StaticSemaphore_t  s_cmd_lock_buf;
+static portMUX_TYPE       s_report_mux   = portMUX_INITIALIZER_UNLOCKED;
+
+// Latency trace cho frame lệnh có trace (master đo cạnh encoder -> TX xong).
+// Mốc thời gian theo đồng hồ master nên chỉ ghi khi đã đồng bộ (can_time_sync).
+enum { TRACE_CAN_RX = 0, TRACE_PWM, TRACE_N_STAGES };
+static const char *const s_trace_stages[TRACE_N_STAGES] = { "can_rx", "pwm" };
+
+// Log được đẩy sang task ưu tiên thấp, handler CAN không format/UART
+typedef enum {
+    SLAVE_EVT_MOTOR_CMD = 0,
+    SLAVE_EVT_LOOP_ON,
+    SLAVE_EVT_SYNC_STATS,
+    SLAVE_EVT_CMD_STATS,
+    SLAVE_EVT_WDT_TRIP,
+    SLAVE_EVT_WDT_CLEAR,
+    SLAVE_EVT_OVERCURRENT,
+    SLAVE_EVT_MOTOR_CHAR,
+    SLAVE_EVT_OTHER_FRAME,
+} slave_evt_type_t;
+
+typedef struct {
+    slave_evt_type_t type;
+    uint32_t         id;
+    int32_t          value;
+    uint8_t          dlc;
+} slave_evt_t;
+
+#define SLAVE_LOG_QUEUE_LEN   16
+
+static QueueHandle_t     s_log_queue   = NULL;
+static volatile uint32_t s_log_dropped = 0;
+
+static void on_motor_cmd(const twai_message_t *msg, int64_t rx_us, void *arg);
+static void on_motor_packed(const twai_message_t *msg, int64_t rx_us, void *arg);
+static void on_motor_ramp(const twai_message_t *msg, int64_t rx_us, void *arg);
+static void on_motor_char(const twai_message_t *msg, int64_t rx_us, void *arg);
+static void on_sync(const twai_message_t *msg, int64_t rx_us, void *arg);
+static void on_setpoint(const twai_message_t *msg, int64_t rx_us, void *arg);
+static void on_other_frame(const twai_message_t *msg, int64_t rx_us, void *arg);
+static void task_log(void *arg);
+static void task_telemetry(void *arg);
+static void task_motor_char(void *arg);
+static void local_loop_step(void *arg);
+static void cmd_wdt_check(void *arg);
+static void log_event(slave_evt_type_t type, uint32_t id, int32_t value, uint8_t dlc);
 
 // ================== app_main ==================
 
 void app_main(void)
 {
-    ESP_LOGI(TAG, "SLAVE node starting (motor driver only)...");
+    ESP_LOGI(TAG, "SLAVE node %d starting (motor driver only)...", SLAVE_NODE_ID);
 
     // ====== GET PIN FROM HEADER ======
     app_driver_config_t cfg = {
         .motor_pwm_pin      = MOTOR_PWM_PIN,
         .motor_forward_pin  = MOTOR_FWD_PIN,
         .motor_backward_pin = MOTOR_BWD_PIN,
+        .motor_pwm_freq_hz  = MOTOR_PWM_FREQ_HZ,
+        .motor_pwm_resolution = MOTOR_PWM_RES,
+        .motor_dead_time_us = MOTOR_DEAD_TIME_US,
+        .motor_isense_channel = MOTOR_ISENSE_CHANNEL,
+        .motor_sense_mohm   = MOTOR_SENSE_MOHM,
+        .motor_trip_ma      = MOTOR_TRIP_MA,
 
-        .enc_clk_pin        = ENC_CLK_PIN,      // encoder không dùng nữa,
-        .enc_dt_pin         = ENC_DT_PIN,       // nhưng vẫn có thể giữ nguyên
+        .enc_clk_pin        = ENC_CLK_PIN,      // dùng cho vòng kín trên slave
+        .enc_dt_pin         = ENC_DT_PIN,
         .enc_sw_pin         = ENC_SW_PIN,
         .enc_reverse_dir    = ENC_REVERSE_DIR,
         .enc_angle_min      = ENC_ANGLE_MIN,
@@ -38,43 +192,698 @@ void app_main(void)
     };
 
     // ====== INIT HARDWARE ======
-    app_driver_init(&cfg);   // Khởi tạo CAN + motor (+ encoder nếu bạn vẫn để)
+    app_driver_init(&cfg);   // Khởi tạo CAN + motor + encoder
+    s_motor = app_driver_get_motor();
+
+    if (SLAVE_MOTOR_BENCH_ITER) {
+        motor_bench_t b;
+        if (motor_apply_benchmark(s_motor, SLAVE_MOTOR_BENCH_ITER, &b) == ESP_OK) {
+            ESP_LOGI(TAG, "motor_apply: n=%u cycles min/avg/max=%u/%u/%u (max %u us), "
+                          "reversal max %u us",
+                     (unsigned)b.iterations, (unsigned)b.min_cycles, (unsigned)b.avg_cycles,
+                     (unsigned)b.max_cycles, (unsigned)b.max_us, (unsigned)b.switch_max_us);
+        }
+    }
+
+    // ====== Bảng đặc tính motor (NVS) ======
+    esp_err_t nvs_err = nvs_flash_init();
+    if (nvs_err == ESP_ERR_NVS_NO_FREE_PAGES || nvs_err == ESP_ERR_NVS_NEW_VERSION_FOUND) {
+        ESP_ERROR_CHECK(nvs_flash_erase());
+        nvs_err = nvs_flash_init();
+    }
+    ESP_ERROR_CHECK(nvs_err);
+
+    bool char_loaded = motor_char_load(&s_char_tab[0], SLAVE_CHAR_NVS_KEY) == ESP_OK &&
+                       s_char_tab[0].duty_max == DUTY_MAX;
+    if (char_loaded) {
+        ESP_LOGI(TAG, "Motor table loaded: breakaway fwd=%u rev=%u",
+                 s_char_tab[0].breakaway[MOTOR_CHAR_FWD], s_char_tab[0].breakaway[MOTOR_CHAR_REV]);
+    } else {
+        motor_char_default(&s_char_tab[0], DUTY_MAX, DUTY_MIN);
+        ESP_LOGW(TAG, "No motor table, using DUTY_MIN=%d", DUTY_MIN);
+    }
+
+    // ====== PID + vòng kín cục bộ (chỉ chạy khi nhận CAN_ID_SETPOINT) ======
+    pid_config_t pid_cfg = {
+        .gains       = s_pid_gains,
+        .n_gains     = sizeof(s_pid_gains) / sizeof(s_pid_gains[0]),
+        .out_max     = DUTY_MAX,
+        .min_duty    = 0,           // bù ma sát tĩnh nằm trong s_lin
+        .integ_limit = 300,
+        .slew_max    = 2,
+        .deadband    = ANGLE_DEADBAND_DEG,
+    };
+    ESP_ERROR_CHECK(pid_create(&pid_cfg, &s_pid));
+
+    control_loop_config_t loop_cfg = {
+        .period_us  = SLAVE_LOOP_PERIOD_US,
+        .fn         = local_loop_step,
+        .name       = "LOCAL_LOOP",
+        .stack_size = 4096,
+    };
+    s_cmd_lock = xSemaphoreCreateMutexStatic(&s_cmd_lock_buf);
+    ESP_ERROR_CHECK(control_loop_create(&loop_cfg, &s_loop));
+    ESP_ERROR_CHECK(control_loop_start(s_loop));
+
+    // ====== CAN RX dispatch + log / feedback tasks ======
+    s_log_queue = xQueueCreate(SLAVE_LOG_QUEUE_LEN, sizeof(slave_evt_t));
+    xTaskCreate(task_log, "LOG", 3072, NULL, 1, NULL);
+
+    ESP_ERROR_CHECK(can_driver_register_handler(CAN_ID_NODE(CAN_ID_MOTOR_CMD, SLAVE_NODE_ID),
+                                                on_motor_cmd, NULL));
+    ESP_ERROR_CHECK(can_driver_register_handler(CAN_ID_NODE(CAN_ID_SETPOINT, SLAVE_NODE_ID),
+                                                on_setpoint, NULL));
+    ESP_ERROR_CHECK(can_driver_register_handler(CAN_ID_NODE(CAN_ID_MOTOR_RAMP, SLAVE_NODE_ID),
+                                                on_motor_ramp, NULL));
+    ESP_ERROR_CHECK(can_driver_register_handler(CAN_ID_NODE(CAN_ID_MOTOR_CHAR, SLAVE_NODE_ID),
+                                                on_motor_char, NULL));
+    ESP_ERROR_CHECK(can_driver_register_handler(CAN_ID_MOTOR_PACKED, on_motor_packed, NULL));
+    ESP_ERROR_CHECK(can_driver_register_handler(CAN_ID_SYNC, on_sync, NULL));
+    ESP_ERROR_CHECK(can_time_sync_slave_start());
+    ESP_ERROR_CHECK(ltrace_init(s_trace_stages, TRACE_N_STAGES));
+    ESP_ERROR_CHECK(ltrace_start_console());
+    ESP_ERROR_CHECK(can_driver_set_default_handler(on_other_frame, NULL));
+    ESP_ERROR_CHECK(can_driver_start_dispatch(configMAX_PRIORITIES - 3));
+    ESP_ERROR_CHECK(can_driver_start_health_monitor(CAN_HEALTH_DEFAULT_PERIOD_MS,
+                                                    CAN_HEALTH_DEFAULT_LOG_MS));
+
+    xTaskCreate(task_telemetry, "TELEMETRY", 3072, NULL, 3, NULL);
+
+    if (SLAVE_CMD_TIMEOUT_MS) {
+        const esp_timer_create_args_t wdt_args = {
+            .callback = cmd_wdt_check,
+            .name     = "CMD_WDT",
+        };
+        ESP_ERROR_CHECK(esp_timer_create(&wdt_args, &s_wdt_timer));
+        // Kiểm tra 4 lần mỗi timeout: trễ phát hiện tối đa 1.25 x timeout
+        ESP_ERROR_CHECK(esp_timer_start_periodic(s_wdt_timer, SLAVE_CMD_TIMEOUT_MS * 250));
+    }
+
+    if (SLAVE_CHAR_ON_BOOT && !char_loaded) {
+        s_char_busy = true;
+        xTaskCreate(task_motor_char, "MOTOR_CHAR", 4096,
+                    (void *)(uintptr_t)CAN_MOTOR_CHAR_RUN, 2, NULL);
+    }
+
+    ESP_LOGI(TAG, "SLAVE app started (CAN dispatch running)");
+}
+
+// Độ lớn duty (thang DUTY_MAX) -> Q15 sau hạn dòng
+static uint16_t limited_q15(int32_t mag)
+{
+    s_ilimit_applied = s_ilimit_q15;
+    return (uint16_t)(((uint32_t)DUTY_Q15(mag) * s_ilimit_applied) >> 15);
+}
+
+// Duty có dấu (thang DUTY_MAX) sau hạn dòng, cho s_applied_duty; gọi sau limited_q15
+static int16_t limited_signed(int32_t lin)
+{
+    int32_t mag = (int32_t)(((uint32_t)(lin > 0 ? lin : -lin) * s_ilimit_applied) >> 15);
+    return (int16_t)(lin > 0 ? mag : -mag);
+}
+
+// Áp duty có dấu (effort, qua bảng s_lin) lên motor. Sau khi ngắt quá dòng,
+// cầu thả trôi tới lệnh duty 0.
+static void apply_signed_duty(int32_t duty)
+{
+    if (s_char_running) {
+        return;
+    }
+    motor_cmd_t cmd;
+    if (duty == 0) {
+        if (motor_is_tripped(s_motor)) {
+            current_sense_clear_trip();
+        }
+        cmd.mode = SLAVE_STOP_BRAKE ? MOTOR_MODE_BRAKE : MOTOR_MODE_COAST;
+        cmd.duty = SLAVE_STOP_BRAKE ? MOTOR_DUTY_FULL : 0;
+        s_applied_duty = 0;
+    } else {
+        int32_t lin = motor_char_linearize(s_lin, duty);
+        cmd.mode = duty > 0 ? MOTOR_MODE_FORWARD : MOTOR_MODE_REVERSE;
+        cmd.duty = limited_q15(lin > 0 ? lin : -lin);
+        s_applied_duty = limited_signed(lin);
+    }
+    motor_apply(s_motor, &cmd);
+    s_applied = (int16_t)duty;
+}
+
+// Ramp phần cứng tới duty có dấu. Đổi chiều: chuyển sang chiều mới với duty 0
+// (motor_apply lo thả trôi + dead time) rồi ramp lên (LEDC chỉ fade độ lớn duty).
+static void ramp_signed_duty(int32_t duty, uint32_t time_ms)
+{
+    if (s_char_running) {
+        return;
+    }
+    if (time_ms == 0 || (duty == 0 && motor_is_tripped(s_motor))) {
+        apply_signed_duty(duty);
+        return;
+    }
+    if (duty == s_applied && s_ilimit_q15 == s_ilimit_applied) {
+        return;     // frame gửi lại (refresh): không khởi động lại fade đang chạy
+    }
+    if (duty == 0) {
+        motor_ramp_down(s_motor, time_ms);
+        s_applied_duty = 0;
+    } else {
+        bool fwd = duty > 0;
+        if (s_applied != 0 && (s_applied > 0) != fwd) {
+            motor_cmd_t cmd = { .mode = fwd ? MOTOR_MODE_FORWARD : MOTOR_MODE_REVERSE, .duty = 0 };
+            motor_apply(s_motor, &cmd);
+        } else {
+            motor_set_direction(s_motor, fwd);
+        }
+        int32_t lin = motor_char_linearize(s_lin, duty);
+        motor_ramp_to(s_motor, limited_q15(fwd ? lin : -lin), time_ms);
+        s_applied_duty = limited_signed(lin);
+    }
+    s_applied = (int16_t)duty;
+}
+
+// ================== LOCAL LOOP (SLAVE_LOOP_PERIOD_US) ==================
+
+static void local_loop_step(void *arg)
+{
+    (void)arg;
+    if (s_mode != SLAVE_MODE_LOCAL_LOOP) {
+        return;
+    }
+
+    int16_t current = app_driver_get_encoder_angle();
+    int16_t error   = app_driver_angle_error(s_setpoint, current);
+    int32_t out     = pid_update(s_pid, error, app_driver_get_encoder_position());
+
+    // Handler CAN / watchdog đang đổi lệnh: bỏ chu kỳ này, không chặn vòng kín
+    if ((out != s_applied || s_ilimit_q15 != s_ilimit_applied) &&
+        xSemaphoreTake(s_cmd_lock, 0) == pdTRUE) {
+        if (s_mode == SLAVE_MODE_LOCAL_LOOP) {
+            apply_signed_duty(out);
+        }
+        xSemaphoreGive(s_cmd_lock);
+    }
+}
+
+// ================== TASK: TELEMETRY / FEEDBACK (slave -> master) ==================
+
+static void send_telemetry(void)
+{
+    // Timestamp theo đồng hồ master khi đã đồng bộ, để master đo được độ trễ thật
+    int64_t now    = esp_timer_get_time();
+    bool    synced = can_time_sync_valid();
+
+    // Bus lỗi: không RUNNING hoặc đã error passive (TEC/REC >= 128)
+    can_health_t h;
+    bool bus_bad = can_driver_get_health(&h) == ESP_OK &&
+                   (h.state != TWAI_STATE_RUNNING ||
+                    h.tx_error_counter >= 128 || h.rx_error_counter >= 128);
+
+    can_telemetry_t tm = {
+        .time_us  = (uint16_t)(synced ? can_time_sync_to_master(now) : now),
+        .position = (int16_t)app_driver_get_encoder_position(),
+        .duty     = s_applied_duty,
+        .faults   = s_faults | s_fault_events | (synced ? 0 : CAN_FAULT_TIME_UNSYNCED) |
+                    (bus_bad ? CAN_FAULT_BUS : 0) |
+                    (motor_is_tripped(s_motor) ? CAN_FAULT_OVERCURRENT : 0),
+    };
+    int32_t vel = app_driver_get_encoder_velocity();
+    tm.velocity = (int16_t)(vel > INT16_MAX ? INT16_MAX : vel < INT16_MIN ? INT16_MIN : vel);
+
+    if (can_driver_send_telemetry(&tm) == ESP_OK) {
+        portENTER_CRITICAL(&s_fault_mux);
+        s_fault_events &= (uint8_t)~tm.faults | CAN_FAULT_TIME_UNSYNCED;
+        portEXIT_CRITICAL(&s_fault_mux);
+    }
+}
+
+// Dòng motor: hạn dòng mềm, báo ngắt quá dòng, gửi CAN_ID_CURRENT khi send = true
+static void current_update(bool send)
+{
+    static uint32_t trips_seen = 0;
+    current_sense_reading_t r;
+    if (current_sense_get(&r, send) != ESP_OK) {
+        return;     // không đo dòng (MOTOR_ISENSE_CHANNEL < 0)
+    }
+
+    // Vượt hạn: giảm duty theo tỉ lệ hạn / dòng; dưới hạn: nhả dần (1/8 mỗi chu kỳ)
+    uint32_t k = s_ilimit_q15;
+    if (SLAVE_CURRENT_LIMIT_MA && r.filtered_ma > SLAVE_CURRENT_LIMIT_MA) {
+        k = k * SLAVE_CURRENT_LIMIT_MA / (uint32_t)r.filtered_ma;
+    } else {
+        k += (MOTOR_DUTY_FULL - k + 7) >> 3;
+    }
+    s_ilimit_q15 = (uint16_t)k;
+
+    if (r.trips != trips_seen) {
+        trips_seen = r.trips;
+        log_event(SLAVE_EVT_OVERCURRENT, 0, r.peak_ma, 0);
+    }
+
+    if (send) {
+        can_current_t cur = {
+            .current_ma = (uint16_t)(r.filtered_ma > UINT16_MAX ? UINT16_MAX
+                                     : r.filtered_ma < 0 ? 0 : r.filtered_ma),
+            .peak_ma    = (uint16_t)(r.peak_ma > UINT16_MAX ? UINT16_MAX
+                                     : r.peak_ma < 0 ? 0 : r.peak_ma),
+            .trips      = (uint16_t)r.trips,
+            .tripped    = r.tripped,
+        };
+        can_driver_send_current(&cur);
+    }
+}
+
+static void task_telemetry(void *arg)
+{
+    (void)arg;
+    const uint32_t period_ms = SLAVE_TELEMETRY_PERIOD_MS ? SLAVE_TELEMETRY_PERIOD_MS
+                                                         : SLAVE_FEEDBACK_PERIOD_MS;
+    uint32_t   fb_elapsed_ms = 0;
+    uint32_t   cur_count     = 0;
+    TickType_t last_wake     = xTaskGetTickCount();
+
+    while (1) {
+        bool send_cur = false;
+        if (SLAVE_TELEMETRY_PERIOD_MS) {
+            send_telemetry();
+            if (SLAVE_CURRENT_EVERY && ++cur_count >= SLAVE_CURRENT_EVERY) {
+                cur_count = 0;
+                send_cur  = true;
+            }
+        }
+        current_update(send_cur);
+
+        fb_elapsed_ms += period_ms;
+        if (fb_elapsed_ms >= SLAVE_FEEDBACK_PERIOD_MS) {
+            fb_elapsed_ms = 0;
+            if (s_mode == SLAVE_MODE_LOCAL_LOOP) {
+                can_driver_send_feedback(app_driver_get_encoder_angle(), s_applied_duty);
+            }
+        }
+        vTaskDelayUntil(&last_wake, pdMS_TO_TICKS(period_ms));
+    }
+}
 
-    // ====== Create CAN RX Task ======
-    xTaskCreate(task_can_rx, "CAN_RX_TASK", 4096, NULL, 5, NULL);
+// ================== TASK: ĐẶC TÍNH MOTOR (motor_char) ==================
 
-    ESP_LOGI(TAG, "SLAVE app started (CAN RX task running)");
+// Duty thô khi quét: không qua bảng tuyến tính hóa / hạn dòng mềm, ngắt cứng vẫn hoạt động
+static esp_err_t char_apply(int32_t duty, void *ctx)
+{
+    (void)ctx;
+    motor_cmd_t cmd = {
+        .mode = duty > 0 ? MOTOR_MODE_FORWARD : duty < 0 ? MOTOR_MODE_REVERSE : MOTOR_MODE_COAST,
+        .duty = DUTY_Q15(duty > 0 ? duty : -duty),
+    };
+    s_applied_duty = (int16_t)duty;
+    return motor_apply(s_motor, &cmd);
+}
+
+static int32_t char_position(void *ctx)
+{
+    (void)ctx;
+    return app_driver_get_encoder_position();
+}
+
+// Dựng bảng mới ở bản không dùng rồi đổi s_lin; arg = CAN_MOTOR_CHAR_*
+static void task_motor_char(void *arg)
+{
+    uint8_t       cmd  = (uint8_t)(uintptr_t)arg;
+    motor_char_t *next = (s_lin == &s_char_tab[0]) ? &s_char_tab[1] : &s_char_tab[0];
+    esp_err_t     err;
+
+    if (cmd == CAN_MOTOR_CHAR_ERASE) {
+        err = motor_char_erase(SLAVE_CHAR_NVS_KEY);
+        motor_char_default(next, DUTY_MAX, DUTY_MIN);
+    } else {
+        xSemaphoreTake(s_cmd_lock, portMAX_DELAY);
+        s_mode         = SLAVE_MODE_DIRECT;     // dừng vòng kín cục bộ
+        s_char_running = true;
+        s_applied      = 0;
+        s_applied_duty = 0;
+        xSemaphoreGive(s_cmd_lock);
+
+        motor_char_config_t ccfg = {
+            .apply      = char_apply,
+            .position   = char_position,
+            .duty_max   = DUTY_MAX,
+            .max_travel = SLAVE_CHAR_MAX_TRAVEL,
+        };
+        err = motor_char_run(&ccfg, next);
+        s_char_running = false;
+        if (err == ESP_OK && motor_char_save(next, SLAVE_CHAR_NVS_KEY) != ESP_OK) {
+            ESP_LOGW(TAG, "Motor table not saved to NVS, used until reboot");
+        }
+    }
+    if (err == ESP_OK || cmd == CAN_MOTOR_CHAR_ERASE) {
+        s_lin = next;
+    }
+    log_event(SLAVE_EVT_MOTOR_CHAR, cmd, err, 0);
+    s_char_busy = false;
+    vTaskDelete(NULL);
 }
 
-// ================== TASK: CAN RX (nhận lệnh motor) ==================
+// ================== CAN HANDLERS (dispatch task, không log trực tiếp) ==================
 
-void task_can_rx(void *arg)
+static void log_event(slave_evt_type_t type, uint32_t id, int32_t value, uint8_t dlc)
+{
+    slave_evt_t evt = { .type = type, .id = id, .value = value, .dlc = dlc };
+    if (!s_log_queue || xQueueSend(s_log_queue, &evt, 0) != pdTRUE) {
+        s_log_dropped++;
+    }
+}
+
+// Lệnh hợp lệ cho node này vừa tới: nạp lại watchdog, cập nhật thống kê khoảng cách.
+// Gọi khi giữ s_cmd_lock, cùng lần giữ với lệnh ra motor.
+static void cmd_feed(uint32_t id, int64_t rx_us)
+{
+    s_cmd_last_us = (uint32_t)rx_us;
+    s_cmd_seen    = true;
+
+    if (s_wdt_tripped) {
+        s_wdt_tripped = false;
+        portENTER_CRITICAL(&s_fault_mux);
+        s_faults &= (uint8_t)~CAN_FAULT_WATCHDOG;
+        portEXIT_CRITICAL(&s_fault_mux);
+        log_event(SLAVE_EVT_WDT_CLEAR, id, 0, 0);
+    }
+
+    if (s_cmd_prev_us) {
+        uint32_t gap = (uint32_t)(rx_us - s_cmd_prev_us);
+        uint32_t ms  = gap / 1000;
+        unsigned b   = ms ? 32 - (unsigned)__builtin_clz(ms) : 0;
+
+        cmd_stats_t *st = &s_cmd_stats;
+        if (st->count == 0 || gap < st->gap_min_us) st->gap_min_us = gap;
+        if (gap > st->gap_max_us)                   st->gap_max_us = gap;
+        st->gap_sum_us += gap;
+        st->hist[b < CMD_GAP_BUCKETS ? b : CMD_GAP_BUCKETS - 1]++;
+        st->count++;
+
+        if (st->count >= SLAVE_CMD_STATS_EVERY) {
+            portENTER_CRITICAL(&s_report_mux);
+            s_cmd_report       = *st;
+            s_cmd_report.trips = s_wdt_trips;
+            portEXIT_CRITICAL(&s_report_mux);
+            memset(st, 0, sizeof(*st));
+            log_event(SLAVE_EVT_CMD_STATS, id, 0, 0);
+        }
+    }
+    s_cmd_prev_us = rx_us;
+}
+
+// esp_timer: quá SLAVE_CMD_TIMEOUT_MS không có lệnh -> fade phần cứng về 0.
+// Kiểm tra và ngắt dưới s_cmd_lock. Lock đang bận nghĩa là handler đang xử lý một
+// lệnh mới: bỏ lần kiểm tra này, lần sau (1/4 timeout) thấy lệnh đã được nạp lại.
+static void cmd_wdt_check(void *arg)
 {
     (void)arg;
-    twai_message_t msg;
+    if (xSemaphoreTake(s_cmd_lock, 0) != pdTRUE) {
+        return;
+    }
+    uint32_t age = (uint32_t)esp_timer_get_time() - s_cmd_last_us;
+    if (!s_cmd_seen || s_wdt_tripped || s_char_running || age <= SLAVE_CMD_TIMEOUT_MS * 1000u) {
+        xSemaphoreGive(s_cmd_lock);
+        return;
+    }
 
-    ESP_LOGI(TAG, "CAN RX task started, waiting for motor commands...");
+    s_wdt_tripped = true;
+    s_wdt_trips++;
+    s_mode = SLAVE_MODE_DIRECT;     // dừng vòng kín cục bộ ghi duty
+    motor_ramp_down(s_motor, SLAVE_CMD_RAMP_MS);
+    s_applied      = 0;
+    s_applied_duty = 0;
+
+    portENTER_CRITICAL(&s_fault_mux);
+    s_faults |= CAN_FAULT_WATCHDOG;
+    portEXIT_CRITICAL(&s_fault_mux);
+    xSemaphoreGive(s_cmd_lock);
+    log_event(SLAVE_EVT_WDT_TRIP, 0, (int32_t)(age / 1000), 0);
+}
+
+static void on_motor_cmd(const twai_message_t *msg, int64_t rx_us, void *arg)
+{
+    (void)arg;
+    bool dir;
+    uint16_t duty;
+
+    if (can_driver_parse_motor_cmd(msg, &dir, &duty) != ESP_OK) {
+        return;
+    }
+
+    // Frame có trace: dựng lại thời điểm capture (16 bit thấp, giờ master)
+    ltrace_tag_t tag;
+    uint8_t      seq;
+    uint16_t     cap16;
+    bool traced = can_time_sync_valid() &&
+                  can_driver_parse_motor_cmd_trace(msg, &seq, &cap16) == ESP_OK;
+    if (traced) {
+        int64_t rx_m = can_time_sync_to_master(rx_us);
+        ltrace_resume(&tag, seq, rx_m - (uint16_t)((uint16_t)rx_m - cap16));
+        ltrace_mark(&tag, TRACE_CAN_RX, rx_m);
+    }
+
+    xSemaphoreTake(s_cmd_lock, portMAX_DELAY);
+    cmd_feed(msg->identifier, rx_us);
+    s_mode = SLAVE_MODE_DIRECT;
+    int32_t signed_duty = dir ? (int32_t)duty : -(int32_t)duty;
+    apply_signed_duty(signed_duty);
+    xSemaphoreGive(s_cmd_lock);
+    if (traced) {
+        ltrace_mark(&tag, TRACE_PWM, can_time_sync_now());
+    }
+    log_event(SLAVE_EVT_MOTOR_CMD, msg->identifier, signed_duty, msg->data_length_code);
+}
+
+static void on_motor_ramp(const twai_message_t *msg, int64_t rx_us, void *arg)
+{
+    (void)arg;
+    bool     dir;
+    uint16_t duty, ramp_ms;
+
+    if (can_driver_parse_motor_ramp(msg, &dir, &duty, &ramp_ms) != ESP_OK) {
+        return;
+    }
+    xSemaphoreTake(s_cmd_lock, portMAX_DELAY);
+    cmd_feed(msg->identifier, rx_us);
+    s_mode = SLAVE_MODE_DIRECT;
+    int32_t signed_duty = dir ? (int32_t)duty : -(int32_t)duty;
+    ramp_signed_duty(signed_duty, ramp_ms);
+    xSemaphoreGive(s_cmd_lock);
+    log_event(SLAVE_EVT_MOTOR_CMD, msg->identifier, signed_duty, msg->data_length_code);
+}
+
+// Chạy / xóa đặc tính motor trong task riêng (quét mất ~20 s, không chặn dispatch)
+static void on_motor_char(const twai_message_t *msg, int64_t rx_us, void *arg)
+{
+    (void)rx_us;
+    (void)arg;
+    uint8_t cmd;
+
+    if (can_driver_parse_motor_char(msg, &cmd) != ESP_OK ||
+        (cmd != CAN_MOTOR_CHAR_RUN && cmd != CAN_MOTOR_CHAR_ERASE) || s_char_busy) {
+        return;
+    }
+    s_char_busy = true;
+    if (xTaskCreate(task_motor_char, "MOTOR_CHAR", 4096,
+                    (void *)(uintptr_t)cmd, 2, NULL) != pdPASS) {
+        s_char_busy = false;
+    }
+}
+
+// Frame gộp nhiều trục: chỉ lấy slot của node này
+static void on_motor_packed(const twai_message_t *msg, int64_t rx_us, void *arg)
+{
+    (void)arg;
+    int16_t duty;
+    bool    staged;
+
+    if (can_driver_decode_packed(msg, SLAVE_NODE_ID, &duty, &staged) != ESP_OK) {
+        return;
+    }
+    xSemaphoreTake(s_cmd_lock, portMAX_DELAY);
+    cmd_feed(msg->identifier, rx_us);
+    s_mode = SLAVE_MODE_DIRECT;
+    if (staged) {
+        s_staged_duty  = duty;
+        s_staged_valid = true;
+        xSemaphoreGive(s_cmd_lock);
+        return;
+    }
+    apply_signed_duty(duty);
+    xSemaphoreGive(s_cmd_lock);
+    log_event(SLAVE_EVT_MOTOR_CMD, msg->identifier, duty, msg->data_length_code);
+}
+
+// SYNC: áp duty đã stage. ledc_update_duty chốt duty mới ở đầu chu kỳ PWM kế
+// tiếp, nên độ trễ tới chân PWM còn cộng thêm tối đa 1 chu kỳ PWM.
+static void on_sync(const twai_message_t *msg, int64_t rx_us, void *arg)
+{
+    (void)arg;
+    uint8_t counter;
+
+    if (can_driver_parse_sync(msg, &counter) != ESP_OK) {
+        return;
+    }
+    if (s_sync_seen) {
+        uint8_t missed = (uint8_t)(counter - s_sync_last - 1);
+        if (missed) {
+            s_sync_stats.missed += missed;
+            portENTER_CRITICAL(&s_fault_mux);
+            s_fault_events |= CAN_FAULT_SYNC_LOST;
+            portEXIT_CRITICAL(&s_fault_mux);
+        }
+    }
+    s_sync_seen = true;
+    s_sync_last = counter;
+
+    xSemaphoreTake(s_cmd_lock, portMAX_DELAY);
+    if (!s_staged_valid || s_mode != SLAVE_MODE_DIRECT) {
+        xSemaphoreGive(s_cmd_lock);
+        return;
+    }
+    s_staged_valid = false;
+
+    int16_t prev = s_applied;
+    apply_signed_duty(s_staged_duty);
+    xSemaphoreGive(s_cmd_lock);
+    uint32_t lat = (uint32_t)(esp_timer_get_time() - rx_us);
+
+    sync_stats_t *st = &s_sync_stats;
+    if (st->count == 0 || lat < st->lat_min_us) st->lat_min_us = lat;
+    if (lat > st->lat_max_us)                   st->lat_max_us = lat;
+    st->lat_sum_us += lat;
+    st->count++;
+
+    if (s_staged_duty != prev) {
+        log_event(SLAVE_EVT_MOTOR_CMD, msg->identifier, s_staged_duty, msg->data_length_code);
+    }
+    if (st->count >= SYNC_REPORT_EVERY) {
+        portENTER_CRITICAL(&s_report_mux);
+        s_sync_report = *st;
+        portEXIT_CRITICAL(&s_report_mux);
+        memset(st, 0, sizeof(*st));
+        log_event(SLAVE_EVT_SYNC_STATS, msg->identifier, 0, msg->data_length_code);
+    }
+}
+
+static void on_setpoint(const twai_message_t *msg, int64_t rx_us, void *arg)
+{
+    (void)arg;
+    int16_t setpoint;
+
+    if (can_driver_parse_setpoint(msg, &setpoint) != ESP_OK) {
+        return;
+    }
+    xSemaphoreTake(s_cmd_lock, portMAX_DELAY);
+    cmd_feed(msg->identifier, rx_us);
+    s_setpoint = setpoint;
+    bool loop_on = s_mode != SLAVE_MODE_LOCAL_LOOP;
+    if (loop_on) {
+        pid_reset(s_pid, app_driver_get_encoder_position());
+        s_mode = SLAVE_MODE_LOCAL_LOOP;
+    }
+    xSemaphoreGive(s_cmd_lock);
+    if (loop_on) {
+        log_event(SLAVE_EVT_LOOP_ON, msg->identifier, setpoint, msg->data_length_code);
+    }
+}
+
+static void on_other_frame(const twai_message_t *msg, int64_t rx_us, void *arg)
+{
+    (void)rx_us;
+    (void)arg;
+    log_event(SLAVE_EVT_OTHER_FRAME, msg->identifier, 0, msg->data_length_code);
+}
+
+// ================== TASK: LOG (ưu tiên thấp) ==================
+
+static void task_log(void *arg)
+{
+    (void)arg;
+    slave_evt_t evt;
+    uint32_t last_dropped = 0;
 
     while (1) {
-        if (can_driver_receive(&msg, portMAX_DELAY) == ESP_OK) {
-            bool dir;
-            uint16_t duty;
-
-            if (can_driver_parse_motor_cmd(&msg, &dir, &duty) == ESP_OK) {
-                if (duty == 0) {
-                    motor_stop();
-                    ESP_LOGI(TAG, "Motor STOP");
-                } else {
-                    motor_set_direction(dir);
-                    motor_set_speed(duty);
-                    ESP_LOGI(TAG, "Motor CMD: dir=%d, duty=%u",
-                             (int)dir, (unsigned)duty);
+        if (xQueueReceive(s_log_queue, &evt, portMAX_DELAY) != pdTRUE) {
+            continue;
+        }
+        switch (evt.type) {
+        case SLAVE_EVT_MOTOR_CMD:
+            if (evt.value == 0) {
+                ESP_LOGI(TAG, "Motor STOP");
+            } else {
+                ESP_LOGI(TAG, "Motor CMD: dir=%d, duty=%d",
+                         evt.value > 0, (int)(evt.value > 0 ? evt.value : -evt.value));
+            }
+            break;
+        case SLAVE_EVT_LOOP_ON:
+            ESP_LOGI(TAG, "Local loop ON (setpoint=%d)", (int)evt.value);
+            break;
+        case SLAVE_EVT_SYNC_STATS: {
+            portENTER_CRITICAL(&s_report_mux);
+            sync_stats_t st = s_sync_report;
+            portEXIT_CRITICAL(&s_report_mux);
+            if (st.count) {
+                ESP_LOGI(TAG, "SYNC->PWM: n=%u min/avg/max=%u/%u/%u us missed=%u",
+                         (unsigned)st.count, (unsigned)st.lat_min_us,
+                         (unsigned)(st.lat_sum_us / st.count), (unsigned)st.lat_max_us,
+                         (unsigned)st.missed);
+            }
+            break;
+        }
+        case SLAVE_EVT_CMD_STATS: {
+            portENTER_CRITICAL(&s_report_mux);
+            cmd_stats_t st = s_cmd_report;
+            portEXIT_CRITICAL(&s_report_mux);
+            if (!st.count) {
+                break;
+            }
+            // p99 theo histogram: cận trên của bucket chứa lệnh thứ 99%
+            uint32_t need = st.count - st.count / 100, acc = 0;
+            unsigned b = 0;
+            for (; b < CMD_GAP_BUCKETS - 1; b++) {
+                acc += st.hist[b];
+                if (acc >= need) {
+                    break;
                 }
+            }
+            bool last = (b == CMD_GAP_BUCKETS - 1);
+            ESP_LOGI(TAG, "CMD gap: n=%u min/avg/max=%u/%u/%u us p99 %s %u ms "
+                          "(timeout %u ms, trips=%u)",
+                     (unsigned)st.count, (unsigned)st.gap_min_us,
+                     (unsigned)(st.gap_sum_us / st.count), (unsigned)st.gap_max_us,
+                     last ? ">=" : "<", last ? 1u << (b - 1) : 1u << b,
+                     (unsigned)SLAVE_CMD_TIMEOUT_MS, (unsigned)st.trips);
+            break;
+        }
+        case SLAVE_EVT_WDT_TRIP:
+            ESP_LOGW(TAG, "Command watchdog: no command for %d ms, ramping down",
+                     (int)evt.value);
+            break;
+        case SLAVE_EVT_WDT_CLEAR:
+            ESP_LOGI(TAG, "Command watchdog cleared (ID=0x%03X)", (unsigned)evt.id);
+            break;
+        case SLAVE_EVT_MOTOR_CHAR:
+            if (evt.value != ESP_OK) {
+                ESP_LOGE(TAG, "Motor %s failed: %s", evt.id == CAN_MOTOR_CHAR_RUN ? "sweep" : "erase",
+                         esp_err_to_name((esp_err_t)evt.value));
             } else {
-                // Không phải frame MOTOR_CMD, có thể log debug nếu cần
-                ESP_LOGD(TAG, "Received non-motor frame: ID=0x%03X, DLC=%d",
-                         msg.identifier, msg.data_length_code);
+                const motor_char_t *c = s_lin;
+                ESP_LOGI(TAG, "Motor table %s: breakaway fwd=%u rev=%u",
+                         c->measured ? "updated" : "reset", c->breakaway[MOTOR_CHAR_FWD],
+                         c->breakaway[MOTOR_CHAR_REV]);
             }
+            break;
+        case SLAVE_EVT_OVERCURRENT:
+            ESP_LOGE(TAG, "Overcurrent trip (peak %d mA > %d mA), bridge off until duty 0",
+                     (int)evt.value, MOTOR_TRIP_MA);
+            break;
+        default:
+            // Không phải frame MOTOR_CMD / SETPOINT, có thể log debug nếu cần
+            ESP_LOGD(TAG, "Received non-motor frame: ID=0x%03X, DLC=%d",
+                     (unsigned)evt.id, evt.dlc);
+            break;
+        }
+        if (s_log_dropped != last_dropped) {
+            last_dropped = s_log_dropped;
+            ESP_LOGW(TAG, "Log queue full, %u events dropped", (unsigned)last_dropped);
         }
     }
 }
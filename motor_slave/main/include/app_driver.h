@@ -2,6 +2,7 @@
 #define __APP_DRIVER_H__
 
 #include "esp_err.h"
+#include "motor_driver.h"
 #include <stdint.h>
 
 // ================== BOARD PIN CONFIG ==================
@@ -9,6 +10,36 @@
 #define MOTOR_PWM_PIN       1
 #define MOTOR_FWD_PIN       5
 #define MOTOR_BWD_PIN       6
+// PWM: 20 kHz trên ngưỡng nghe (5 kHz cũ kêu rít). L298N chuyển mạch chậm (~1-2 µs)
+// nên tổn hao chuyển mạch tăng theo tần số; hạ xuống nếu driver nóng.
+#define MOTOR_PWM_FREQ_HZ   20000
+#define MOTOR_PWM_RES       0       // bit duty, 0 = cao nhất cho tần số (11 bit @ 20 kHz)
+#define MOTOR_DEAD_TIME_US  100     // thả trôi khi đổi chiều / thoát hãm
+#define SLAVE_STOP_BRAKE    0       // duty 0: 1 = hãm chủ động (IN1 = IN2 = 1), 0 = thả trôi
+#define SLAVE_MOTOR_BENCH_ITER 500  // đo motor_apply lúc khởi động (0 = bỏ qua)
+
+// -------- Dòng motor (điện trở sense của L298N -> ADC1) --------
+// ADC continuous lấy mẫu đồng bộ với PWM (số mẫu nguyên trên mỗi chu kỳ PWM),
+// ISR của ADC cắt cầu ngay khi dòng trung bình frame vượt MOTOR_TRIP_MA.
+#define MOTOR_ISENSE_CHANNEL   0       // ADC1_CH0 = GPIO0, -1 = không đo dòng
+#define MOTOR_SENSE_MOHM       500     // 0.5 Ω (tính cả hệ số khuếch đại nếu có)
+#define MOTOR_ISENSE_PERIODS   20      // chu kỳ PWM mỗi frame (1 ms @ 20 kHz)
+#define MOTOR_TRIP_MA          2500    // ngắt cứng, chỉ gỡ bằng lệnh duty 0
+#define MOTOR_ISENSE_FILTER    3       // IIR 1/8 mỗi frame
+#define SLAVE_CURRENT_LIMIT_MA 1500    // hạn dòng mềm: giảm duty tỉ lệ, 0 = tắt
+// CAN_ID_CURRENT gửi mỗi SLAVE_CURRENT_EVERY lần telemetry (0 = không gửi)
+#define SLAVE_CURRENT_EVERY    5
+
+// -------- Đặc tính motor (motor_char, bảng lưu trong NVS) --------
+// CAN_MOTOR_CHAR_RUN: quét duty theo encoder, tìm duty khởi động mỗi chiều và
+// dựng bảng effort -> duty; mọi lệnh duty (master và vòng kín cục bộ) đi qua bảng.
+// Chưa có bảng: bù bằng DUTY_MIN cố định như trước.
+#define SLAVE_CHAR_NVS_KEY     "axis"
+#define SLAVE_CHAR_ON_BOOT     0       // 1 = tự quét lúc khởi động nếu NVS chưa có bảng
+// Hành trình tối đa khi quét, tick tính từ vị trí bắt đầu (1 tick = 1 đơn vị góc):
+// 1/4 dải ENC_ANGLE_MIN..MAX, đặt trục gần giữa hành trình trước khi quét để không
+// chạm cữ cơ khí. Vượt giới hạn: dừng quét, giữ bảng cũ. 0 = trục quay tự do.
+#define SLAVE_CHAR_MAX_TRAVEL  ((ENC_ANGLE_MAX - ENC_ANGLE_MIN) / 4)
 
 // -------- Encoder pins --------
 #define ENC_CLK_PIN         7
@@ -18,15 +49,48 @@
 #define ENC_ANGLE_MIN       0
 #define ENC_ANGLE_MAX       180
 
+// -------- Vòng kín trên slave (CAN_ID_SETPOINT) --------
+#define SLAVE_LOOP_PERIOD_US      1000    // 1 kHz
+#define SLAVE_FEEDBACK_PERIOD_MS  20      // CAN_ID_FEEDBACK về master
+
+// -------- Telemetry (CAN_ID_TELEMETRY, gửi ở mọi chế độ) --------
+// Bội số của tick FreeRTOS (10 ms), < 65 ms để master mở rộng được wrap 16-bit.
+// 0 = tắt telemetry.
+#define SLAVE_TELEMETRY_PERIOD_MS 10      // 100 Hz
+
+// -------- Watchdog lệnh (master chết / mất bus) --------
+// Không nhận lệnh hợp lệ (MOTOR_CMD, frame gộp, SETPOINT) trong SLAVE_CMD_TIMEOUT_MS:
+// fade duty về 0 trong SLAVE_CMD_RAMP_MS và bật CAN_FAULT_WATCHDOG.
+// Master gửi lại lệnh ít nhất mỗi 50 ms. 0 = tắt watchdog.
+#define SLAVE_CMD_TIMEOUT_MS      250
+#define SLAVE_CMD_RAMP_MS         300
+#define SLAVE_CMD_STATS_EVERY     1000    // log thống kê khoảng cách lệnh mỗi 1000 lệnh
+
 // -------- CAN (ESP32C3 -> MCP2551) --------
+// Node ID của slave (0..15). Mỗi trục trên bus cần một node ID riêng,
+// node 0 dùng đúng ID gốc 0x101..0x103 như bản 1 trục.
+#define SLAVE_NODE_ID       0
 #define CAN_TX_PIN          GPIO_NUM_2
 #define CAN_RX_PIN          GPIO_NUM_3
+// Dò bitrate của bus (listen-only) trước khi init, tối đa SLAVE_CAN_AUTO_BAUD_MS;
+// hết thời gian thì dùng CONFIG_CAN_DRIVER_BITRATE. 0 = không dò.
+// Chỉ bật khi bus có >= 3 node: slave đang dò không ACK, nên cần thêm một node
+// khác ACK frame của master. Bus 1 master + 1 slave: frame không bao giờ hợp lệ,
+// slave chờ hết thời gian và TEC của master tăng dần tới error passive.
+#define SLAVE_CAN_AUTO_BAUD_MS    0
+#define SLAVE_CAN_AUTO_BAUD_WIN   100     // ms nghe mỗi bitrate (> chu kỳ TIME_SYNC)
 
 // ================== DRIVER CONFIG STRUCT ==================
 typedef struct {
     int motor_pwm_pin;
     int motor_forward_pin;
     int motor_backward_pin;
+    uint32_t motor_pwm_freq_hz;
+    uint8_t  motor_pwm_resolution;
+    uint32_t motor_dead_time_us;
+    int      motor_isense_channel;   // -1 = không đo dòng
+    uint32_t motor_sense_mohm;
+    uint32_t motor_trip_ma;
 
     int enc_clk_pin;
     int enc_dt_pin;
@@ -46,9 +110,29 @@ typedef struct {
  */
 esp_err_t app_driver_init(const app_driver_config_t *cfg);
 
+/**
+ * @brief Handle motor của board (NULL trước app_driver_init)
+ */
+motor_handle_t app_driver_get_motor(void);
+
 /**
  * @brief Đọc góc hiện tại từ encoder (đơn vị độ)
  */
 int16_t app_driver_get_encoder_angle(void);
 
+/**
+ * @brief Vị trí nhiều vòng của encoder (tick, không wrap)
+ */
+int32_t app_driver_get_encoder_position(void);
+
+/**
+ * @brief Vận tốc encoder (tick/s)
+ */
+int32_t app_driver_get_encoder_velocity(void);
+
+/**
+ * @brief Sai số target - current theo đường ngắn nhất trên vòng encoder
+ */
+int16_t app_driver_angle_error(int16_t target, int16_t current);
+
 #endif // __APP_DRIVER_H__
@@ -0,0 +1,66 @@
+/*
+ * Tool host: bảng số trục tối đa theo bitrate và tần số vòng control.
+ *
+ * Build (trên PC, từ thư mục gốc repo):
+ *   gcc -O2 -Icomponents/can_driver/include -o can_bus_load \
+ *       tools/can_bus_load.c components/can_driver/can_bus_load.c
+ *
+ * Dùng:
+ *   ./can_bus_load [axes_per_frame] [cmd_dlc] [feedback_hz] [load_pct]
+ *   mặc định: 1 trục/frame, DLC 3 (CAN_ID_MOTOR_CMD), feedback 50 Hz, tải 70%
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "can_bus_load.h"
+
+static const uint32_t s_bitrates[] = { 125000, 250000, 500000, 800000, 1000000 };
+static const uint32_t s_loop_hz[]  = { 100, 200, 500, 1000, 2000 };
+
+#define ARRAY_LEN(a)  (sizeof(a) / sizeof((a)[0]))
+
+int main(int argc, char **argv)
+{
+    can_bus_load_cfg_t cfg = {
+        .axes_per_frame = 1,
+        .cmd_dlc        = 3,
+        .feedback_hz    = 50,       // SLAVE_FEEDBACK_PERIOD_MS = 20
+        .feedback_dlc   = 4,
+        .extended       = false,
+    };
+    uint32_t load_pct = 70;
+
+    if (argc > 1) cfg.axes_per_frame = (uint8_t)atoi(argv[1]);
+    if (argc > 2) cfg.cmd_dlc        = (uint8_t)atoi(argv[2]);
+    if (argc > 3) cfg.feedback_hz    = (uint32_t)atoi(argv[3]);
+    if (argc > 4) load_pct           = (uint32_t)atoi(argv[4]);
+
+    if (cfg.axes_per_frame == 0 || cfg.cmd_dlc > 8 || load_pct == 0 || load_pct > 100) {
+        fprintf(stderr, "usage: %s [axes_per_frame] [cmd_dlc] [feedback_hz] [load_pct]\n", argv[0]);
+        return 1;
+    }
+
+    printf("cmd frame: %u axes/frame, DLC %u (%u bit worst-case)\n",
+           cfg.axes_per_frame, cfg.cmd_dlc, can_frame_bits_max(cfg.cmd_dlc, false));
+    printf("feedback : %u Hz/axis, DLC %u (%u bit worst-case)\n",
+           cfg.feedback_hz, cfg.feedback_dlc, can_frame_bits_max(cfg.feedback_dlc, false));
+    printf("max axes at <= %u%% bus load:\n\n", load_pct);
+
+    printf("%10s", "loop Hz");
+    for (size_t b = 0; b < ARRAY_LEN(s_bitrates); b++) {
+        printf("%10u", s_bitrates[b] / 1000);
+    }
+    printf("  (kbit/s)\n");
+
+    for (size_t l = 0; l < ARRAY_LEN(s_loop_hz); l++) {
+        cfg.loop_hz = s_loop_hz[l];
+        printf("%10u", cfg.loop_hz);
+        for (size_t b = 0; b < ARRAY_LEN(s_bitrates); b++) {
+            cfg.bitrate = s_bitrates[b];
+            printf("%10u", can_bus_load_max_axes(&cfg, load_pct * 10));
+        }
+        printf("\n");
+    }
+    return 0;
+}
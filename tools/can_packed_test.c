@@ -0,0 +1,249 @@
+/*
+ * Tool host: test mã hoá/giải mã CAN_ID_MOTOR_PACKED (components/can_driver/can_packed.c).
+ *
+ * Kiểm tra:
+ *   - round-trip mọi duty trong [-1024, 1023] ở mọi slot, với mọi first_node / count / staged
+ *     (duty ngoài [-1023, 1023] bị kẹp, CAN_PACKED_DUTY_KEEP -> ESP_ERR_NOT_FOUND)
+ *   - node nằm ngoài frame -> ESP_ERR_NOT_FOUND
+ *   - can_driver_merge_packed: slot KEEP của frame mới lấy duty của frame cũ cùng header
+ *   - frame sai (DLC, count, ID, extd/rtr) -> ESP_FAIL, tham số encode sai -> ESP_ERR_INVALID_ARG
+ *
+ * Build (trên PC, từ thư mục gốc repo):
+ *   gcc -O2 -Itools/host -Icomponents/can_driver/include \
+ *       -o can_packed_test tools/can_packed_test.c components/can_driver/can_packed.c
+ *
+ * Dùng:
+ *   ./can_packed_test        trả về 0 nếu mọi trường hợp đạt
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "can_driver.h"
+
+static unsigned s_checks;
+static unsigned s_fails;
+
+#define CHECK(cond, ...)                                   \
+    do {                                                   \
+        s_checks++;                                        \
+        if (!(cond)) {                                     \
+            if (s_fails++ < 20) {                          \
+                printf("FAIL %s:%d: ", __FILE__, __LINE__); \
+                printf(__VA_ARGS__);                       \
+                printf("\n");                              \
+            }                                              \
+        }                                                  \
+    } while (0)
+
+static int16_t expected(int16_t d)
+{
+    if (d == CAN_PACKED_DUTY_KEEP)  return d;
+    if (d > CAN_PACKED_DUTY_MAX)    return CAN_PACKED_DUTY_MAX;
+    if (d < -CAN_PACKED_DUTY_MAX)   return -CAN_PACKED_DUTY_MAX;
+    return d;
+}
+
+// Giải mã mọi node 0..CAN_MAX_NODES-1 và so với duty[] đã gửi
+static void check_frame(const twai_message_t *msg, uint8_t first, const int16_t *duty,
+                        size_t count, bool staged)
+{
+    for (uint8_t node = 0; node < CAN_MAX_NODES; node++) {
+        int16_t got = 0x7FFF;
+        bool    got_staged = !staged;
+        esp_err_t err = can_driver_decode_packed(msg, node, &got, &got_staged);
+
+        if (node < first || node >= first + count) {
+            CHECK(err == ESP_ERR_NOT_FOUND, "first %u count %u node %u ngoài frame: err %d",
+                  first, (unsigned)count, node, err);
+            continue;
+        }
+        int16_t want = expected(duty[node - first]);
+        if (want == CAN_PACKED_DUTY_KEEP) {
+            CHECK(err == ESP_ERR_NOT_FOUND, "first %u count %u node %u KEEP: err %d",
+                  first, (unsigned)count, node, err);
+            continue;
+        }
+        CHECK(err == ESP_OK && got == want && got_staged == staged,
+              "first %u count %u staged %d node %u: gửi %d, nhận %d (staged %d), err %d",
+              first, (unsigned)count, staged, node, duty[node - first], got, got_staged, err);
+    }
+}
+
+static void test_round_trip(void)
+{
+    for (uint8_t first = 0; first < CAN_MAX_NODES; first++) {
+        for (size_t count = 1; count <= CAN_PACKED_MAX_AXES && first + count <= CAN_MAX_NODES;
+             count++)
+        {
+            for (int staged = 0; staged <= 1; staged++) {
+                for (int d = CAN_PACKED_DUTY_KEEP; d <= CAN_PACKED_DUTY_MAX; d++) {
+                    for (size_t slot = 0; slot < count; slot++) {
+                        // Các slot còn lại nhận giá trị khác nhau để bắt lỗi lệch bit giữa slot
+                        int16_t duty[CAN_PACKED_MAX_AXES];
+                        for (size_t k = 0; k < count; k++) {
+                            duty[k] = (int16_t)(((d + 2048 + 389 * (int)(k + 1)) % 2047) - 1023);
+                        }
+                        duty[slot] = (int16_t)d;
+
+                        twai_message_t msg;
+                        esp_err_t err = can_driver_encode_packed(&msg, first, duty, count, staged);
+                        CHECK(err == ESP_OK, "encode first %u count %u: err %d",
+                              first, (unsigned)count, err);
+                        CHECK(msg.identifier == CAN_ID_MOTOR_PACKED && !msg.extd && !msg.rtr &&
+                              msg.data_length_code == (8 + 11 * count + 7) / 8,
+                              "count %u: id 0x%03x dlc %u", (unsigned)count,
+                              (unsigned)msg.identifier, msg.data_length_code);
+                        check_frame(&msg, first, duty, count, staged);
+                    }
+                }
+            }
+        }
+    }
+}
+
+static void test_clamp(void)
+{
+    static const int16_t in[] = { 1024, 2000, INT16_MAX, -1025, -2000, INT16_MIN };
+    for (size_t i = 0; i < sizeof(in) / sizeof(in[0]); i++) {
+        twai_message_t msg;
+        CHECK(can_driver_encode_packed(&msg, 3, &in[i], 1, false) == ESP_OK, "encode %d", in[i]);
+        check_frame(&msg, 3, &in[i], 1, false);
+    }
+}
+
+static void test_encode_invalid(void)
+{
+    twai_message_t msg;
+    int16_t duty[CAN_PACKED_MAX_AXES + 1] = {0};
+
+    CHECK(can_driver_encode_packed(NULL, 0, duty, 1, false) == ESP_ERR_INVALID_ARG, "msg NULL");
+    CHECK(can_driver_encode_packed(&msg, 0, NULL, 1, false) == ESP_ERR_INVALID_ARG, "duty NULL");
+    CHECK(can_driver_encode_packed(&msg, 0, duty, 0, false) == ESP_ERR_INVALID_ARG, "count 0");
+    CHECK(can_driver_encode_packed(&msg, 0, duty, CAN_PACKED_MAX_AXES + 1, false)
+          == ESP_ERR_INVALID_ARG, "count > max");
+    CHECK(can_driver_encode_packed(&msg, CAN_MAX_NODES - 1, duty, 2, false)
+          == ESP_ERR_INVALID_ARG, "vượt CAN_MAX_NODES");
+    CHECK(can_driver_encode_packed(&msg, CAN_MAX_NODES, duty, 1, false)
+          == ESP_ERR_INVALID_ARG, "first_node >= CAN_MAX_NODES");
+}
+
+// Frame mới thay frame cùng header trong hàng đợi TX: slot KEEP lấy duty của frame cũ
+static void test_merge(void)
+{
+    for (uint8_t first = 0; first < CAN_MAX_NODES; first++) {
+        for (size_t count = 1; count <= CAN_PACKED_MAX_AXES && first + count <= CAN_MAX_NODES;
+             count++)
+        {
+            // Mọi tổ hợp slot KEEP trong frame cũ / frame mới
+            for (unsigned keep_old = 0; keep_old < (1u << count); keep_old++) {
+                for (unsigned keep_new = 0; keep_new < (1u << count); keep_new++) {
+                    int16_t d_old[CAN_PACKED_MAX_AXES], d_new[CAN_PACKED_MAX_AXES];
+                    int16_t want[CAN_PACKED_MAX_AXES];
+                    for (size_t k = 0; k < count; k++) {
+                        d_old[k] = (keep_old >> k) & 1 ? CAN_PACKED_DUTY_KEEP : (int16_t)(100 * k - 300);
+                        d_new[k] = (keep_new >> k) & 1 ? CAN_PACKED_DUTY_KEEP : (int16_t)(-77 * k + 500);
+                        want[k]  = (keep_new >> k) & 1 ? d_old[k] : d_new[k];
+                    }
+                    twai_message_t older, newer;
+                    can_driver_encode_packed(&older, first, d_old, count, true);
+                    can_driver_encode_packed(&newer, first, d_new, count, true);
+                    esp_err_t err = can_driver_merge_packed(&newer, &older);
+                    CHECK(err == ESP_OK, "merge first %u count %u: err %d",
+                          first, (unsigned)count, err);
+                    check_frame(&newer, first, want, count, true);
+                }
+            }
+        }
+    }
+
+    // Khác header (node đầu / số slot / cờ staged) hoặc không phải frame gộp: không gộp
+    static const int16_t duty[2] = { 10, 20 };
+    twai_message_t a, b;
+    can_driver_encode_packed(&a, 0, duty, 2, false);
+    can_driver_encode_packed(&b, 1, duty, 2, false);
+    CHECK(can_driver_merge_packed(&a, &b) == ESP_ERR_INVALID_ARG, "merge khác first_node");
+    can_driver_encode_packed(&b, 0, duty, 2, true);
+    CHECK(can_driver_merge_packed(&a, &b) == ESP_ERR_INVALID_ARG, "merge khác staged");
+    can_driver_encode_packed(&b, 0, duty, 1, false);
+    CHECK(can_driver_merge_packed(&a, &b) == ESP_ERR_INVALID_ARG, "merge khác count");
+    b = a;
+    b.identifier = CAN_ID_MOTOR_CMD;
+    CHECK(can_driver_merge_packed(&a, &b) == ESP_ERR_INVALID_ARG, "merge khác ID");
+    CHECK(can_driver_merge_packed(NULL, &b) == ESP_ERR_INVALID_ARG, "merge NULL");
+}
+
+static void expect_fail(const twai_message_t *msg, const char *what)
+{
+    for (uint8_t node = 0; node < CAN_MAX_NODES; node++) {
+        int16_t d = 0;
+        esp_err_t err = can_driver_decode_packed(msg, node, &d, NULL);
+        CHECK(err == ESP_FAIL, "%s, node %u: err %d", what, node, err);
+    }
+}
+
+static void test_decode_malformed(void)
+{
+    static const int16_t duty[CAN_PACKED_MAX_AXES] = { 100, -200, 300, -400, 500 };
+    twai_message_t good, msg;
+
+    for (size_t count = 1; count <= CAN_PACKED_MAX_AXES; count++) {
+        CHECK(can_driver_encode_packed(&good, 0, duty, count, false) == ESP_OK, "encode");
+
+        msg = good;
+        msg.data_length_code = 0;
+        expect_fail(&msg, "DLC 0");
+
+        msg = good;
+        msg.data_length_code = 9;
+        expect_fail(&msg, "DLC 9");
+
+        // DLC không đủ chỗ cho count slot
+        msg = good;
+        msg.data_length_code = (uint8_t)((8 + 11 * count - 1) / 8);
+        if (msg.data_length_code > 0) {
+            expect_fail(&msg, "DLC ngắn hơn count");
+        }
+
+        msg = good;
+        msg.identifier = CAN_ID_MOTOR_PACKED + 1;
+        expect_fail(&msg, "sai ID");
+
+        msg = good;
+        msg.extd = 1;
+        expect_fail(&msg, "extd");
+
+        msg = good;
+        msg.rtr = 1;
+        expect_fail(&msg, "rtr");
+    }
+
+    // count trong header = 0 hoặc > CAN_PACKED_MAX_AXES (trường 3 bit), frame đủ 8 byte
+    for (uint8_t c = 0; c < 8; c++) {
+        if (c >= 1 && c <= CAN_PACKED_MAX_AXES) {
+            continue;
+        }
+        memset(&msg, 0, sizeof(msg));
+        msg.identifier       = CAN_ID_MOTOR_PACKED;
+        msg.data_length_code = 8;
+        msg.data[0]          = (uint8_t)(c << 4);
+        expect_fail(&msg, "count ngoài [1, CAN_PACKED_MAX_AXES]");
+    }
+
+    int16_t d;
+    CHECK(can_driver_decode_packed(NULL, 0, &d, NULL) == ESP_ERR_INVALID_ARG, "msg NULL");
+    CHECK(can_driver_decode_packed(&good, 0, NULL, NULL) == ESP_ERR_INVALID_ARG, "duty NULL");
+}
+
+int main(void)
+{
+    test_round_trip();
+    test_clamp();
+    test_encode_invalid();
+    test_merge();
+    test_decode_malformed();
+
+    printf("%u checks, %u fails: %s\n", s_checks, s_fails, s_fails ? "FAIL" : "OK");
+    return s_fails ? 1 : 0;
+}
@@ -0,0 +1,42 @@
+/*
+ * Stub driver/twai.h cho tool host: chỉ các kiểu mà can_driver.h dùng.
+ * Bố cục twai_message_t giống ESP-IDF (legacy TWAI driver).
+ */
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef int      gpio_num_t;
+typedef uint32_t TickType_t;
+typedef uint32_t UBaseType_t;
+
+typedef enum {
+    TWAI_STATE_STOPPED,
+    TWAI_STATE_RUNNING,
+    TWAI_STATE_BUS_OFF,
+    TWAI_STATE_RECOVERING,
+} twai_state_t;
+
+typedef struct {
+    uint32_t acceptance_code;
+    uint32_t acceptance_mask;
+    bool     single_filter;
+} twai_filter_config_t;
+
+typedef struct {
+    union {
+        struct {
+            uint32_t extd: 1;
+            uint32_t rtr: 1;
+            uint32_t ss: 1;
+            uint32_t self: 1;
+            uint32_t dlc_non_comp: 1;
+            uint32_t reserved: 27;
+        };
+        uint32_t flags;
+    };
+    uint32_t identifier;
+    uint8_t  data_length_code;
+    uint8_t  data[8];
+} twai_message_t;
@@ -0,0 +1,153 @@
+/*
+ * Tool host: stress test sequence counter của encoder_driver (ky040_seqlock.h).
+ * 1 thread giả lập ISR encoder ghi ticks / position / last_edge_us / dir và
+ * vòng timestamp cạnh, nhiều thread reader chép snapshot như _read_snapshot /
+ * _read_edges rồi kiểm tra mọi trường thuộc cùng một lần ghi.
+ *
+ * Build (trên PC, từ thư mục gốc repo):
+ *   gcc -O2 -pthread -Icomponents/encoder_driver -o ky040_seqlock_stress \
+ *       tools/ky040_seqlock_stress.c
+ *
+ * Dùng:
+ *   ./ky040_seqlock_stress [writes] [readers] [unsafe]
+ *   mặc định: 20000000 lần ghi, 3 reader. "unsafe" bỏ bước retry để thấy test
+ *   bắt được snapshot rách (kỳ vọng báo lỗi, cần máy nhiều lõi).
+ *   Trả về 0 nếu không có snapshot rách.
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ky040_seqlock.h"
+
+#define SPAN        181                 // ENC_ANGLE_MIN..ENC_ANGLE_MAX = 0..180
+#define EDGE_RING   8
+#define EDGE_BASE   0x123456789LL       // > 32 bit: tách được int64 bị rách
+#define EDGE_STEP   997
+
+// Cùng bố cục các trường được bảo vệ trong struct ky040_encoder
+typedef struct {
+    volatile uint32_t seq;
+    volatile int32_t  ticks;
+    volatile int64_t  position;
+    volatile int64_t  last_edge_us;
+    volatile int8_t   last_dir;
+    volatile uint32_t edge_us[EDGE_RING];
+    volatile uint8_t  edge_head;
+} enc_t;
+
+static enc_t    s_enc;
+static uint64_t s_writes  = 20000000;
+static int      s_unsafe  = 0;
+static volatile int s_done = 0;
+
+typedef struct {
+    uint64_t reads;
+    uint64_t retries;
+    uint64_t torn;
+    uint64_t backwards;
+} reader_stats_t;
+
+static inline int8_t dir_of(int64_t n) { return (n & 1) ? 1 : -1; }
+
+// Giả lập ky040_isr_clk: lần ghi thứ n
+static void *writer(void *arg)
+{
+    (void)arg;
+    for (int64_t n = 1; n <= (int64_t)s_writes; n++) {
+        uint8_t head = (s_enc.edge_head + 1) & (EDGE_RING - 1);
+        int64_t now  = EDGE_BASE + n * EDGE_STEP;
+        ky040_seq_write_begin(&s_enc.seq);
+        s_enc.ticks        = (int32_t)(n % SPAN);
+        s_enc.position     = n;
+        s_enc.last_edge_us = now;
+        s_enc.last_dir     = dir_of(n);
+        s_enc.edge_us[head] = (uint32_t)now;
+        s_enc.edge_head    = head;
+        ky040_seq_write_end(&s_enc.seq);
+    }
+    s_done = 1;
+    return NULL;
+}
+
+static void *reader(void *arg)
+{
+    reader_stats_t *st   = (reader_stats_t *)arg;
+    int64_t         last = 0;
+
+    while (!s_done) {
+        int32_t  ticks;
+        int64_t  pos, edge;
+        int8_t   dir;
+        uint32_t ring[EDGE_RING];
+        uint32_t s0;
+        do {
+            s0    = ky040_seq_read_begin(&s_enc.seq);
+            ticks = s_enc.ticks;
+            pos   = s_enc.position;
+            edge  = s_enc.last_edge_us;
+            dir   = s_enc.last_dir;
+            uint8_t head = s_enc.edge_head;
+            for (int i = 0; i < EDGE_RING; i++) {
+                ring[i] = s_enc.edge_us[(head - i) & (EDGE_RING - 1)];
+            }
+            if (s_unsafe) break;
+        } while (ky040_seq_read_retry(&s_enc.seq, s0) && ++st->retries);
+
+        st->reads++;
+        if (pos == 0) continue;     // chưa có lần ghi nào
+
+        bool ok = ticks == (int32_t)(pos % SPAN) &&
+                  edge  == EDGE_BASE + pos * EDGE_STEP &&
+                  dir   == dir_of(pos);
+        for (int i = 0; ok && i < EDGE_RING && i < pos; i++) {
+            ok = ring[i] == (uint32_t)(EDGE_BASE + (pos - i) * EDGE_STEP);
+        }
+        if (!ok) {
+            if (st->torn++ < 3) {
+                fprintf(stderr, "torn snapshot: pos=%lld ticks=%d edge=%lld dir=%d\n",
+                        (long long)pos, ticks, (long long)edge, dir);
+            }
+        }
+        if (pos < last) st->backwards++;
+        last = pos;
+    }
+    return NULL;
+}
+
+int main(int argc, char **argv)
+{
+    int n_readers = 3;
+    if (argc > 1) s_writes  = strtoull(argv[1], NULL, 10);
+    if (argc > 2) n_readers = atoi(argv[2]);
+    if (argc > 3) s_unsafe  = strcmp(argv[3], "unsafe") == 0;
+    if (s_writes == 0 || n_readers <= 0 || n_readers > 16) {
+        fprintf(stderr, "usage: %s [writes] [readers] [unsafe]\n", argv[0]);
+        return 2;
+    }
+
+    pthread_t      rt[16], wt;
+    reader_stats_t st[16];
+    memset(st, 0, sizeof(st));
+
+    for (int i = 0; i < n_readers; i++) {
+        pthread_create(&rt[i], NULL, reader, &st[i]);
+    }
+    pthread_create(&wt, NULL, writer, NULL);
+    pthread_join(wt, NULL);
+
+    uint64_t torn = 0, backwards = 0;
+    for (int i = 0; i < n_readers; i++) {
+        pthread_join(rt[i], NULL);
+        printf("reader %d: reads=%llu retries=%llu torn=%llu backwards=%llu\n", i,
+               (unsigned long long)st[i].reads, (unsigned long long)st[i].retries,
+               (unsigned long long)st[i].torn, (unsigned long long)st[i].backwards);
+        torn      += st[i].torn;
+        backwards += st[i].backwards;
+    }
+    printf("%llu writes, %s\n", (unsigned long long)s_writes,
+           torn || backwards ? "FAIL" : "OK");
+    return torn || backwards ? 1 : 0;
+}
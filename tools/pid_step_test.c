@@ -0,0 +1,148 @@
+/*
+ * Tool host: test đáp ứng bước của pid_controller với bảng gain của master
+ * (motor_master/main/include/master_pid.h) trên mô hình motor bậc 1 có ma sát.
+ *
+ * Mô hình (bước 1 ms, PID chạy mỗi CONTROL_PERIOD_US):
+ *   - effort -> duty như bảng mặc định trên slave (DUTY_MIN 250 của slave, chưa có motor_char)
+ *   - ma sát tĩnh: trục đứng yên tới khi |duty| > PLANT_BREAKAWAY
+ *   - vận tốc bám PLANT_GAIN * (|duty| - PLANT_COULOMB) với hằng số thời gian PLANT_TAU_MS
+ *   - encoder 1 tick = 1 độ, đọc lại ở đầu mỗi chu kỳ control
+ *
+ * Mỗi bước chạy 2 lần: khâu D từ sai phân vị trí (pid_update) và từ vận tốc đo
+ * (pid_update_rate, như control_step trên master).
+ *
+ * Build (trên PC, từ thư mục gốc repo):
+ *   gcc -O2 -Itools/host -Icomponents/pid_controller/include -Imotor_master/main/include \
+ *       -o pid_step_test tools/pid_step_test.c components/pid_controller/pid_controller.c
+ *
+ * Dùng:
+ *   ./pid_step_test          trả về 0 nếu mọi bước đạt giới hạn overshoot / settling
+ */
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "pid_controller.h"
+#include "master_pid.h"
+
+#define SLAVE_DUTY_MIN     250     // motor_slave: DUTY_MIN (bảng motor_char mặc định)
+#define PLANT_BREAKAWAY    230     // duty để trục bắt đầu quay
+#define PLANT_COULOMB      190     // duty chỉ đủ thắng ma sát động
+#define PLANT_GAIN         0.6     // độ/s mỗi đơn vị duty trên PLANT_COULOMB
+#define PLANT_TAU_MS       60.0
+#define PLANT_STOP_DPS     3.0     // dưới tốc độ này, không đủ duty -> dính lại
+
+#define SIM_MS             3000
+#define SETTLE_HOLD_MS     300     // phải nằm trong deadband liên tục từng này
+// Dừng ở mép deadband là hợp lệ; thêm 1 tick cho lượng tử encoder
+#define OVERSHOOT_MAX      (ANGLE_DEADBAND_DEG + 1.0)
+
+typedef struct {
+    int32_t from, to;
+    double  overshoot_max;         // độ, vượt quá đích theo chiều bước
+    int     settle_max_ms;
+} step_case_t;
+
+static const step_case_t s_cases[] = {
+    {   0,   90, OVERSHOOT_MAX, 900 },
+    {   0,   10, OVERSHOOT_MAX, 500 },
+    {  90,    0, OVERSHOOT_MAX, 900 },
+    {   0, -170, OVERSHOOT_MAX, 1400 },
+    {  45,   40, OVERSHOOT_MAX, 500 },
+};
+
+static int32_t slave_duty(int32_t effort)
+{
+    if (effort == 0) return 0;
+    int32_t mag = effort > 0 ? effort : -effort;
+    int32_t d   = SLAVE_DUTY_MIN + mag * (DUTY_MAX - SLAVE_DUTY_MIN) / DUTY_MAX;
+    return effort > 0 ? d : -d;
+}
+
+static void plant_step(double *theta, double *omega, int32_t duty, double dt_s)
+{
+    int32_t mag = duty > 0 ? duty : -duty;
+    if (*omega == 0.0 && mag <= PLANT_BREAKAWAY) {
+        return;
+    }
+    double target = 0.0;
+    if (mag > PLANT_COULOMB) {
+        target = (duty > 0 ? 1 : -1) * PLANT_GAIN * (mag - PLANT_COULOMB);
+    }
+    *omega += (target - *omega) * (dt_s * 1000.0 / PLANT_TAU_MS);
+    if (fabs(*omega) < PLANT_STOP_DPS && mag <= PLANT_BREAKAWAY) {
+        *omega = 0.0;
+    }
+    *theta += *omega * dt_s;
+}
+
+static int run_case(const step_case_t *c, bool use_rate)
+{
+    static const pid_gains_t gains[] = MASTER_PID_GAINS;
+    pid_config_t cfg = {
+        .gains       = gains,
+        .n_gains     = sizeof(gains) / sizeof(gains[0]),
+        .out_max     = DUTY_MAX,
+        .min_duty    = DUTY_MIN,
+        .integ_limit = INTEG_LIMIT,
+        .slew_max    = DUTY_STEP_MAX,
+        .deadband    = ANGLE_DEADBAND_DEG,
+    };
+    pid_handle_t pid;
+    if (pid_create(&cfg, &pid) != ESP_OK) {
+        printf("pid_create failed\n");
+        return 1;
+    }
+
+    const int period_ms = CONTROL_PERIOD_US / 1000;
+    double  theta = c->from, omega = 0.0;
+    int32_t duty = 0;
+    int     dir  = c->to > c->from ? 1 : -1;
+    double  overshoot = 0.0;
+    int     in_band_since = -1;
+    pid_reset(pid, c->from);
+
+    for (int t = 0; t < SIM_MS; t++) {
+        if (t % period_ms == 0) {
+            int32_t pos    = (int32_t)floor(theta);
+            int32_t effort;
+            if (use_rate) {
+                // Vận tốc Q8 (tick/s) * chu kỳ, như app_driver_encoder_get_current_velocity
+                int32_t rate_q8 = (int32_t)(omega * 256.0 * period_ms / 1000.0);
+                effort = pid_update_rate(pid, c->to - pos, rate_q8);
+            } else {
+                effort = pid_update(pid, c->to - pos, pos);
+            }
+            duty = slave_duty(effort);
+
+            bool in_band = abs(c->to - pos) <= ANGLE_DEADBAND_DEG && effort == 0;
+            if (!in_band)                in_band_since = -1;
+            else if (in_band_since < 0)  in_band_since = t;
+        }
+        plant_step(&theta, &omega, duty, 0.001);
+        double over = (theta - c->to) * dir;
+        if (over > overshoot) overshoot = over;
+    }
+    pid_delete(pid);
+
+    int settle_ms = (in_band_since >= 0 && SIM_MS - in_band_since >= SETTLE_HOLD_MS)
+                  ? in_band_since : -1;
+    bool ok = settle_ms >= 0 && settle_ms <= c->settle_max_ms && overshoot <= c->overshoot_max;
+    printf("%s step %4d -> %4d: overshoot %5.2f deg (max %.1f), settling %4d ms (max %d), final %6.2f  %s\n",
+           use_rate ? "rate" : "pos ", (int)c->from, (int)c->to, overshoot, c->overshoot_max, settle_ms, c->settle_max_ms,
+           theta, ok ? "OK" : "FAIL");
+    return ok ? 0 : 1;
+}
+
+int main(void)
+{
+    int fails = 0;
+    for (size_t i = 0; i < sizeof(s_cases) / sizeof(s_cases[0]); i++) {
+        fails += run_case(&s_cases[i], false);
+        fails += run_case(&s_cases[i], true);
+    }
+    printf("%s\n", fails ? "FAIL" : "OK");
+    return fails ? 1 : 0;
+}